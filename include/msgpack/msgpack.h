@@ -57,13 +57,80 @@ typedef enum msgpack_type {
     MSGPACK_TYPE_ARRAY = MSGPACK_TYPE_FIXARRAY,
 } msgpack_type;
 
+/* Heap hooks for buffers, readers and decoded object trees. Sizes are
+ * passed back on reallocate/deallocate so pool and tracking allocators do
+ * not need to record them. */
+typedef struct msgpack_allocator {
+    void *(*allocate)(size_t size, void *user_data);
+    void *(*reallocate)(void *ptr, size_t old_size, size_t new_size, void *user_data);
+    void (*deallocate)(void *ptr, size_t size, void *user_data);
+    void *user_data;
+} msgpack_allocator;
+
+typedef int (*msgpack_flush_func)(const uint8_t *data, size_t len, void *user_data);
+
+/* A buffer with a flush callback is bounded: instead of growing, it hands
+ * its contents to flush() whenever an append would not fit, and payloads
+ * larger than the whole buffer are passed through directly. */
 typedef struct msgpack_buffer {
     uint8_t *data;
     size_t capacity;
     size_t position;
     size_t length;
+    double growth_factor;
+    size_t max_grow_step;
+    msgpack_flush_func flush;
+    void *flush_user_data;
+    uint64_t flushed;
+    const msgpack_allocator *allocator;
 } msgpack_buffer;
 
+/* Bump-pointer cursor over the unused tail of a msgpack_buffer. Capacity is
+ * checked once by msgpack_writer_begin/msgpack_writer_ensure; the
+ * msgpack_pack_*_unchecked functions then write without any checks, so the
+ * caller must have reserved enough room (MSGPACK_WRITER_MAX_SCALAR bytes per
+ * call, plus payload lengths). The largest single write is a timestamp96
+ * (15 bytes); other scalars take at most 9 and str/bin/ext headers at most
+ * 6. */
+typedef struct msgpack_writer {
+    msgpack_buffer *buf;
+    uint8_t *ptr;
+    uint8_t *end;
+} msgpack_writer;
+
+#define MSGPACK_WRITER_MAX_SCALAR 15
+
+/* Timestamp bounds: nanoseconds must be below one second, and timestamp64
+ * holds seconds below 2^34 (later and negative times take timestamp96). */
+#define MSGPACK_NSEC_PER_SEC 1000000000u
+#define MSGPACK_TIMESTAMP64_MAX_SECONDS (1ull << 34)
+
+struct iovec;
+
+typedef struct msgpack_iovec_segment {
+    const uint8_t *ref;
+    size_t offset;
+    size_t len;
+} msgpack_iovec_segment;
+
+/* Scatter-gather output: headers and small values are packed into the
+ * scratch buffer, while str/bin/ext payloads of at least `threshold` bytes
+ * are kept as references to caller memory, which must stay valid until the
+ * iovec list has been written out. Any msgpack_pack_* function may be used
+ * on &w->scratch between the msgpack_iovec_pack_* calls. */
+typedef struct msgpack_iovec_writer {
+    msgpack_buffer scratch;
+    msgpack_iovec_segment *segments;
+    size_t segment_count;
+    size_t segment_capacity;
+    size_t mark;
+    size_t threshold;
+    struct iovec *iov;
+    size_t iov_capacity;
+} msgpack_iovec_writer;
+
+#define MSGPACK_IOVEC_DEFAULT_THRESHOLD 4096
+
 typedef struct msgpack_object {
     msgpack_type type;
     union {
@@ -101,12 +168,262 @@ typedef struct msgpack_object_kv {
     msgpack_object value;
 } msgpack_object_kv;
 
+struct msgpack_zone_chunk;
+
+/* Chunked bump allocator for decoded object trees. Everything allocated from
+ * a zone is released at once by msgpack_zone_reset (which keeps enough memory
+ * for the largest message seen so far) or msgpack_zone_free. */
+typedef struct msgpack_zone {
+    struct msgpack_zone_chunk *chunks;
+    uint8_t *ptr;
+    uint8_t *end;
+    size_t chunk_size;
+    size_t used;
+    size_t high_water;
+    const msgpack_allocator *allocator;
+} msgpack_zone;
+
+#define MSGPACK_ZONE_DEFAULT_CHUNK_SIZE 8192
+
+/* Maximum container nesting accepted by readers and serializers unless
+ * overridden; 0 disables the limit. */
+#define MSGPACK_DEFAULT_MAX_DEPTH 1024
+
 typedef struct msgpack_reader {
     const uint8_t *data;
     size_t length;
     size_t position;
+    const msgpack_allocator *allocator;
+    msgpack_zone *zone;
+    size_t max_depth;
+    bool validate_utf8;
+    /* input offset of the first invalid UTF-8 byte if the latest read
+     * failed on one, else SIZE_MAX */
+    size_t utf8_error_offset;
 } msgpack_reader;
 
+/* One value pulled from a reader by msgpack_cursor_next. Scalars carry their
+ * value, str/bin/ext point into the reader's input, and arrays/maps carry
+ * only their element count (key/value pairs for maps); their elements follow
+ * as subsequent tokens. */
+typedef struct msgpack_token {
+    msgpack_type type;
+    union {
+        bool b;
+        uint64_t u;
+        int64_t i;
+        double f;
+        struct {
+            uint32_t size;
+            const char *ptr;
+        } str;
+        struct {
+            uint32_t size;
+            const uint8_t *ptr;
+        } bin;
+        struct {
+            int8_t type;
+            uint32_t size;
+            const uint8_t *ptr;
+        } ext;
+        uint32_t count;
+        int64_t timestamp;
+    } as;
+} msgpack_token;
+
+/* One value in a structural index. Offsets are into the indexed input; next
+ * is the tape index just past this value's subtree, so skipping any value is
+ * a single jump. For an array holding a container, children is where its
+ * element indexes start in the tape's children table; otherwise it is
+ * SIZE_MAX and element i sits at index + 1 + i. */
+typedef struct msgpack_tape_entry {
+    size_t offset;
+    size_t end;
+    size_t next;
+    size_t children;
+    msgpack_type type;
+    uint32_t count;
+} msgpack_tape_entry;
+
+/* Flat pre-order index of every value in one message (map keys included),
+ * built in one pass by msgpack_tape_build. Rebuilding reuses the entries. */
+typedef struct msgpack_tape {
+    msgpack_tape_entry *entries;
+    size_t count;
+    size_t capacity;
+    size_t *children;
+    size_t children_count;
+    size_t children_capacity;
+    const uint8_t *data;
+    size_t length;
+    const msgpack_allocator *allocator;
+} msgpack_tape;
+
+/* Lazy handle on the value at the start of an encoded buffer. Lookups decode
+ * only the headers on the way to their target and skip everything else in
+ * place; views never allocate and their pointers refer to the buffer. */
+typedef struct msgpack_view {
+    const uint8_t *data;
+    size_t length;
+} msgpack_view;
+
+struct msgpack_projection_node;
+
+/* A set of key paths such as {"id", "meta.region"} compiled once by
+ * msgpack_projection_compile and applied to many messages by
+ * msgpack_read_projected. */
+typedef struct msgpack_projection {
+    struct msgpack_projection_node *nodes;
+    size_t node_count;
+    size_t node_capacity;
+    char *keys;
+    size_t keys_size;
+    const msgpack_allocator *allocator;
+} msgpack_projection;
+
+typedef enum {
+    MSGPACK_PREDICATE_EXISTS,
+    MSGPACK_PREDICATE_EQ,
+    MSGPACK_PREDICATE_LT,
+    MSGPACK_PREDICATE_LE,
+    MSGPACK_PREDICATE_GT,
+    MSGPACK_PREDICATE_GE,
+    MSGPACK_PREDICATE_PREFIX
+} msgpack_predicate_op;
+
+/* One condition on the field at path (msgpack_view_get syntax). Numbers
+ * compare by value across int/uint/float encodings; strings compare
+ * bytewise; EQ also matches nil and bool; PREFIX takes a string constant. */
+typedef struct msgpack_predicate {
+    const char *path;
+    msgpack_predicate_op op;
+    msgpack_object value;
+} msgpack_predicate;
+
+/* A conjunction of predicates compiled by msgpack_filter_compile. Paths and
+ * string constants are copied, so the caller's predicates need not outlive
+ * it. */
+typedef struct msgpack_filter {
+    msgpack_predicate *predicates;
+    size_t count;
+    char *strings;
+    size_t strings_size;
+    const msgpack_allocator *allocator;
+} msgpack_filter;
+
+/* Bounds enforced by msgpack_validate. Any field left 0 is unlimited. Sizes
+ * are payload bytes for str/bin/ext, and elements (key/value pairs for maps)
+ * for containers. */
+typedef struct msgpack_limits {
+    size_t max_depth;
+    uint32_t max_str_size;
+    uint32_t max_bin_size;
+    uint32_t max_ext_size;
+    uint32_t max_container_size;
+} msgpack_limits;
+
+/* Callback return codes for msgpack_parse. Any negative value aborts the
+ * parse. */
+#define MSGPACK_VISIT_CONTINUE 0
+#define MSGPACK_VISIT_SKIP 1
+
+/* SAX-style callbacks for msgpack_parse. NULL callbacks are ignored (the
+ * value is still consumed). Unsigned wire types go to on_uint and signed ones
+ * to on_int. str/bin/ext arrive as slices of the reader's input. Returning
+ * MSGPACK_VISIT_SKIP from on_array_begin/on_map_begin skips the container's
+ * elements and its end callback; from on_map_key it skips that key and its
+ * value. on_map_key is called before each key, which is then delivered through
+ * the regular value callbacks. */
+typedef struct msgpack_visitor {
+    int (*on_nil)(void *ctx);
+    int (*on_bool)(void *ctx, bool b);
+    int (*on_int)(void *ctx, int64_t i);
+    int (*on_uint)(void *ctx, uint64_t u);
+    int (*on_float)(void *ctx, double f);
+    int (*on_str)(void *ctx, const char *ptr, uint32_t size);
+    int (*on_bin)(void *ctx, const uint8_t *ptr, uint32_t size);
+    int (*on_ext)(void *ctx, int8_t type, const uint8_t *ptr, uint32_t size);
+    int (*on_timestamp)(void *ctx, int64_t seconds);
+    int (*on_array_begin)(void *ctx, uint32_t count);
+    int (*on_array_end)(void *ctx);
+    int (*on_map_begin)(void *ctx, uint32_t count);
+    int (*on_map_key)(void *ctx, uint32_t index);
+    int (*on_map_end)(void *ctx);
+} msgpack_visitor;
+
+/* Returned by msgpack_unpacker_next when the buffered bytes end mid-message. */
+#define MSGPACK_UNPACK_NEED_MORE 1
+
+/* Largest message an unpacker buffers unless overridden; 0 disables the
+ * limit. */
+#define MSGPACK_UNPACKER_DEFAULT_MAX_MESSAGE_SIZE ((size_t)64 << 20)
+
+/* Resumable decoder for input that arrives in arbitrary chunks. Bytes are
+ * buffered; the scan for the end of the current message (offset and number
+ * of values still pending) survives between calls, so every byte is scanned
+ * once and each message is decoded once, when it is complete. */
+typedef struct msgpack_unpacker {
+    msgpack_buffer buffer;
+    size_t consumed;
+    size_t scanned;
+    uint64_t pending;
+    uint64_t elements;
+    msgpack_zone *zone;
+    size_t max_depth;
+    size_t max_message_size;
+    uint64_t max_elements;
+    bool validate_utf8;
+    /* offset within the failed message of its first invalid UTF-8 byte */
+    size_t utf8_error_offset;
+} msgpack_unpacker;
+
+struct msgpack_pool_shared;
+
+/* Fixed set of worker threads for the parallel decoder and encoder. The
+ * calling thread works alongside them, so a pool of thread_count starts
+ * thread_count - 1 threads; 0 asks for one per online CPU. A job's tasks
+ * sit behind one shared atomic counter that every thread claims the next
+ * task from; there are no per-thread queues and no work stealing, which
+ * suits the few dozen coarse tasks per job the library hands it. Only
+ * available on POSIX systems. */
+typedef struct msgpack_pool {
+    struct msgpack_pool_shared *shared;
+    size_t thread_count;
+    const msgpack_allocator *allocator;
+} msgpack_pool;
+
+/* Arrays and maps with fewer elements than this are decoded on the calling
+ * thread by msgpack_read_object_parallel. */
+#define MSGPACK_PARALLEL_MIN_ELEMENTS 4096
+
+/* Output of msgpack_serialize_batch: the encodings of a batch of objects
+ * back to back in buffer, object i at [offsets[i], offsets[i + 1]). With
+ * wrap_array the buffer starts with one array header for the batch, so it
+ * is a single message. The per-thread scratch buffers are kept between
+ * calls. */
+typedef struct msgpack_batch {
+    msgpack_buffer buffer;
+    size_t *offsets;
+    size_t count;
+    size_t offsets_capacity;
+    msgpack_buffer *scratch;
+    size_t scratch_count;
+    size_t scratch_capacity;
+    size_t max_depth;
+    bool wrap_array;
+} msgpack_batch;
+
+/* CPU features the bulk kernels (typed arrays, UTF-8 validation) can use.
+ * msgpack_cpu_features reports the ones in use: everything the running CPU
+ * and OS support, detected once on first use, narrowed by
+ * msgpack_cpu_set_features. Always 0 on non-x86 builds. MSGPACK_CPU_AVX512
+ * means AVX-512 F and BW; the AVX-512 kernels also need MSGPACK_CPU_BMI2
+ * and fall back to AVX2 without it. */
+#define MSGPACK_CPU_SSE42 (1u << 0)
+#define MSGPACK_CPU_AVX2 (1u << 1)
+#define MSGPACK_CPU_AVX512 (1u << 2)
+#define MSGPACK_CPU_BMI2 (1u << 3)
+
 typedef struct msgpack_serializer msgpack_serializer;
 
 typedef int (*msgpack_serialize_func)(msgpack_serializer *serializer, const msgpack_object *obj, msgpack_buffer *buf);
@@ -115,20 +432,110 @@ typedef struct msgpack_serializer {
     msgpack_buffer buffer;
     msgpack_serialize_func serialize;
     void *user_data;
+    size_t max_depth;
 } msgpack_serializer;
 
 int msgpack_buffer_init(msgpack_buffer *buf, size_t initial_capacity);
+int msgpack_buffer_init_with_allocator(msgpack_buffer *buf, size_t initial_capacity, const msgpack_allocator *allocator);
 void msgpack_buffer_free(msgpack_buffer *buf);
 int msgpack_buffer_append(msgpack_buffer *buf, const void *data, size_t len);
 void msgpack_buffer_clear(msgpack_buffer *buf);
+int msgpack_buffer_reserve(msgpack_buffer *buf, size_t additional);
+int msgpack_buffer_shrink_to_fit(msgpack_buffer *buf);
+int msgpack_buffer_set_growth(msgpack_buffer *buf, double factor, size_t max_step);
+int msgpack_buffer_init_stream(msgpack_buffer *buf, size_t capacity, msgpack_flush_func flush, void *user_data);
+int msgpack_buffer_init_stream_with_allocator(msgpack_buffer *buf, size_t capacity, msgpack_flush_func flush, void *user_data,
+                                              const msgpack_allocator *allocator);
+int msgpack_buffer_init_fd(msgpack_buffer *buf, size_t capacity, int fd);
+int msgpack_buffer_init_fd_with_allocator(msgpack_buffer *buf, size_t capacity, int fd, const msgpack_allocator *allocator);
+int msgpack_buffer_flush(msgpack_buffer *buf);
 
 int msgpack_serializer_init(msgpack_serializer *serializer, size_t initial_capacity);
 void msgpack_serializer_free(msgpack_serializer *serializer);
+void msgpack_serializer_set_max_depth(msgpack_serializer *serializer, size_t max_depth);
 int msgpack_serialize(msgpack_serializer *serializer, const msgpack_object *obj);
+int msgpack_serialize_sized(msgpack_serializer *serializer, const msgpack_object *obj);
+int msgpack_object_packed_size(const msgpack_object *obj, size_t *size);
 
 int msgpack_reader_init(msgpack_reader *reader, const void *data, size_t len);
+void msgpack_reader_set_allocator(msgpack_reader *reader, const msgpack_allocator *allocator);
+void msgpack_reader_set_zone(msgpack_reader *reader, msgpack_zone *zone);
+void msgpack_reader_set_max_depth(msgpack_reader *reader, size_t max_depth);
+void msgpack_reader_set_validate_utf8(msgpack_reader *reader, bool validate);
 int msgpack_read_object(msgpack_reader *reader, msgpack_object *obj);
 void msgpack_object_free(msgpack_object *obj);
+void msgpack_object_free_with_allocator(msgpack_object *obj, const msgpack_allocator *allocator);
+int msgpack_read_object_compact(msgpack_reader *reader, msgpack_object *obj);
+void msgpack_object_free_compact(msgpack_object *obj, const msgpack_allocator *allocator);
+int msgpack_read_many(msgpack_reader *reader, msgpack_object *objs, size_t max, size_t *count);
+void msgpack_object_free_many(msgpack_object *objs, size_t count, const msgpack_allocator *allocator);
+int msgpack_cursor_next(msgpack_reader *reader, msgpack_token *token);
+int msgpack_parse(msgpack_reader *reader, const msgpack_visitor *visitor, void *ctx);
+int msgpack_skip_object(msgpack_reader *reader);
+int msgpack_validate(const void *data, size_t len, const msgpack_limits *limits);
+int msgpack_scan_boundaries(const void *data, size_t len, size_t *offsets, size_t max, size_t *count);
+
+int msgpack_tape_init(msgpack_tape *tape, size_t initial_capacity);
+int msgpack_tape_init_with_allocator(msgpack_tape *tape, size_t initial_capacity, const msgpack_allocator *allocator);
+void msgpack_tape_free(msgpack_tape *tape);
+int msgpack_tape_build(msgpack_tape *tape, msgpack_reader *reader);
+int msgpack_tape_read(const msgpack_tape *tape, size_t index, msgpack_object *obj);
+int msgpack_tape_array_at(const msgpack_tape *tape, size_t index, uint32_t i, size_t *out);
+int msgpack_tape_map_find(const msgpack_tape *tape, size_t index, const char *key, size_t key_len, size_t *out);
+
+int msgpack_view_init(msgpack_view *view, const void *data, size_t len);
+int msgpack_view_get(const msgpack_view *view, const char *path, msgpack_view *out);
+int msgpack_view_read(const msgpack_view *view, msgpack_object *obj);
+int msgpack_view_get_bool(const msgpack_view *view, const char *path, bool *out);
+int msgpack_view_get_int(const msgpack_view *view, const char *path, int64_t *out);
+int msgpack_view_get_uint(const msgpack_view *view, const char *path, uint64_t *out);
+int msgpack_view_get_float(const msgpack_view *view, const char *path, double *out);
+int msgpack_view_get_str(const msgpack_view *view, const char *path, const char **ptr, uint32_t *size);
+
+int msgpack_projection_compile(msgpack_projection *proj, const char *const *paths, size_t count);
+int msgpack_projection_compile_with_allocator(msgpack_projection *proj, const char *const *paths, size_t count, const msgpack_allocator *allocator);
+void msgpack_projection_free(msgpack_projection *proj);
+int msgpack_read_projected(msgpack_reader *reader, const msgpack_projection *proj, msgpack_object *obj);
+
+int msgpack_filter_compile(msgpack_filter *filter, const msgpack_predicate *predicates, size_t count);
+int msgpack_filter_compile_with_allocator(msgpack_filter *filter, const msgpack_predicate *predicates, size_t count, const msgpack_allocator *allocator);
+void msgpack_filter_free(msgpack_filter *filter);
+bool msgpack_filter_match(const msgpack_filter *filter, const void *data, size_t len);
+int msgpack_read_filtered(msgpack_reader *reader, const msgpack_filter *filter, msgpack_object *obj);
+
+int msgpack_unpacker_init(msgpack_unpacker *unpacker, size_t initial_capacity);
+int msgpack_unpacker_init_with_allocator(msgpack_unpacker *unpacker, size_t initial_capacity, const msgpack_allocator *allocator);
+void msgpack_unpacker_free(msgpack_unpacker *unpacker);
+void msgpack_unpacker_reset(msgpack_unpacker *unpacker);
+void msgpack_unpacker_set_zone(msgpack_unpacker *unpacker, msgpack_zone *zone);
+void msgpack_unpacker_set_max_depth(msgpack_unpacker *unpacker, size_t max_depth);
+void msgpack_unpacker_set_max_message_size(msgpack_unpacker *unpacker, size_t max_message_size);
+void msgpack_unpacker_set_max_elements(msgpack_unpacker *unpacker, uint64_t max_elements);
+void msgpack_unpacker_set_validate_utf8(msgpack_unpacker *unpacker, bool validate);
+int msgpack_unpacker_feed(msgpack_unpacker *unpacker, const void *data, size_t len);
+uint8_t *msgpack_unpacker_reserve(msgpack_unpacker *unpacker, size_t len);
+void msgpack_unpacker_commit(msgpack_unpacker *unpacker, size_t len);
+int msgpack_unpacker_next(msgpack_unpacker *unpacker, msgpack_object *obj);
+
+int msgpack_pool_init(msgpack_pool *pool, size_t thread_count);
+int msgpack_pool_init_with_allocator(msgpack_pool *pool, size_t thread_count, const msgpack_allocator *allocator);
+void msgpack_pool_free(msgpack_pool *pool);
+int msgpack_read_object_parallel(msgpack_reader *reader, msgpack_object *obj, msgpack_pool *pool);
+int msgpack_batch_init(msgpack_batch *batch, size_t initial_capacity);
+int msgpack_batch_init_with_allocator(msgpack_batch *batch, size_t initial_capacity, const msgpack_allocator *allocator);
+void msgpack_batch_free(msgpack_batch *batch);
+void msgpack_batch_set_max_depth(msgpack_batch *batch, size_t max_depth);
+void msgpack_batch_set_wrap_array(msgpack_batch *batch, bool wrap_array);
+int msgpack_serialize_batch(const msgpack_object *objs, size_t n, msgpack_pool *pool, msgpack_batch *out);
+
+unsigned msgpack_cpu_features(void);
+void msgpack_cpu_set_features(unsigned mask);
+
+int msgpack_zone_init(msgpack_zone *zone, size_t chunk_size);
+int msgpack_zone_init_with_allocator(msgpack_zone *zone, size_t chunk_size, const msgpack_allocator *allocator);
+void *msgpack_zone_alloc(msgpack_zone *zone, size_t size);
+void msgpack_zone_reset(msgpack_zone *zone);
+void msgpack_zone_free(msgpack_zone *zone);
 
 int msgpack_pack_nil(msgpack_buffer *buf);
 int msgpack_pack_bool(msgpack_buffer *buf, bool b);
@@ -142,6 +549,29 @@ int msgpack_pack_map(msgpack_buffer *buf, uint32_t size);
 int msgpack_pack_ext(msgpack_buffer *buf, int8_t type, const uint8_t *data, size_t len);
 int msgpack_pack_timestamp(msgpack_buffer *buf, int64_t seconds, uint32_t nanoseconds);
 
+int msgpack_pack_int64_array(msgpack_buffer *buf, const int64_t *values, size_t n);
+int msgpack_pack_uint64_array(msgpack_buffer *buf, const uint64_t *values, size_t n);
+int msgpack_pack_double_array(msgpack_buffer *buf, const double *values, size_t n);
+int msgpack_pack_float_array(msgpack_buffer *buf, const float *values, size_t n);
+int msgpack_read_int64_array(msgpack_reader *reader, int64_t *values, size_t max, size_t *count);
+int msgpack_read_uint64_array(msgpack_reader *reader, uint64_t *values, size_t max, size_t *count);
+int msgpack_read_double_array(msgpack_reader *reader, double *values, size_t max, size_t *count);
+int msgpack_read_float_array(msgpack_reader *reader, float *values, size_t max, size_t *count);
+
+int msgpack_writer_begin(msgpack_writer *w, msgpack_buffer *buf, size_t reserve);
+int msgpack_writer_ensure(msgpack_writer *w, size_t len);
+void msgpack_writer_end(msgpack_writer *w);
+
+int msgpack_iovec_writer_init(msgpack_iovec_writer *w, size_t threshold);
+int msgpack_iovec_writer_init_with_allocator(msgpack_iovec_writer *w, size_t threshold, const msgpack_allocator *allocator);
+void msgpack_iovec_writer_free(msgpack_iovec_writer *w);
+void msgpack_iovec_writer_clear(msgpack_iovec_writer *w);
+int msgpack_iovec_pack_str(msgpack_iovec_writer *w, const char *str, size_t len);
+int msgpack_iovec_pack_bin(msgpack_iovec_writer *w, const uint8_t *bin, size_t len);
+int msgpack_iovec_pack_ext(msgpack_iovec_writer *w, int8_t type, const uint8_t *data, size_t len);
+int msgpack_iovec_writer_finish(msgpack_iovec_writer *w, const struct iovec **iov, size_t *iovcnt);
+size_t msgpack_iovec_writer_length(const msgpack_iovec_writer *w);
+
 static inline uint8_t msgpack_format_posfixint(uint8_t value) {
     return value & 0x7F;
 }
@@ -190,8 +620,287 @@ static inline int8_t msgpack_fixext_type(uint8_t b) {
     return (int8_t)(b & 0x0F);
 }
 
+/* Payload size of a fixext lead byte (msgpack_is_fixext): 1, 2, 4, 8 or 16
+ * for 0xD4-0xD8. 1.0.0 returned the low nibble (4-8) instead; see Changes
+ * in the README. */
 static inline uint8_t msgpack_fixext_size(uint8_t b) {
-    return (b & 0x0F);
+    return (uint8_t)(1u << (b - 0xD4));
+}
+
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define msgpack_be16(v) ((uint16_t)(v))
+#define msgpack_be32(v) ((uint32_t)(v))
+#define msgpack_be64(v) ((uint64_t)(v))
+#elif defined(__GNUC__) || defined(__clang__)
+#define msgpack_be16(v) __builtin_bswap16((uint16_t)(v))
+#define msgpack_be32(v) __builtin_bswap32((uint32_t)(v))
+#define msgpack_be64(v) __builtin_bswap64((uint64_t)(v))
+#else
+static inline uint16_t msgpack_be16(uint16_t v) {
+    return (uint16_t)((v >> 8) | (v << 8));
+}
+
+static inline uint32_t msgpack_be32(uint32_t v) {
+    return ((v & 0xFF) << 24) | ((v & 0xFF00) << 8) | ((v >> 8) & 0xFF00) | (v >> 24);
+}
+
+static inline uint64_t msgpack_be64(uint64_t v) {
+    return ((uint64_t)msgpack_be32((uint32_t)v) << 32) | msgpack_be32((uint32_t)(v >> 32));
+}
+#endif
+
+static inline void msgpack_store_be16(uint8_t *p, uint16_t v) {
+    v = msgpack_be16(v);
+    memcpy(p, &v, 2);
+}
+
+static inline void msgpack_store_be32(uint8_t *p, uint32_t v) {
+    v = msgpack_be32(v);
+    memcpy(p, &v, 4);
+}
+
+static inline void msgpack_store_be64(uint8_t *p, uint64_t v) {
+    v = msgpack_be64(v);
+    memcpy(p, &v, 8);
+}
+
+static inline uint16_t msgpack_load_be16(const uint8_t *p) {
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return msgpack_be16(v);
+}
+
+static inline uint32_t msgpack_load_be32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return msgpack_be32(v);
+}
+
+static inline uint64_t msgpack_load_be64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return msgpack_be64(v);
+}
+
+static inline size_t msgpack_reader_remaining(const msgpack_reader *reader) {
+    return reader->length - reader->position;
+}
+
+static inline size_t msgpack_writer_remaining(const msgpack_writer *w) {
+    return (size_t)(w->end - w->ptr);
+}
+
+static inline void msgpack_pack_nil_unchecked(msgpack_writer *w) {
+    *w->ptr++ = 0xC0;
+}
+
+static inline void msgpack_pack_bool_unchecked(msgpack_writer *w, bool b) {
+    *w->ptr++ = b ? 0xC3 : 0xC2;
+}
+
+static inline void msgpack_pack_uint_unchecked(msgpack_writer *w, uint64_t u) {
+    uint8_t *p = w->ptr;
+    if (u <= 127) {
+        p[0] = (uint8_t)u;
+        w->ptr = p + 1;
+    } else if (u <= 0xFF) {
+        p[0] = 0xCC;
+        p[1] = (uint8_t)u;
+        w->ptr = p + 2;
+    } else if (u <= 0xFFFF) {
+        p[0] = 0xCD;
+        msgpack_store_be16(p + 1, (uint16_t)u);
+        w->ptr = p + 3;
+    } else if (u <= 0xFFFFFFFF) {
+        p[0] = 0xCE;
+        msgpack_store_be32(p + 1, (uint32_t)u);
+        w->ptr = p + 5;
+    } else {
+        p[0] = 0xCF;
+        msgpack_store_be64(p + 1, u);
+        w->ptr = p + 9;
+    }
+}
+
+static inline void msgpack_pack_int_unchecked(msgpack_writer *w, int64_t i) {
+    if (i >= 0) {
+        msgpack_pack_uint_unchecked(w, (uint64_t)i);
+        return;
+    }
+    uint8_t *p = w->ptr;
+    if (i >= -32) {
+        p[0] = (uint8_t)i;
+        w->ptr = p + 1;
+    } else if (i >= -128) {
+        p[0] = 0xD0;
+        p[1] = (uint8_t)i;
+        w->ptr = p + 2;
+    } else if (i >= -32768) {
+        p[0] = 0xD1;
+        msgpack_store_be16(p + 1, (uint16_t)i);
+        w->ptr = p + 3;
+    } else if (i >= -2147483648LL) {
+        p[0] = 0xD2;
+        msgpack_store_be32(p + 1, (uint32_t)i);
+        w->ptr = p + 5;
+    } else {
+        p[0] = 0xD3;
+        msgpack_store_be64(p + 1, (uint64_t)i);
+        w->ptr = p + 9;
+    }
+}
+
+static inline void msgpack_pack_float_unchecked(msgpack_writer *w, double f) {
+    uint8_t *p = w->ptr;
+    float f32 = (float)f;
+    if ((double)f32 == f) {
+        uint32_t bits;
+        memcpy(&bits, &f32, 4);
+        p[0] = 0xCA;
+        msgpack_store_be32(p + 1, bits);
+        w->ptr = p + 5;
+    } else {
+        uint64_t bits;
+        memcpy(&bits, &f, 8);
+        p[0] = 0xCB;
+        msgpack_store_be64(p + 1, bits);
+        w->ptr = p + 9;
+    }
+}
+
+static inline void msgpack_pack_str_header_unchecked(msgpack_writer *w, size_t len) {
+    uint8_t *p = w->ptr;
+    if (len <= 31) {
+        p[0] = (uint8_t)(0xA0 | len);
+        w->ptr = p + 1;
+    } else if (len <= 255) {
+        p[0] = 0xD9;
+        p[1] = (uint8_t)len;
+        w->ptr = p + 2;
+    } else if (len <= 0xFFFF) {
+        p[0] = 0xDA;
+        msgpack_store_be16(p + 1, (uint16_t)len);
+        w->ptr = p + 3;
+    } else {
+        p[0] = 0xDB;
+        msgpack_store_be32(p + 1, (uint32_t)len);
+        w->ptr = p + 5;
+    }
+}
+
+static inline void msgpack_pack_str_unchecked(msgpack_writer *w, const char *str, size_t len) {
+    msgpack_pack_str_header_unchecked(w, len);
+    memcpy(w->ptr, str, len);
+    w->ptr += len;
+}
+
+static inline void msgpack_pack_bin_header_unchecked(msgpack_writer *w, size_t len) {
+    uint8_t *p = w->ptr;
+    if (len <= 255) {
+        p[0] = 0xC4;
+        p[1] = (uint8_t)len;
+        w->ptr = p + 2;
+    } else if (len <= 0xFFFF) {
+        p[0] = 0xC5;
+        msgpack_store_be16(p + 1, (uint16_t)len);
+        w->ptr = p + 3;
+    } else {
+        p[0] = 0xC6;
+        msgpack_store_be32(p + 1, (uint32_t)len);
+        w->ptr = p + 5;
+    }
+}
+
+static inline void msgpack_pack_bin_unchecked(msgpack_writer *w, const uint8_t *bin, size_t len) {
+    msgpack_pack_bin_header_unchecked(w, len);
+    memcpy(w->ptr, bin, len);
+    w->ptr += len;
+}
+
+static inline void msgpack_pack_container_unchecked(msgpack_writer *w, uint8_t fix, uint8_t tag16, uint32_t size) {
+    uint8_t *p = w->ptr;
+    if (size <= 15) {
+        p[0] = (uint8_t)(fix | size);
+        w->ptr = p + 1;
+    } else if (size <= 0xFFFF) {
+        p[0] = tag16;
+        msgpack_store_be16(p + 1, (uint16_t)size);
+        w->ptr = p + 3;
+    } else {
+        p[0] = (uint8_t)(tag16 + 1);
+        msgpack_store_be32(p + 1, size);
+        w->ptr = p + 5;
+    }
+}
+
+static inline void msgpack_pack_array_unchecked(msgpack_writer *w, uint32_t size) {
+    msgpack_pack_container_unchecked(w, 0x90, 0xDC, size);
+}
+
+static inline void msgpack_pack_map_unchecked(msgpack_writer *w, uint32_t size) {
+    msgpack_pack_container_unchecked(w, 0x80, 0xDE, size);
+}
+
+static inline void msgpack_pack_ext_header_unchecked(msgpack_writer *w, int8_t type, size_t len) {
+    uint8_t *p = w->ptr;
+    switch (len) {
+        case 1: p[0] = 0xD4; p += 1; break;
+        case 2: p[0] = 0xD5; p += 1; break;
+        case 4: p[0] = 0xD6; p += 1; break;
+        case 8: p[0] = 0xD7; p += 1; break;
+        case 16: p[0] = 0xD8; p += 1; break;
+        default:
+            if (len <= 255) {
+                p[0] = 0xC7;
+                p[1] = (uint8_t)len;
+                p += 2;
+            } else if (len <= 0xFFFF) {
+                p[0] = 0xC8;
+                msgpack_store_be16(p + 1, (uint16_t)len);
+                p += 3;
+            } else {
+                p[0] = 0xC9;
+                msgpack_store_be32(p + 1, (uint32_t)len);
+                p += 5;
+            }
+            break;
+    }
+    *p++ = (uint8_t)type;
+    w->ptr = p;
+}
+
+static inline void msgpack_pack_ext_unchecked(msgpack_writer *w, int8_t type, const uint8_t *data, size_t len) {
+    msgpack_pack_ext_header_unchecked(w, type, len);
+    memcpy(w->ptr, data, len);
+    w->ptr += len;
+}
+
+/* Same layouts and checks as msgpack_pack_timestamp; writes nothing and
+ * returns -1 for nanoseconds of a second or more. */
+static inline int msgpack_pack_timestamp_unchecked(msgpack_writer *w, int64_t seconds, uint32_t nanoseconds) {
+    if (nanoseconds >= MSGPACK_NSEC_PER_SEC) {
+        return -1;
+    }
+    uint8_t *p = w->ptr;
+    if (nanoseconds == 0 && seconds >= 0 && seconds <= 0xFFFFFFFFLL) {
+        p[0] = 0xD6;
+        p[1] = 0xFF;
+        msgpack_store_be32(p + 2, (uint32_t)seconds);
+        w->ptr = p + 6;
+    } else if (seconds >= 0 && (uint64_t)seconds < MSGPACK_TIMESTAMP64_MAX_SECONDS) {
+        p[0] = 0xD7;
+        p[1] = 0xFF;
+        msgpack_store_be64(p + 2, ((uint64_t)nanoseconds << 34) | (uint64_t)seconds);
+        w->ptr = p + 10;
+    } else {
+        p[0] = 0xC7;
+        p[1] = 12;
+        p[2] = 0xFF;
+        msgpack_store_be32(p + 3, nanoseconds);
+        msgpack_store_be64(p + 7, (uint64_t)seconds);
+        w->ptr = p + 15;
+    }
+    return 0;
 }
 
 #ifdef __cplusplus
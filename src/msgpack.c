@@ -1,27 +1,113 @@
 #include "msgpack/msgpack.h"
+#include "msgpack_internal.h"
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <errno.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
 
 #define MSGPACK_BUFFER_GROW_SIZE 256
+#define MSGPACK_BUFFER_GROWTH_FACTOR 2.0
+#define MSGPACK_BUFFER_MAX_GROW_STEP ((size_t)64 * 1024 * 1024)
 
 int msgpack_buffer_init(msgpack_buffer *buf, size_t initial_capacity) {
+    return msgpack_buffer_init_with_allocator(buf, initial_capacity, NULL);
+}
+
+int msgpack_buffer_init_with_allocator(msgpack_buffer *buf, size_t initial_capacity, const msgpack_allocator *allocator) {
     if (initial_capacity == 0) {
         initial_capacity = MSGPACK_BUFFER_GROW_SIZE;
     }
-    buf->data = (uint8_t *)malloc(initial_capacity);
+    buf->allocator = allocator;
+    buf->data = (uint8_t *)msgpack_alloc(allocator, initial_capacity);
     if (!buf->data) {
         return -1;
     }
     buf->capacity = initial_capacity;
     buf->position = 0;
     buf->length = 0;
+    buf->growth_factor = MSGPACK_BUFFER_GROWTH_FACTOR;
+    buf->max_grow_step = MSGPACK_BUFFER_MAX_GROW_STEP;
+    buf->flush = NULL;
+    buf->flush_user_data = NULL;
+    buf->flushed = 0;
+    return 0;
+}
+
+int msgpack_buffer_init_stream(msgpack_buffer *buf, size_t capacity, msgpack_flush_func flush, void *user_data) {
+    return msgpack_buffer_init_stream_with_allocator(buf, capacity, flush, user_data, NULL);
+}
+
+int msgpack_buffer_init_stream_with_allocator(msgpack_buffer *buf, size_t capacity, msgpack_flush_func flush, void *user_data,
+                                              const msgpack_allocator *allocator) {
+    if (!flush) {
+        return -1;
+    }
+    if (msgpack_buffer_init_with_allocator(buf, capacity, allocator) != 0) {
+        return -1;
+    }
+    buf->flush = flush;
+    buf->flush_user_data = user_data;
+    return 0;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+static int msgpack_fd_flush(const uint8_t *data, size_t len, void *user_data) {
+    int fd = (int)(intptr_t)user_data;
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int msgpack_buffer_init_fd_with_allocator(msgpack_buffer *buf, size_t capacity, int fd, const msgpack_allocator *allocator) {
+    return msgpack_buffer_init_stream_with_allocator(buf, capacity, msgpack_fd_flush, (void *)(intptr_t)fd, allocator);
+}
+#else
+int msgpack_buffer_init_fd_with_allocator(msgpack_buffer *buf, size_t capacity, int fd, const msgpack_allocator *allocator) {
+    (void)buf;
+    (void)capacity;
+    (void)fd;
+    (void)allocator;
+    return -1;
+}
+#endif
+
+int msgpack_buffer_init_fd(msgpack_buffer *buf, size_t capacity, int fd) {
+    return msgpack_buffer_init_fd_with_allocator(buf, capacity, fd, NULL);
+}
+
+static int msgpack_buffer_emit(msgpack_buffer *buf, const void *data, size_t len) {
+    if (buf->flush(data, len, buf->flush_user_data) != 0) {
+        return -1;
+    }
+    buf->flushed += len;
+    return 0;
+}
+
+int msgpack_buffer_flush(msgpack_buffer *buf) {
+    if (!buf->flush || buf->length == 0) {
+        return 0;
+    }
+    if (msgpack_buffer_emit(buf, buf->data, buf->length) != 0) {
+        return -1;
+    }
+    buf->length = 0;
+    buf->position = 0;
     return 0;
 }
 
 void msgpack_buffer_free(msgpack_buffer *buf) {
     if (buf->data) {
-        free(buf->data);
+        msgpack_dealloc(buf->allocator, buf->data, buf->capacity);
         buf->data = NULL;
     }
     buf->capacity = 0;
@@ -29,30 +115,140 @@ void msgpack_buffer_free(msgpack_buffer *buf) {
     buf->position = 0;
 }
 
+static int msgpack_buffer_resize(msgpack_buffer *buf, size_t new_capacity) {
+    uint8_t *new_data = (uint8_t *)msgpack_realloc(buf->allocator, buf->data, buf->capacity, new_capacity);
+    if (!new_data) {
+        return -1;
+    }
+    buf->data = new_data;
+    buf->capacity = new_capacity;
+    return 0;
+}
+
+/* Grows capacity geometrically so a long run of appends costs amortized O(1)
+ * reallocations; each step is capped at max_grow_step (0 means uncapped). */
+static int msgpack_buffer_grow(msgpack_buffer *buf, size_t required) {
+    double factor = buf->growth_factor > 1.0 ? buf->growth_factor : MSGPACK_BUFFER_GROWTH_FACTOR;
+    size_t step = MSGPACK_BUFFER_GROW_SIZE;
+    double scaled = (double)buf->capacity * (factor - 1.0);
+    if (scaled > (double)step) {
+        step = scaled >= (double)SIZE_MAX ? SIZE_MAX : (size_t)scaled;
+    }
+    if (buf->max_grow_step != 0 && step > buf->max_grow_step) {
+        step = buf->max_grow_step;
+    }
+    size_t new_capacity = buf->capacity > SIZE_MAX - step ? SIZE_MAX : buf->capacity + step;
+    if (new_capacity < required) {
+        new_capacity = required;
+    }
+    return msgpack_buffer_resize(buf, new_capacity);
+}
+
+static int msgpack_buffer_ensure(msgpack_buffer *buf, size_t len) {
+    if (len <= buf->capacity - buf->length) {
+        return 0;
+    }
+    if (buf->flush) {
+        if (msgpack_buffer_flush(buf) != 0) {
+            return -1;
+        }
+        return len <= buf->capacity ? 0 : -1;
+    }
+    if (len > SIZE_MAX - buf->length) {
+        return -1;
+    }
+    return msgpack_buffer_grow(buf, buf->length + len);
+}
+
 int msgpack_buffer_append(msgpack_buffer *buf, const void *data, size_t len) {
-    if (buf->length + len > buf->capacity) {
-        size_t new_capacity = buf->capacity + len + MSGPACK_BUFFER_GROW_SIZE;
-        uint8_t *new_data = (uint8_t *)realloc(buf->data, new_capacity);
-        if (!new_data) {
+    if (buf->flush && len > buf->capacity) {
+        if (msgpack_buffer_flush(buf) != 0) {
             return -1;
         }
-        buf->data = new_data;
-        buf->capacity = new_capacity;
+        return msgpack_buffer_emit(buf, data, len);
+    }
+    if (msgpack_buffer_ensure(buf, len) != 0) {
+        return -1;
     }
     memcpy(buf->data + buf->length, data, len);
     buf->length += len;
     return 0;
 }
 
+int msgpack_buffer_reserve(msgpack_buffer *buf, size_t additional) {
+    if (additional <= buf->capacity - buf->length) {
+        return 0;
+    }
+    if (buf->flush) {
+        return msgpack_buffer_ensure(buf, additional);
+    }
+    if (additional > SIZE_MAX - buf->length) {
+        return -1;
+    }
+    return msgpack_buffer_resize(buf, buf->length + additional);
+}
+
+int msgpack_buffer_shrink_to_fit(msgpack_buffer *buf) {
+    if (buf->flush) {
+        return 0;
+    }
+    size_t new_capacity = buf->length > 0 ? buf->length : 1;
+    if (new_capacity >= buf->capacity) {
+        return 0;
+    }
+    return msgpack_buffer_resize(buf, new_capacity);
+}
+
+int msgpack_buffer_set_growth(msgpack_buffer *buf, double factor, size_t max_step) {
+    if (!(factor > 1.0)) {
+        return -1;
+    }
+    buf->growth_factor = factor;
+    buf->max_grow_step = max_step;
+    return 0;
+}
+
 void msgpack_buffer_clear(msgpack_buffer *buf) {
     buf->position = 0;
     buf->length = 0;
 }
 
+int msgpack_writer_begin(msgpack_writer *w, msgpack_buffer *buf, size_t reserve) {
+    if (msgpack_buffer_reserve(buf, reserve) != 0) {
+        return -1;
+    }
+    w->buf = buf;
+    w->ptr = buf->data + buf->length;
+    w->end = buf->data + buf->capacity;
+    return 0;
+}
+
+int msgpack_writer_ensure(msgpack_writer *w, size_t len) {
+    if (len <= msgpack_writer_remaining(w)) {
+        return 0;
+    }
+    msgpack_writer_end(w);
+    if (msgpack_buffer_ensure(w->buf, len) != 0) {
+        return -1;
+    }
+    w->ptr = w->buf->data + w->buf->length;
+    w->end = w->buf->data + w->buf->capacity;
+    return 0;
+}
+
+void msgpack_writer_end(msgpack_writer *w) {
+    w->buf->length = (size_t)(w->ptr - w->buf->data);
+}
+
 int msgpack_serializer_init(msgpack_serializer *serializer, size_t initial_capacity) {
+    serializer->max_depth = MSGPACK_DEFAULT_MAX_DEPTH;
     return msgpack_buffer_init(&serializer->buffer, initial_capacity);
 }
 
+void msgpack_serializer_set_max_depth(msgpack_serializer *serializer, size_t max_depth) {
+    serializer->max_depth = max_depth;
+}
+
 void msgpack_serializer_free(msgpack_serializer *serializer) {
     msgpack_buffer_free(&serializer->buffer);
 }
@@ -228,7 +424,14 @@ int msgpack_pack_ext(msgpack_buffer *buf, int8_t type, const uint8_t *data, size
     return msgpack_buffer_append(buf, data, len);
 }
 
+/* Packs the smallest of the spec's layouts: timestamp32 for whole seconds
+ * that fit in 32 bits, timestamp64 for seconds below 2^34, timestamp96
+ * otherwise. Nanoseconds of a second or more are rejected: timestamp64 only
+ * has 30 bits for them. */
 int msgpack_pack_timestamp(msgpack_buffer *buf, int64_t seconds, uint32_t nanoseconds) {
+    if (nanoseconds >= MSGPACK_NSEC_PER_SEC) {
+        return -1;
+    }
     if (nanoseconds == 0 && seconds >= 0 && seconds <= 0xFFFFFFFFLL) {
         uint8_t bytes[6];
         bytes[0] = 0xD6;
@@ -239,20 +442,12 @@ int msgpack_pack_timestamp(msgpack_buffer *buf, int64_t seconds, uint32_t nanose
         bytes[4] = (uint8_t)((sec >> 8) & 0xFF);
         bytes[5] = (uint8_t)(sec & 0xFF);
         return msgpack_buffer_append(buf, bytes, 6);
-    } else if ((uint64_t)seconds <= 0xFFFFFFFF) {
+    } else if (seconds >= 0 && (uint64_t)seconds < MSGPACK_TIMESTAMP64_MAX_SECONDS) {
         uint8_t bytes[10];
         bytes[0] = 0xD7;
         bytes[1] = (int8_t)-1;
-        uint32_t ns = nanoseconds;
-        uint32_t sec = (uint32_t)seconds;
-        bytes[2] = (uint8_t)((ns >> 24) & 0xFF);
-        bytes[3] = (uint8_t)((ns >> 16) & 0xFF);
-        bytes[4] = (uint8_t)((ns >> 8) & 0xFF);
-        bytes[5] = (uint8_t)(ns & 0xFF);
-        bytes[6] = (uint8_t)((sec >> 24) & 0xFF);
-        bytes[7] = (uint8_t)((sec >> 16) & 0xFF);
-        bytes[8] = (uint8_t)((sec >> 8) & 0xFF);
-        bytes[9] = (uint8_t)(sec & 0xFF);
+        /* 30 bits of nanoseconds above 34 bits of seconds */
+        msgpack_store_be64(bytes + 2, ((uint64_t)nanoseconds << 34) | (uint64_t)seconds);
         return msgpack_buffer_append(buf, bytes, 10);
     } else {
         uint8_t bytes[15];
@@ -277,69 +472,231 @@ int msgpack_pack_timestamp(msgpack_buffer *buf, int64_t seconds, uint32_t nanose
     }
 }
 
-static int msgpack_serialize_recursive(msgpack_serializer *serializer, const msgpack_object *obj);
+static int msgpack_serialize_node(const msgpack_object *obj, void *ctx) {
+    msgpack_buffer *buf = (msgpack_buffer *)ctx;
+    switch (obj->type) {
+        case MSGPACK_TYPE_NIL:
+            return msgpack_pack_nil(buf);
+        case MSGPACK_TYPE_BOOL:
+            return msgpack_pack_bool(buf, obj->as.b);
+        case MSGPACK_TYPE_POSITIVE_FIXINT:
+        case MSGPACK_TYPE_UINT8:
+        case MSGPACK_TYPE_UINT16:
+        case MSGPACK_TYPE_UINT32:
+        case MSGPACK_TYPE_UINT64:
+            return msgpack_pack_uint(buf, obj->as.u);
+        case MSGPACK_TYPE_NEGATIVE_FIXINT:
+        case MSGPACK_TYPE_INT8:
+        case MSGPACK_TYPE_INT16:
+        case MSGPACK_TYPE_INT32:
+        case MSGPACK_TYPE_INT64:
+            return msgpack_pack_int(buf, obj->as.i);
+        case MSGPACK_TYPE_FLOAT32:
+        case MSGPACK_TYPE_FLOAT64:
+            return msgpack_pack_float(buf, obj->as.f);
+        case MSGPACK_TYPE_FIXSTR:
+        case MSGPACK_TYPE_STR8:
+        case MSGPACK_TYPE_STR16:
+        case MSGPACK_TYPE_STR32:
+            return msgpack_pack_str(buf, obj->as.str.ptr, obj->as.str.size);
+        case MSGPACK_TYPE_BIN8:
+        case MSGPACK_TYPE_BIN16:
+        case MSGPACK_TYPE_BIN32:
+            return msgpack_pack_bin(buf, obj->as.bin.ptr, obj->as.bin.size);
+        case MSGPACK_TYPE_FIXARRAY:
+        case MSGPACK_TYPE_ARRAY16:
+        case MSGPACK_TYPE_ARRAY32:
+            return msgpack_pack_array(buf, obj->as.array.size);
+        case MSGPACK_TYPE_FIXMAP:
+        case MSGPACK_TYPE_MAP16:
+        case MSGPACK_TYPE_MAP32:
+            return msgpack_pack_map(buf, obj->as.map.size);
+        case MSGPACK_TYPE_FIXEXT1:
+        case MSGPACK_TYPE_FIXEXT2:
+        case MSGPACK_TYPE_FIXEXT4:
+        case MSGPACK_TYPE_FIXEXT8:
+        case MSGPACK_TYPE_FIXEXT16:
+        case MSGPACK_TYPE_EXT8:
+        case MSGPACK_TYPE_EXT16:
+        case MSGPACK_TYPE_EXT32:
+            return msgpack_pack_ext(buf, obj->as.ext.type, obj->as.ext.ptr, obj->as.ext.size);
+        case MSGPACK_TYPE_TIMESTAMP:
+            return msgpack_pack_timestamp(buf, obj->as.timestamp, 0);
+        default:
+            return -1;
+    }
+}
 
-int msgpack_serialize(msgpack_serializer *serializer, const msgpack_object *obj) {
-    msgpack_buffer_clear(&serializer->buffer);
-    return msgpack_serialize_recursive(serializer, obj);
+/* Only reached after msgpack_object_packed_size has validated every type and
+ * reserved the exact output size. */
+static int msgpack_serialize_node_unchecked(const msgpack_object *obj, void *ctx) {
+    msgpack_writer *w = (msgpack_writer *)ctx;
+    switch (obj->type) {
+        case MSGPACK_TYPE_NIL:
+            msgpack_pack_nil_unchecked(w);
+            break;
+        case MSGPACK_TYPE_BOOL:
+            msgpack_pack_bool_unchecked(w, obj->as.b);
+            break;
+        case MSGPACK_TYPE_POSITIVE_FIXINT:
+        case MSGPACK_TYPE_UINT8:
+        case MSGPACK_TYPE_UINT16:
+        case MSGPACK_TYPE_UINT32:
+        case MSGPACK_TYPE_UINT64:
+            msgpack_pack_uint_unchecked(w, obj->as.u);
+            break;
+        case MSGPACK_TYPE_NEGATIVE_FIXINT:
+        case MSGPACK_TYPE_INT8:
+        case MSGPACK_TYPE_INT16:
+        case MSGPACK_TYPE_INT32:
+        case MSGPACK_TYPE_INT64:
+            msgpack_pack_int_unchecked(w, obj->as.i);
+            break;
+        case MSGPACK_TYPE_FLOAT32:
+        case MSGPACK_TYPE_FLOAT64:
+            msgpack_pack_float_unchecked(w, obj->as.f);
+            break;
+        case MSGPACK_TYPE_FIXSTR:
+        case MSGPACK_TYPE_STR8:
+        case MSGPACK_TYPE_STR16:
+        case MSGPACK_TYPE_STR32:
+            msgpack_pack_str_unchecked(w, obj->as.str.ptr, obj->as.str.size);
+            break;
+        case MSGPACK_TYPE_BIN8:
+        case MSGPACK_TYPE_BIN16:
+        case MSGPACK_TYPE_BIN32:
+            msgpack_pack_bin_unchecked(w, obj->as.bin.ptr, obj->as.bin.size);
+            break;
+        case MSGPACK_TYPE_FIXARRAY:
+        case MSGPACK_TYPE_ARRAY16:
+        case MSGPACK_TYPE_ARRAY32:
+            msgpack_pack_array_unchecked(w, obj->as.array.size);
+            break;
+        case MSGPACK_TYPE_FIXMAP:
+        case MSGPACK_TYPE_MAP16:
+        case MSGPACK_TYPE_MAP32:
+            msgpack_pack_map_unchecked(w, obj->as.map.size);
+            break;
+        case MSGPACK_TYPE_FIXEXT1:
+        case MSGPACK_TYPE_FIXEXT2:
+        case MSGPACK_TYPE_FIXEXT4:
+        case MSGPACK_TYPE_FIXEXT8:
+        case MSGPACK_TYPE_FIXEXT16:
+        case MSGPACK_TYPE_EXT8:
+        case MSGPACK_TYPE_EXT16:
+        case MSGPACK_TYPE_EXT32:
+            msgpack_pack_ext_unchecked(w, obj->as.ext.type, obj->as.ext.ptr, obj->as.ext.size);
+            break;
+        case MSGPACK_TYPE_TIMESTAMP:
+            msgpack_pack_timestamp_unchecked(w, obj->as.timestamp, 0);
+            break;
+        default:
+            return -1;
+    }
+    return 0;
+}
+
+/* Header sizes below mirror the width selection in the msgpack_pack_* functions. */
+static size_t msgpack_uint_packed_size(uint64_t u) {
+    if (u <= 127) return 1;
+    if (u <= 0xFF) return 2;
+    if (u <= 0xFFFF) return 3;
+    if (u <= 0xFFFFFFFF) return 5;
+    return 9;
+}
+
+static size_t msgpack_int_packed_size(int64_t i) {
+    if (i >= 0) return msgpack_uint_packed_size((uint64_t)i);
+    if (i >= -32) return 1;
+    if (i >= -128) return 2;
+    if (i >= -32768) return 3;
+    if (i >= -2147483648) return 5;
+    return 9;
+}
+
+static size_t msgpack_float_packed_size(double f) {
+    float f32 = (float)f;
+    return (double)f32 == f ? 5 : 9;
 }
 
-static int msgpack_serialize_recursive(msgpack_serializer *serializer, const msgpack_object *obj) {
-    // Note: buffer is NOT cleared here - it's already cleared by the top-level call
-    
+static size_t msgpack_str_header_size(size_t len) {
+    if (len <= 31) return 1;
+    if (len <= 255) return 2;
+    if (len <= 0xFFFF) return 3;
+    return 5;
+}
+
+static size_t msgpack_bin_header_size(size_t len) {
+    if (len <= 255) return 2;
+    if (len <= 0xFFFF) return 3;
+    return 5;
+}
+
+static size_t msgpack_container_header_size(uint32_t size) {
+    if (size <= 15) return 1;
+    if (size <= 0xFFFF) return 3;
+    return 5;
+}
+
+static size_t msgpack_ext_header_size(size_t len) {
+    if (len == 1 || len == 2 || len == 4 || len == 8 || len == 16) return 2;
+    if (len <= 255) return 3;
+    if (len <= 0xFFFF) return 4;
+    return 6;
+}
+
+static size_t msgpack_timestamp_packed_size(int64_t seconds, uint32_t nanoseconds) {
+    if (nanoseconds == 0 && seconds >= 0 && seconds <= 0xFFFFFFFFLL) return 6;
+    if (seconds >= 0 && (uint64_t)seconds < MSGPACK_TIMESTAMP64_MAX_SECONDS) return 10;
+    return 15;
+}
+
+static int msgpack_node_packed_size(const msgpack_object *obj, void *ctx) {
+    size_t total;
     switch (obj->type) {
         case MSGPACK_TYPE_NIL:
-            return msgpack_pack_nil(&serializer->buffer);
         case MSGPACK_TYPE_BOOL:
-            return msgpack_pack_bool(&serializer->buffer, obj->as.b);
+            total = 1;
+            break;
         case MSGPACK_TYPE_POSITIVE_FIXINT:
         case MSGPACK_TYPE_UINT8:
         case MSGPACK_TYPE_UINT16:
         case MSGPACK_TYPE_UINT32:
         case MSGPACK_TYPE_UINT64:
-            return msgpack_pack_uint(&serializer->buffer, obj->as.u);
+            total = msgpack_uint_packed_size(obj->as.u);
+            break;
         case MSGPACK_TYPE_NEGATIVE_FIXINT:
         case MSGPACK_TYPE_INT8:
         case MSGPACK_TYPE_INT16:
         case MSGPACK_TYPE_INT32:
         case MSGPACK_TYPE_INT64:
-            return msgpack_pack_int(&serializer->buffer, obj->as.i);
+            total = msgpack_int_packed_size(obj->as.i);
+            break;
         case MSGPACK_TYPE_FLOAT32:
         case MSGPACK_TYPE_FLOAT64:
-            return msgpack_pack_float(&serializer->buffer, obj->as.f);
+            total = msgpack_float_packed_size(obj->as.f);
+            break;
         case MSGPACK_TYPE_FIXSTR:
         case MSGPACK_TYPE_STR8:
         case MSGPACK_TYPE_STR16:
         case MSGPACK_TYPE_STR32:
-            return msgpack_pack_str(&serializer->buffer, obj->as.str.ptr, obj->as.str.size);
+            total = msgpack_str_header_size(obj->as.str.size) + obj->as.str.size;
+            break;
         case MSGPACK_TYPE_BIN8:
         case MSGPACK_TYPE_BIN16:
         case MSGPACK_TYPE_BIN32:
-            return msgpack_pack_bin(&serializer->buffer, obj->as.bin.ptr, obj->as.bin.size);
+            total = msgpack_bin_header_size(obj->as.bin.size) + obj->as.bin.size;
+            break;
         case MSGPACK_TYPE_FIXARRAY:
         case MSGPACK_TYPE_ARRAY16:
-        case MSGPACK_TYPE_ARRAY32: {
-            int ret = msgpack_pack_array(&serializer->buffer, obj->as.array.size);
-            if (ret != 0) return ret;
-            for (uint32_t i = 0; i < obj->as.array.size; i++) {
-                ret = msgpack_serialize_recursive(serializer, &obj->as.array.ptr[i]);
-                if (ret != 0) return ret;
-            }
-            return 0;
-        }
+        case MSGPACK_TYPE_ARRAY32:
+            total = msgpack_container_header_size(obj->as.array.size);
+            break;
         case MSGPACK_TYPE_FIXMAP:
         case MSGPACK_TYPE_MAP16:
-        case MSGPACK_TYPE_MAP32: {
-            int ret = msgpack_pack_map(&serializer->buffer, obj->as.map.size);
-            if (ret != 0) return ret;
-            for (uint32_t i = 0; i < obj->as.map.size; i++) {
-                ret = msgpack_serialize_recursive(serializer, &obj->as.map.ptr[i].key);
-                if (ret != 0) return ret;
-                ret = msgpack_serialize_recursive(serializer, &obj->as.map.ptr[i].value);
-                if (ret != 0) return ret;
-            }
-            return 0;
-        }
+        case MSGPACK_TYPE_MAP32:
+            total = msgpack_container_header_size(obj->as.map.size);
+            break;
         case MSGPACK_TYPE_FIXEXT1:
         case MSGPACK_TYPE_FIXEXT2:
         case MSGPACK_TYPE_FIXEXT4:
@@ -348,10 +705,85 @@ static int msgpack_serialize_recursive(msgpack_serializer *serializer, const msg
         case MSGPACK_TYPE_EXT8:
         case MSGPACK_TYPE_EXT16:
         case MSGPACK_TYPE_EXT32:
-            return msgpack_pack_ext(&serializer->buffer, obj->as.ext.type, obj->as.ext.ptr, obj->as.ext.size);
+            total = msgpack_ext_header_size(obj->as.ext.size) + obj->as.ext.size;
+            break;
         case MSGPACK_TYPE_TIMESTAMP:
-            return msgpack_pack_timestamp(&serializer->buffer, obj->as.timestamp, 0);
+            total = msgpack_timestamp_packed_size(obj->as.timestamp, 0);
+            break;
         default:
             return -1;
     }
+    *(size_t *)ctx += total;
+    return 0;
+}
+
+typedef int (*msgpack_visit_func)(const msgpack_object *obj, void *ctx);
+
+/* Visits every node of a tree in pre-order using an explicit stack, so deep
+ * trees cost heap frames rather than C stack. max_depth bounds container
+ * nesting (0 means unlimited). */
+static int msgpack_walk(const msgpack_object *root, size_t max_depth, msgpack_visit_func visit, void *ctx) {
+    msgpack_stack stack;
+    msgpack_stack_init(&stack, NULL);
+    /* the root is treated as the only child of a virtual outermost frame */
+    msgpack_stack_push(&stack, (msgpack_object *)root, 1);
+    int ret = 0;
+    while (stack.depth > 0) {
+        msgpack_frame *top = msgpack_stack_top(&stack);
+        if (top->index == top->count) {
+            stack.depth--;
+            continue;
+        }
+        const msgpack_object *node = &top->items[top->index++];
+        if (visit(node, ctx) != 0) {
+            ret = -1;
+            break;
+        }
+        if (msgpack_object_is_array(node) || msgpack_object_is_map(node)) {
+            if (max_depth != 0 && stack.depth > max_depth) {
+                ret = -1;
+                break;
+            }
+            uint64_t count = msgpack_object_child_count(node);
+            if (count > 0 && msgpack_stack_push(&stack, msgpack_object_children(node), count) != 0) {
+                ret = -1;
+                break;
+            }
+        }
+    }
+    msgpack_stack_free(&stack);
+    return ret;
+}
+
+int msgpack_pack_object(msgpack_buffer *buf, const msgpack_object *obj, size_t max_depth) {
+    return msgpack_walk(obj, max_depth, msgpack_serialize_node, buf);
+}
+
+int msgpack_serialize(msgpack_serializer *serializer, const msgpack_object *obj) {
+    msgpack_buffer_clear(&serializer->buffer);
+    return msgpack_pack_object(&serializer->buffer, obj, serializer->max_depth);
+}
+
+int msgpack_serialize_sized(msgpack_serializer *serializer, const msgpack_object *obj) {
+    size_t size = 0;
+    if (msgpack_walk(obj, serializer->max_depth, msgpack_node_packed_size, &size) != 0) return -1;
+    msgpack_buffer_clear(&serializer->buffer);
+    msgpack_writer w;
+    if (msgpack_writer_begin(&w, &serializer->buffer, size) != 0) return -1;
+    /* the sizing walk succeeded, but this one can still fail to grow its
+     * stack on a deep tree */
+    int ret = msgpack_walk(obj, serializer->max_depth, msgpack_serialize_node_unchecked, &w);
+    msgpack_writer_end(&w);
+    if (ret != 0) {
+        msgpack_buffer_clear(&serializer->buffer);
+        return -1;
+    }
+    return 0;
+}
+
+int msgpack_object_packed_size(const msgpack_object *obj, size_t *size) {
+    size_t total = 0;
+    if (msgpack_walk(obj, 0, msgpack_node_packed_size, &total) != 0) return -1;
+    *size = total;
+    return 0;
 }
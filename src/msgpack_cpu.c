@@ -0,0 +1,671 @@
+#include "msgpack/msgpack.h"
+#include "msgpack_internal.h"
+#include <stdatomic.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define MSGPACK_CPU_X86 1
+#include <immintrin.h>
+#endif
+
+/* Set once detection has run, so a state of 0 means "not yet detected". */
+#define MSGPACK_CPU_DETECTED (1u << 31)
+
+static atomic_uint msgpack_cpu_state;
+
+/* Scalar kernels: the baseline everywhere and the tail of every vector
+ * loop. Values go through memcpy so src and dst may be any 4 or 8-byte
+ * type. */
+static void msgpack_pack_tagged64_scalar(uint8_t *dst, const void *src, size_t n, uint8_t tag) {
+    const uint8_t *in = (const uint8_t *)src;
+    for (size_t i = 0; i < n; i++, dst += 9, in += 8) {
+        uint64_t v;
+        memcpy(&v, in, 8);
+        dst[0] = tag;
+        msgpack_store_be64(dst + 1, v);
+    }
+}
+
+static size_t msgpack_unpack_tagged64_scalar(void *dst, const uint8_t *src, size_t n, uint8_t tag) {
+    uint8_t *out = (uint8_t *)dst;
+    size_t i = 0;
+    for (; i < n && src[0] == tag; i++, src += 9, out += 8) {
+        uint64_t v = msgpack_load_be64(src + 1);
+        memcpy(out, &v, 8);
+    }
+    return i;
+}
+
+static void msgpack_pack_tagged32_scalar(uint8_t *dst, const void *src, size_t n, uint8_t tag) {
+    const uint8_t *in = (const uint8_t *)src;
+    for (size_t i = 0; i < n; i++, dst += 5, in += 4) {
+        uint32_t v;
+        memcpy(&v, in, 4);
+        dst[0] = tag;
+        msgpack_store_be32(dst + 1, v);
+    }
+}
+
+static size_t msgpack_unpack_tagged32_scalar(void *dst, const uint8_t *src, size_t n, uint8_t tag) {
+    uint8_t *out = (uint8_t *)dst;
+    size_t i = 0;
+    for (; i < n && src[0] == tag; i++, src += 5, out += 4) {
+        uint32_t v = msgpack_load_be32(src + 1);
+        memcpy(out, &v, 4);
+    }
+    return i;
+}
+
+/* Checks one sequence at a time against the well-formed ranges of the
+ * Unicode standard (table 3-7): no overlong forms, no surrogates, nothing
+ * above U+10FFFF. Runs of ASCII are skipped 8 bytes at a time. */
+static size_t msgpack_utf8_invalid_scalar(const uint8_t *s, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+        if (i + 8 <= n) {
+            uint64_t word;
+            memcpy(&word, s + i, 8);
+            if ((word & UINT64_C(0x8080808080808080)) == 0) {
+                i += 8;
+                continue;
+            }
+        }
+        uint8_t c = s[i];
+        if (c < 0x80) {
+            i++;
+            continue;
+        }
+        size_t need;
+        uint8_t lo = 0x80;
+        uint8_t hi = 0xBF;
+        if (c >= 0xC2 && c <= 0xDF) {
+            need = 1;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            need = 2;
+            lo = c == 0xE0 ? 0xA0 : 0x80;
+            hi = c == 0xED ? 0x9F : 0xBF;
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            need = 3;
+            lo = c == 0xF0 ? 0x90 : 0x80;
+            hi = c == 0xF4 ? 0x8F : 0xBF;
+        } else {
+            return i;
+        }
+        if (n - i <= need || s[i + 1] < lo || s[i + 1] > hi) {
+            return i;
+        }
+        for (size_t k = 2; k <= need; k++) {
+            if ((s[i + k] & 0xC0) != 0x80) {
+                return i;
+            }
+        }
+        i += need + 1;
+    }
+    return n;
+}
+
+static const msgpack_kernels msgpack_kernels_scalar = {
+    msgpack_pack_tagged64_scalar,
+    msgpack_unpack_tagged64_scalar,
+    msgpack_pack_tagged32_scalar,
+    msgpack_unpack_tagged32_scalar,
+    msgpack_utf8_invalid_scalar,
+};
+
+#ifdef MSGPACK_CPU_X86
+
+/* One 16-byte shuffle turns two uint64 into [tag][be64][tag][6 bytes of
+ * be64]; the last 2 bytes go out separately. Four uint32 likewise become
+ * [tag][be32] x3 + [tag], with the last be32 stored separately. The wider
+ * levels apply the same shuffle to every 128-bit lane. Decoding reads a
+ * lane from the record start (tags and the first value) and one from a few
+ * bytes later (the value that straddles the lane end), so no load runs past
+ * the records. */
+#define MSGPACK_PACK64_ORDER -1, 7, 6, 5, 4, 3, 2, 1, 0, -1, 15, 14, 13, 12, 11, 10
+#define MSGPACK_UNPACK64_LO 8, 7, 6, 5, 4, 3, 2, 1, -1, -1, -1, -1, -1, -1, -1, -1
+#define MSGPACK_UNPACK64_HI -1, -1, -1, -1, -1, -1, -1, -1, 15, 14, 13, 12, 11, 10, 9, 8
+#define MSGPACK_PACK32_ORDER -1, 3, 2, 1, 0, -1, 7, 6, 5, 4, -1, 11, 10, 9, 8, -1
+#define MSGPACK_UNPACK32_LO 4, 3, 2, 1, 9, 8, 7, 6, 14, 13, 12, 11, -1, -1, -1, -1
+#define MSGPACK_UNPACK32_HI -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 15, 14, 13, 12
+
+/* The bytes of a native value that do not fit in the shuffled lane, stored
+ * big-endian: the low 2 bytes of a uint64, or a whole uint32. */
+static inline void msgpack_store_tail16(uint8_t *dst, const uint8_t *value) {
+    dst[0] = value[1];
+    dst[1] = value[0];
+}
+
+static inline void msgpack_store_tail32(uint8_t *dst, const uint8_t *value) {
+    uint32_t v;
+    memcpy(&v, value, 4);
+    msgpack_store_be32(dst, v);
+}
+
+/* Tag byte positions within a lane, as cmpeq_epi8 movemask bits. */
+#define MSGPACK_TAGS64 0x0201u
+#define MSGPACK_TAGS32 0x8421u
+
+__attribute__((target("sse4.2")))
+static inline __m128i msgpack_tags64(uint8_t tag) {
+    return _mm_setr_epi8((char)tag, 0, 0, 0, 0, 0, 0, 0, 0, (char)tag, 0, 0, 0, 0, 0, 0);
+}
+
+__attribute__((target("sse4.2")))
+static inline __m128i msgpack_tags32(uint8_t tag) {
+    return _mm_setr_epi8((char)tag, 0, 0, 0, 0, (char)tag, 0, 0, 0, 0, (char)tag, 0, 0, 0, 0, (char)tag);
+}
+
+__attribute__((target("sse4.2")))
+static void msgpack_pack_tagged64_sse42(uint8_t *dst, const void *values, size_t n, uint8_t tag) {
+    const uint8_t *src = (const uint8_t *)values;
+    const __m128i order = _mm_setr_epi8(MSGPACK_PACK64_ORDER);
+    const __m128i tags = msgpack_tags64(tag);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2, dst += 18) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + 8 * i));
+        _mm_storeu_si128((__m128i *)dst, _mm_or_si128(_mm_shuffle_epi8(v, order), tags));
+        msgpack_store_tail16(dst + 16, src + 8 * i + 8);
+    }
+    msgpack_pack_tagged64_scalar(dst, src + 8 * i, n - i, tag);
+}
+
+__attribute__((target("sse4.2")))
+static size_t msgpack_unpack_tagged64_sse42(void *values, const uint8_t *src, size_t n, uint8_t tag) {
+    uint8_t *dst = (uint8_t *)values;
+    const __m128i lo_order = _mm_setr_epi8(MSGPACK_UNPACK64_LO);
+    const __m128i hi_order = _mm_setr_epi8(MSGPACK_UNPACK64_HI);
+    const __m128i tags = _mm_set1_epi8((char)tag);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2, src += 18) {
+        __m128i lo = _mm_loadu_si128((const __m128i *)src);
+        __m128i hi = _mm_loadu_si128((const __m128i *)(src + 2));
+        if (((unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(lo, tags)) & MSGPACK_TAGS64) != MSGPACK_TAGS64) {
+            break;
+        }
+        __m128i v = _mm_or_si128(_mm_shuffle_epi8(lo, lo_order), _mm_shuffle_epi8(hi, hi_order));
+        _mm_storeu_si128((__m128i *)(dst + 8 * i), v);
+    }
+    return i + msgpack_unpack_tagged64_scalar(dst + 8 * i, src, n - i, tag);
+}
+
+__attribute__((target("sse4.2")))
+static void msgpack_pack_tagged32_sse42(uint8_t *dst, const void *values, size_t n, uint8_t tag) {
+    const uint8_t *src = (const uint8_t *)values;
+    const __m128i order = _mm_setr_epi8(MSGPACK_PACK32_ORDER);
+    const __m128i tags = msgpack_tags32(tag);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4, dst += 20) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+        _mm_storeu_si128((__m128i *)dst, _mm_or_si128(_mm_shuffle_epi8(v, order), tags));
+        msgpack_store_tail32(dst + 16, src + 4 * i + 12);
+    }
+    msgpack_pack_tagged32_scalar(dst, src + 4 * i, n - i, tag);
+}
+
+__attribute__((target("sse4.2")))
+static size_t msgpack_unpack_tagged32_sse42(void *values, const uint8_t *src, size_t n, uint8_t tag) {
+    uint8_t *dst = (uint8_t *)values;
+    const __m128i lo_order = _mm_setr_epi8(MSGPACK_UNPACK32_LO);
+    const __m128i hi_order = _mm_setr_epi8(MSGPACK_UNPACK32_HI);
+    const __m128i tags = _mm_set1_epi8((char)tag);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4, src += 20) {
+        __m128i lo = _mm_loadu_si128((const __m128i *)src);
+        __m128i hi = _mm_loadu_si128((const __m128i *)(src + 4));
+        if (((unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(lo, tags)) & MSGPACK_TAGS32) != MSGPACK_TAGS32) {
+            break;
+        }
+        __m128i v = _mm_or_si128(_mm_shuffle_epi8(lo, lo_order), _mm_shuffle_epi8(hi, hi_order));
+        _mm_storeu_si128((__m128i *)(dst + 4 * i), v);
+    }
+    return i + msgpack_unpack_tagged32_scalar(dst + 4 * i, src, n - i, tag);
+}
+
+/* UTF-8 validation after Keiser and Lemire, "Validating UTF-8 in less than
+ * one instruction per byte": three nibble lookups classify every byte pair
+ * (previous byte, this byte) into error bits, and a saturating subtract
+ * marks the bytes that must be the 3rd or 4th of a sequence. Blocks of
+ * plain ASCII only check that the block before did not end mid-sequence.
+ * The vector pass says only whether s is valid; an invalid s is rescanned
+ * by the scalar validator for the offset. */
+static const uint8_t msgpack_utf8_byte1_high[16] = {
+    0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x80, 0x80, 0x80, 0x80, 0x21, 0x01, 0x15, 0x49,
+};
+static const uint8_t msgpack_utf8_byte1_low[16] = {
+    0xE7, 0xA3, 0x83, 0x83, 0x8B, 0xCB, 0xCB, 0xCB, 0xCB, 0xCB, 0xCB, 0xCB, 0xCB, 0xDB, 0xCB, 0xCB,
+};
+static const uint8_t msgpack_utf8_byte2_high[16] = {
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0xE6, 0xAE, 0xBA, 0xBA, 0x01, 0x01, 0x01, 0x01,
+};
+
+typedef struct msgpack_utf8_state128 {
+    __m128i prev;
+    __m128i incomplete;
+    __m128i error;
+} msgpack_utf8_state128;
+
+__attribute__((target("sse4.2")))
+static inline void msgpack_utf8_block_sse42(msgpack_utf8_state128 *state, __m128i in) {
+    if (_mm_movemask_epi8(in) == 0) {
+        state->error = _mm_or_si128(state->error, state->incomplete);
+        state->prev = in;
+        return;
+    }
+    const __m128i byte1_high = _mm_loadu_si128((const __m128i *)msgpack_utf8_byte1_high);
+    const __m128i byte1_low = _mm_loadu_si128((const __m128i *)msgpack_utf8_byte1_low);
+    const __m128i byte2_high = _mm_loadu_si128((const __m128i *)msgpack_utf8_byte2_high);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i prev1 = _mm_alignr_epi8(in, state->prev, 15);
+    __m128i special = _mm_and_si128(
+        _mm_and_si128(_mm_shuffle_epi8(byte1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+                      _mm_shuffle_epi8(byte1_low, _mm_and_si128(prev1, nibble))),
+        _mm_shuffle_epi8(byte2_high, _mm_and_si128(_mm_srli_epi16(in, 4), nibble)));
+    __m128i prev2 = _mm_alignr_epi8(in, state->prev, 14);
+    __m128i prev3 = _mm_alignr_epi8(in, state->prev, 13);
+    __m128i must_continue = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80))),
+                                         _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80))));
+    must_continue = _mm_and_si128(must_continue, _mm_set1_epi8((char)0x80));
+    state->error = _mm_or_si128(state->error, _mm_xor_si128(must_continue, special));
+    /* a lead byte in the last 3 positions that needs more than is left */
+    const __m128i max = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, (char)0xEF, (char)0xDF, (char)0xBF);
+    state->incomplete = _mm_subs_epu8(in, max);
+    state->prev = in;
+}
+
+__attribute__((target("sse4.2")))
+static size_t msgpack_utf8_invalid_sse42(const uint8_t *s, size_t n) {
+    if (n < 16) {
+        return msgpack_utf8_invalid_scalar(s, n);
+    }
+    msgpack_utf8_state128 state = {_mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128()};
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        msgpack_utf8_block_sse42(&state, _mm_loadu_si128((const __m128i *)(s + i)));
+    }
+    if (i < n) {
+        /* zero padding is ASCII, so a sequence cut short by the end of s
+         * still shows up as one */
+        uint8_t tail[16] = {0};
+        memcpy(tail, s + i, n - i);
+        msgpack_utf8_block_sse42(&state, _mm_loadu_si128((const __m128i *)tail));
+    }
+    __m128i error = _mm_or_si128(state.error, state.incomplete);
+    return _mm_testz_si128(error, error) ? n : msgpack_utf8_invalid_scalar(s, n);
+}
+
+static const msgpack_kernels msgpack_kernels_sse42 = {
+    msgpack_pack_tagged64_sse42,
+    msgpack_unpack_tagged64_sse42,
+    msgpack_pack_tagged32_sse42,
+    msgpack_unpack_tagged32_sse42,
+    msgpack_utf8_invalid_sse42,
+};
+
+__attribute__((target("avx2")))
+static inline __m256i msgpack_load_lanes2(const uint8_t *p, size_t stride) {
+    __m128i lane0 = _mm_loadu_si128((const __m128i *)p);
+    __m128i lane1 = _mm_loadu_si128((const __m128i *)(p + stride));
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(lane0), lane1, 1);
+}
+
+__attribute__((target("avx2")))
+static void msgpack_pack_tagged64_avx2(uint8_t *dst, const void *values, size_t n, uint8_t tag) {
+    const uint8_t *src = (const uint8_t *)values;
+    const __m256i order = _mm256_broadcastsi128_si256(_mm_setr_epi8(MSGPACK_PACK64_ORDER));
+    const __m256i tags = _mm256_broadcastsi128_si256(msgpack_tags64(tag));
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4, dst += 36) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + 8 * i));
+        __m256i r = _mm256_or_si256(_mm256_shuffle_epi8(v, order), tags);
+        _mm_storeu_si128((__m128i *)dst, _mm256_castsi256_si128(r));
+        msgpack_store_tail16(dst + 16, src + 8 * i + 8);
+        _mm_storeu_si128((__m128i *)(dst + 18), _mm256_extracti128_si256(r, 1));
+        msgpack_store_tail16(dst + 34, src + 8 * i + 24);
+    }
+    msgpack_pack_tagged64_sse42(dst, src + 8 * i, n - i, tag);
+}
+
+__attribute__((target("avx2")))
+static size_t msgpack_unpack_tagged64_avx2(void *values, const uint8_t *src, size_t n, uint8_t tag) {
+    uint8_t *dst = (uint8_t *)values;
+    const __m256i lo_order = _mm256_broadcastsi128_si256(_mm_setr_epi8(MSGPACK_UNPACK64_LO));
+    const __m256i hi_order = _mm256_broadcastsi128_si256(_mm_setr_epi8(MSGPACK_UNPACK64_HI));
+    const __m256i tags = _mm256_set1_epi8((char)tag);
+    const unsigned tag_bits = MSGPACK_TAGS64 | MSGPACK_TAGS64 << 16;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4, src += 36) {
+        __m256i lo = msgpack_load_lanes2(src, 18);
+        __m256i hi = msgpack_load_lanes2(src + 2, 18);
+        if (((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, tags)) & tag_bits) != tag_bits) {
+            break;
+        }
+        __m256i v = _mm256_or_si256(_mm256_shuffle_epi8(lo, lo_order), _mm256_shuffle_epi8(hi, hi_order));
+        _mm256_storeu_si256((__m256i *)(dst + 8 * i), v);
+    }
+    return i + msgpack_unpack_tagged64_sse42(dst + 8 * i, src, n - i, tag);
+}
+
+__attribute__((target("avx2")))
+static void msgpack_pack_tagged32_avx2(uint8_t *dst, const void *values, size_t n, uint8_t tag) {
+    const uint8_t *src = (const uint8_t *)values;
+    const __m256i order = _mm256_broadcastsi128_si256(_mm_setr_epi8(MSGPACK_PACK32_ORDER));
+    const __m256i tags = _mm256_broadcastsi128_si256(msgpack_tags32(tag));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8, dst += 40) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + 4 * i));
+        __m256i r = _mm256_or_si256(_mm256_shuffle_epi8(v, order), tags);
+        _mm_storeu_si128((__m128i *)dst, _mm256_castsi256_si128(r));
+        msgpack_store_tail32(dst + 16, src + 4 * i + 12);
+        _mm_storeu_si128((__m128i *)(dst + 20), _mm256_extracti128_si256(r, 1));
+        msgpack_store_tail32(dst + 36, src + 4 * i + 28);
+    }
+    msgpack_pack_tagged32_sse42(dst, src + 4 * i, n - i, tag);
+}
+
+__attribute__((target("avx2")))
+static size_t msgpack_unpack_tagged32_avx2(void *values, const uint8_t *src, size_t n, uint8_t tag) {
+    uint8_t *dst = (uint8_t *)values;
+    const __m256i lo_order = _mm256_broadcastsi128_si256(_mm_setr_epi8(MSGPACK_UNPACK32_LO));
+    const __m256i hi_order = _mm256_broadcastsi128_si256(_mm_setr_epi8(MSGPACK_UNPACK32_HI));
+    const __m256i tags = _mm256_set1_epi8((char)tag);
+    const unsigned tag_bits = MSGPACK_TAGS32 | MSGPACK_TAGS32 << 16;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8, src += 40) {
+        __m256i lo = msgpack_load_lanes2(src, 20);
+        __m256i hi = msgpack_load_lanes2(src + 4, 20);
+        if (((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, tags)) & tag_bits) != tag_bits) {
+            break;
+        }
+        __m256i v = _mm256_or_si256(_mm256_shuffle_epi8(lo, lo_order), _mm256_shuffle_epi8(hi, hi_order));
+        _mm256_storeu_si256((__m256i *)(dst + 4 * i), v);
+    }
+    return i + msgpack_unpack_tagged32_sse42(dst + 4 * i, src, n - i, tag);
+}
+
+typedef struct msgpack_utf8_state256 {
+    __m256i prev;
+    __m256i incomplete;
+    __m256i error;
+} msgpack_utf8_state256;
+
+/* Same as the SSE4.2 block; the previous bytes cross the 128-bit lanes
+ * through a permute before the per-lane alignr. */
+__attribute__((target("avx2")))
+static inline void msgpack_utf8_block_avx2(msgpack_utf8_state256 *state, __m256i in) {
+    if (_mm256_movemask_epi8(in) == 0) {
+        state->error = _mm256_or_si256(state->error, state->incomplete);
+        state->prev = in;
+        return;
+    }
+    const __m256i byte1_high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)msgpack_utf8_byte1_high));
+    const __m256i byte1_low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)msgpack_utf8_byte1_low));
+    const __m256i byte2_high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)msgpack_utf8_byte2_high));
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i shifted = _mm256_permute2x128_si256(state->prev, in, 0x21);
+    __m256i prev1 = _mm256_alignr_epi8(in, shifted, 15);
+    __m256i special = _mm256_and_si256(
+        _mm256_and_si256(_mm256_shuffle_epi8(byte1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+                         _mm256_shuffle_epi8(byte1_low, _mm256_and_si256(prev1, nibble))),
+        _mm256_shuffle_epi8(byte2_high, _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble)));
+    __m256i prev2 = _mm256_alignr_epi8(in, shifted, 14);
+    __m256i prev3 = _mm256_alignr_epi8(in, shifted, 13);
+    __m256i must_continue = _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80))),
+                                            _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80))));
+    must_continue = _mm256_and_si256(must_continue, _mm256_set1_epi8((char)0x80));
+    state->error = _mm256_or_si256(state->error, _mm256_xor_si256(must_continue, special));
+    const __m256i max = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                         -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, (char)0xEF, (char)0xDF, (char)0xBF);
+    state->incomplete = _mm256_subs_epu8(in, max);
+    state->prev = in;
+}
+
+__attribute__((target("avx2")))
+static size_t msgpack_utf8_invalid_avx2(const uint8_t *s, size_t n) {
+    if (n < 32) {
+        return msgpack_utf8_invalid_sse42(s, n);
+    }
+    msgpack_utf8_state256 state = {_mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256()};
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        msgpack_utf8_block_avx2(&state, _mm256_loadu_si256((const __m256i *)(s + i)));
+    }
+    if (i < n) {
+        uint8_t tail[32] = {0};
+        memcpy(tail, s + i, n - i);
+        msgpack_utf8_block_avx2(&state, _mm256_loadu_si256((const __m256i *)tail));
+    }
+    __m256i error = _mm256_or_si256(state.error, state.incomplete);
+    return _mm256_testz_si256(error, error) ? n : msgpack_utf8_invalid_scalar(s, n);
+}
+
+static const msgpack_kernels msgpack_kernels_avx2 = {
+    msgpack_pack_tagged64_avx2,
+    msgpack_unpack_tagged64_avx2,
+    msgpack_pack_tagged32_avx2,
+    msgpack_unpack_tagged32_avx2,
+    msgpack_utf8_invalid_avx2,
+};
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i msgpack_load_lanes4(const uint8_t *p, size_t stride) {
+    __m512i v = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i *)p));
+    v = _mm512_inserti32x4(v, _mm_loadu_si128((const __m128i *)(p + stride)), 1);
+    v = _mm512_inserti32x4(v, _mm_loadu_si128((const __m128i *)(p + 2 * stride)), 2);
+    return _mm512_inserti32x4(v, _mm_loadu_si128((const __m128i *)(p + 3 * stride)), 3);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline void msgpack_store_lanes4(uint8_t *p, size_t stride, __m512i v) {
+    _mm_storeu_si128((__m128i *)p, _mm512_castsi512_si128(v));
+    _mm_storeu_si128((__m128i *)(p + stride), _mm512_extracti32x4_epi32(v, 1));
+    _mm_storeu_si128((__m128i *)(p + 2 * stride), _mm512_extracti32x4_epi32(v, 2));
+    _mm_storeu_si128((__m128i *)(p + 3 * stride), _mm512_extracti32x4_epi32(v, 3));
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void msgpack_pack_tagged64_avx512(uint8_t *dst, const void *values, size_t n, uint8_t tag) {
+    const uint8_t *src = (const uint8_t *)values;
+    const __m512i order = _mm512_broadcast_i32x4(_mm_setr_epi8(MSGPACK_PACK64_ORDER));
+    const __m512i tags = _mm512_broadcast_i32x4(msgpack_tags64(tag));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8, dst += 72) {
+        __m512i v = _mm512_loadu_si512((const void *)(src + 8 * i));
+        msgpack_store_lanes4(dst, 18, _mm512_or_si512(_mm512_shuffle_epi8(v, order), tags));
+        for (size_t k = 0; k < 4; k++) {
+            msgpack_store_tail16(dst + 18 * k + 16, src + 8 * (i + 2 * k + 1));
+        }
+    }
+    msgpack_pack_tagged64_avx2(dst, src + 8 * i, n - i, tag);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t msgpack_unpack_tagged64_avx512(void *values, const uint8_t *src, size_t n, uint8_t tag) {
+    uint8_t *dst = (uint8_t *)values;
+    const __m512i lo_order = _mm512_broadcast_i32x4(_mm_setr_epi8(MSGPACK_UNPACK64_LO));
+    const __m512i hi_order = _mm512_broadcast_i32x4(_mm_setr_epi8(MSGPACK_UNPACK64_HI));
+    const __m512i tags = _mm512_set1_epi8((char)tag);
+    const uint64_t tag_bits = 0x0201020102010201ULL;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8, src += 72) {
+        __m512i lo = msgpack_load_lanes4(src, 18);
+        __m512i hi = msgpack_load_lanes4(src + 2, 18);
+        if ((_mm512_cmpeq_epi8_mask(lo, tags) & tag_bits) != tag_bits) {
+            break;
+        }
+        __m512i v = _mm512_or_si512(_mm512_shuffle_epi8(lo, lo_order), _mm512_shuffle_epi8(hi, hi_order));
+        _mm512_storeu_si512((void *)(dst + 8 * i), v);
+    }
+    return i + msgpack_unpack_tagged64_avx2(dst + 8 * i, src, n - i, tag);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void msgpack_pack_tagged32_avx512(uint8_t *dst, const void *values, size_t n, uint8_t tag) {
+    const uint8_t *src = (const uint8_t *)values;
+    const __m512i order = _mm512_broadcast_i32x4(_mm_setr_epi8(MSGPACK_PACK32_ORDER));
+    const __m512i tags = _mm512_broadcast_i32x4(msgpack_tags32(tag));
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16, dst += 80) {
+        __m512i v = _mm512_loadu_si512((const void *)(src + 4 * i));
+        msgpack_store_lanes4(dst, 20, _mm512_or_si512(_mm512_shuffle_epi8(v, order), tags));
+        for (size_t k = 0; k < 4; k++) {
+            msgpack_store_tail32(dst + 20 * k + 16, src + 4 * (i + 4 * k + 3));
+        }
+    }
+    msgpack_pack_tagged32_avx2(dst, src + 4 * i, n - i, tag);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t msgpack_unpack_tagged32_avx512(void *values, const uint8_t *src, size_t n, uint8_t tag) {
+    uint8_t *dst = (uint8_t *)values;
+    const __m512i lo_order = _mm512_broadcast_i32x4(_mm_setr_epi8(MSGPACK_UNPACK32_LO));
+    const __m512i hi_order = _mm512_broadcast_i32x4(_mm_setr_epi8(MSGPACK_UNPACK32_HI));
+    const __m512i tags = _mm512_set1_epi8((char)tag);
+    const uint64_t tag_bits = 0x8421842184218421ULL;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16, src += 80) {
+        __m512i lo = msgpack_load_lanes4(src, 20);
+        __m512i hi = msgpack_load_lanes4(src + 4, 20);
+        if ((_mm512_cmpeq_epi8_mask(lo, tags) & tag_bits) != tag_bits) {
+            break;
+        }
+        __m512i v = _mm512_or_si512(_mm512_shuffle_epi8(lo, lo_order), _mm512_shuffle_epi8(hi, hi_order));
+        _mm512_storeu_si512((void *)(dst + 4 * i), v);
+    }
+    return i + msgpack_unpack_tagged32_avx2(dst + 4 * i, src, n - i, tag);
+}
+
+typedef struct msgpack_utf8_state512 {
+    __m512i prev;
+    __m512i incomplete;
+    __m512i error;
+} msgpack_utf8_state512;
+
+/* Same as the AVX2 block over four lanes: a two-source permute lines up
+ * the last lane of the previous block with the first three of this one. */
+__attribute__((target("avx512f,avx512bw")))
+static inline void msgpack_utf8_block_avx512(msgpack_utf8_state512 *state, __m512i in) {
+    if (_mm512_movepi8_mask(in) == 0) {
+        state->error = _mm512_or_si512(state->error, state->incomplete);
+        state->prev = in;
+        return;
+    }
+    const __m512i byte1_high = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)msgpack_utf8_byte1_high));
+    const __m512i byte1_low = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)msgpack_utf8_byte1_low));
+    const __m512i byte2_high = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)msgpack_utf8_byte2_high));
+    const __m512i nibble = _mm512_set1_epi8(0x0F);
+    __m512i shifted = _mm512_permutex2var_epi64(state->prev, _mm512_setr_epi64(6, 7, 8, 9, 10, 11, 12, 13), in);
+    __m512i prev1 = _mm512_alignr_epi8(in, shifted, 15);
+    __m512i special = _mm512_and_si512(
+        _mm512_and_si512(_mm512_shuffle_epi8(byte1_high, _mm512_and_si512(_mm512_srli_epi16(prev1, 4), nibble)),
+                         _mm512_shuffle_epi8(byte1_low, _mm512_and_si512(prev1, nibble))),
+        _mm512_shuffle_epi8(byte2_high, _mm512_and_si512(_mm512_srli_epi16(in, 4), nibble)));
+    __m512i prev2 = _mm512_alignr_epi8(in, shifted, 14);
+    __m512i prev3 = _mm512_alignr_epi8(in, shifted, 13);
+    __m512i must_continue = _mm512_or_si512(_mm512_subs_epu8(prev2, _mm512_set1_epi8((char)(0xE0 - 0x80))),
+                                            _mm512_subs_epu8(prev3, _mm512_set1_epi8((char)(0xF0 - 0x80))));
+    must_continue = _mm512_and_si512(must_continue, _mm512_set1_epi8((char)0x80));
+    state->error = _mm512_or_si512(state->error, _mm512_xor_si512(must_continue, special));
+    /* only the last 3 bytes can start a sequence that runs past the block */
+    const __m512i max = _mm512_mask_blend_epi8(UINT64_C(0xE000000000000000), _mm512_set1_epi8(-1),
+                                               _mm512_set1_epi32((int)0xBFDFEF00));
+    state->incomplete = _mm512_subs_epu8(in, max);
+    state->prev = in;
+}
+
+__attribute__((target("avx512f,avx512bw,bmi2")))
+static size_t msgpack_utf8_invalid_avx512(const uint8_t *s, size_t n) {
+    if (n < 64) {
+        return msgpack_utf8_invalid_avx2(s, n);
+    }
+    msgpack_utf8_state512 state = {_mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512()};
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        msgpack_utf8_block_avx512(&state, _mm512_loadu_si512((const void *)(s + i)));
+    }
+    if (i < n) {
+        /* a masked load zero-fills the tail, which reads as ASCII */
+        msgpack_utf8_block_avx512(&state, _mm512_maskz_loadu_epi8(_bzhi_u64(UINT64_MAX, (unsigned)(n - i)), s + i));
+    }
+    __m512i error = _mm512_or_si512(state.error, state.incomplete);
+    return _mm512_test_epi8_mask(error, error) == 0 ? n : msgpack_utf8_invalid_scalar(s, n);
+}
+
+static const msgpack_kernels msgpack_kernels_avx512 = {
+    msgpack_pack_tagged64_avx512,
+    msgpack_unpack_tagged64_avx512,
+    msgpack_pack_tagged32_avx512,
+    msgpack_unpack_tagged32_avx512,
+    msgpack_utf8_invalid_avx512,
+};
+
+/* __builtin_cpu_supports also checks that the OS saves the AVX and AVX-512
+ * register state. */
+static unsigned msgpack_cpu_detect(void) {
+    __builtin_cpu_init();
+    unsigned features = 0;
+    if (__builtin_cpu_supports("sse4.2")) {
+        features |= MSGPACK_CPU_SSE42;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        features |= MSGPACK_CPU_AVX2;
+    }
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        features |= MSGPACK_CPU_AVX512;
+    }
+    if (__builtin_cpu_supports("bmi2")) {
+        features |= MSGPACK_CPU_BMI2;
+    }
+    return features;
+}
+
+#else
+
+static unsigned msgpack_cpu_detect(void) {
+    return 0;
+}
+
+#endif
+
+static unsigned msgpack_cpu_state_load(void) {
+    unsigned state = atomic_load_explicit(&msgpack_cpu_state, memory_order_relaxed);
+    if (state == 0) {
+        state = msgpack_cpu_detect() | MSGPACK_CPU_DETECTED;
+        unsigned expected = 0;
+        if (!atomic_compare_exchange_strong_explicit(&msgpack_cpu_state, &expected, state, memory_order_relaxed, memory_order_relaxed)) {
+            state = expected;
+        }
+    }
+    return state;
+}
+
+unsigned msgpack_cpu_features(void) {
+    return msgpack_cpu_state_load() & ~MSGPACK_CPU_DETECTED;
+}
+
+/* Narrows the features in use to mask (still limited to what the CPU has),
+ * e.g. to benchmark or test a lower kernel level. ~0u restores full
+ * detection. */
+void msgpack_cpu_set_features(unsigned mask) {
+    unsigned state = (msgpack_cpu_detect() & mask) | MSGPACK_CPU_DETECTED;
+    atomic_store_explicit(&msgpack_cpu_state, state, memory_order_relaxed);
+}
+
+/* Each level also needs every level below it, since its loops hand their
+ * tails down. */
+const msgpack_kernels *msgpack_cpu_kernels(void) {
+#ifdef MSGPACK_CPU_X86
+    unsigned features = msgpack_cpu_state_load();
+    if (!(features & MSGPACK_CPU_SSE42)) {
+        return &msgpack_kernels_scalar;
+    }
+    if (!(features & MSGPACK_CPU_AVX2)) {
+        return &msgpack_kernels_sse42;
+    }
+    /* the AVX-512 UTF-8 validator builds its tail mask with bzhi */
+    if (!(features & MSGPACK_CPU_AVX512) || !(features & MSGPACK_CPU_BMI2)) {
+        return &msgpack_kernels_avx2;
+    }
+    return &msgpack_kernels_avx512;
+#else
+    return &msgpack_kernels_scalar;
+#endif
+}
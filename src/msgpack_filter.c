@@ -0,0 +1,191 @@
+#include "msgpack/msgpack.h"
+#include "msgpack_internal.h"
+#include <string.h>
+
+static bool msgpack_is_number(const msgpack_object *obj) {
+    return msgpack_object_is_unsigned(obj) || msgpack_object_is_signed(obj) || msgpack_object_is_float(obj);
+}
+
+/* Three-way numeric comparison across encodings. Integers compare exactly;
+ * if either side is a float both are compared as doubles. Returns false when
+ * the values are unordered (NaN). */
+static bool msgpack_compare_numbers(const msgpack_object *a, const msgpack_object *b, int *cmp) {
+    if (msgpack_object_is_float(a) || msgpack_object_is_float(b)) {
+        double x = msgpack_object_is_float(a) ? a->as.f : msgpack_object_is_signed(a) ? (double)a->as.i : (double)a->as.u;
+        double y = msgpack_object_is_float(b) ? b->as.f : msgpack_object_is_signed(b) ? (double)b->as.i : (double)b->as.u;
+        if (x != x || y != y) {
+            return false;
+        }
+        *cmp = (x > y) - (x < y);
+        return true;
+    }
+    bool a_neg = msgpack_object_is_signed(a) && a->as.i < 0;
+    bool b_neg = msgpack_object_is_signed(b) && b->as.i < 0;
+    if (a_neg != b_neg) {
+        *cmp = a_neg ? -1 : 1;
+    } else if (a_neg) {
+        *cmp = (a->as.i > b->as.i) - (a->as.i < b->as.i);
+    } else {
+        uint64_t x = msgpack_object_is_signed(a) ? (uint64_t)a->as.i : a->as.u;
+        uint64_t y = msgpack_object_is_signed(b) ? (uint64_t)b->as.i : b->as.u;
+        *cmp = (x > y) - (x < y);
+    }
+    return true;
+}
+
+static bool msgpack_compare_values(const msgpack_object *field, const msgpack_object *constant, int *cmp) {
+    if (msgpack_is_number(field) && msgpack_is_number(constant)) {
+        return msgpack_compare_numbers(field, constant, cmp);
+    }
+    if (msgpack_object_is_str(field) && msgpack_object_is_str(constant)) {
+        uint32_t n = field->as.str.size < constant->as.str.size ? field->as.str.size : constant->as.str.size;
+        int c = memcmp(field->as.str.ptr, constant->as.str.ptr, n);
+        *cmp = c != 0 ? (c > 0) - (c < 0) : (field->as.str.size > constant->as.str.size) - (field->as.str.size < constant->as.str.size);
+        return true;
+    }
+    return false;
+}
+
+static bool msgpack_predicate_holds(const msgpack_predicate *pred, const msgpack_object *field) {
+    const msgpack_object *constant = &pred->value;
+    int cmp;
+    switch (pred->op) {
+        case MSGPACK_PREDICATE_EXISTS:
+            return true;
+        case MSGPACK_PREDICATE_PREFIX:
+            return msgpack_object_is_str(field) && field->as.str.size >= constant->as.str.size &&
+                   memcmp(field->as.str.ptr, constant->as.str.ptr, constant->as.str.size) == 0;
+        case MSGPACK_PREDICATE_EQ:
+            if (field->type == MSGPACK_TYPE_NIL || constant->type == MSGPACK_TYPE_NIL) {
+                return field->type == constant->type;
+            }
+            if (field->type == MSGPACK_TYPE_BOOL || constant->type == MSGPACK_TYPE_BOOL) {
+                return field->type == constant->type && field->as.b == constant->as.b;
+            }
+            return msgpack_compare_values(field, constant, &cmp) && cmp == 0;
+        case MSGPACK_PREDICATE_LT:
+            return msgpack_compare_values(field, constant, &cmp) && cmp < 0;
+        case MSGPACK_PREDICATE_LE:
+            return msgpack_compare_values(field, constant, &cmp) && cmp <= 0;
+        case MSGPACK_PREDICATE_GT:
+            return msgpack_compare_values(field, constant, &cmp) && cmp > 0;
+        case MSGPACK_PREDICATE_GE:
+            return msgpack_compare_values(field, constant, &cmp) && cmp >= 0;
+    }
+    return false;
+}
+
+int msgpack_filter_compile(msgpack_filter *filter, const msgpack_predicate *predicates, size_t count) {
+    return msgpack_filter_compile_with_allocator(filter, predicates, count, NULL);
+}
+
+/* Copies the predicates, their paths and string constants into two
+ * allocations, checking that every constant suits its operator. */
+int msgpack_filter_compile_with_allocator(msgpack_filter *filter, const msgpack_predicate *predicates, size_t count, const msgpack_allocator *allocator) {
+    size_t strings_size = 0;
+    for (size_t i = 0; i < count; i++) {
+        const msgpack_predicate *pred = &predicates[i];
+        const msgpack_object *constant = &pred->value;
+        bool ok;
+        switch (pred->op) {
+            case MSGPACK_PREDICATE_EXISTS:
+                ok = true;
+                break;
+            case MSGPACK_PREDICATE_PREFIX:
+                ok = msgpack_object_is_str(constant);
+                break;
+            case MSGPACK_PREDICATE_EQ:
+                ok = constant->type == MSGPACK_TYPE_NIL || constant->type == MSGPACK_TYPE_BOOL ||
+                     msgpack_is_number(constant) || msgpack_object_is_str(constant);
+                break;
+            case MSGPACK_PREDICATE_LT:
+            case MSGPACK_PREDICATE_LE:
+            case MSGPACK_PREDICATE_GT:
+            case MSGPACK_PREDICATE_GE:
+                ok = msgpack_is_number(constant) || msgpack_object_is_str(constant);
+                break;
+            default:
+                ok = false;
+                break;
+        }
+        if (!ok || !pred->path) {
+            return -1;
+        }
+        strings_size += strlen(pred->path) + 1;
+        if (msgpack_object_is_str(constant)) {
+            strings_size += constant->as.str.size;
+        }
+    }
+    
+    filter->allocator = allocator;
+    filter->count = count;
+    filter->strings_size = strings_size;
+    filter->predicates = (msgpack_predicate *)msgpack_alloc(allocator, count * sizeof(msgpack_predicate));
+    filter->strings = (char *)msgpack_alloc(allocator, strings_size);
+    if ((count > 0 && !filter->predicates) || (strings_size > 0 && !filter->strings)) {
+        msgpack_filter_free(filter);
+        return -1;
+    }
+    char *out = filter->strings;
+    for (size_t i = 0; i < count; i++) {
+        msgpack_predicate *pred = &filter->predicates[i];
+        *pred = predicates[i];
+        size_t path_len = strlen(pred->path) + 1;
+        memcpy(out, pred->path, path_len);
+        pred->path = out;
+        out += path_len;
+        if (msgpack_object_is_str(&pred->value)) {
+            memcpy(out, pred->value.as.str.ptr, pred->value.as.str.size);
+            pred->value.as.str.ptr = out;
+            out += pred->value.as.str.size;
+        }
+    }
+    return 0;
+}
+
+void msgpack_filter_free(msgpack_filter *filter) {
+    msgpack_dealloc(filter->allocator, filter->predicates, filter->count * sizeof(msgpack_predicate));
+    msgpack_dealloc(filter->allocator, filter->strings, filter->strings_size);
+    filter->predicates = NULL;
+    filter->strings = NULL;
+    filter->count = 0;
+    filter->strings_size = 0;
+}
+
+/* Evaluates the conjunction on the message at the start of data without
+ * decoding it: each predicate resolves its field with a view lookup, and
+ * evaluation stops at the first predicate that fails. A missing field, or a
+ * message too malformed to reach it, fails its predicate. */
+bool msgpack_filter_match(const msgpack_filter *filter, const void *data, size_t len) {
+    msgpack_view view;
+    msgpack_view_init(&view, data, len);
+    for (size_t i = 0; i < filter->count; i++) {
+        const msgpack_predicate *pred = &filter->predicates[i];
+        msgpack_view target;
+        msgpack_object field;
+        if (msgpack_view_get(&view, pred->path, &target) != 0 || msgpack_view_read(&target, &field) != 0 ||
+            !msgpack_predicate_holds(pred, &field)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Advances through a stream of messages and decodes the next one that
+ * matches. Messages that don't match are skipped without allocating. Returns
+ * -1 at the end of the stream (msgpack_reader_remaining is 0) or on a
+ * malformed message (the reader is left at its start). */
+int msgpack_read_filtered(msgpack_reader *reader, const msgpack_filter *filter, msgpack_object *obj) {
+    msgpack_reader_clear_error(reader);
+    while (msgpack_reader_remaining(reader) > 0) {
+        size_t start = reader->position;
+        if (msgpack_skip_object(reader) != 0) {
+            return -1;
+        }
+        if (msgpack_filter_match(filter, reader->data + start, reader->position - start)) {
+            reader->position = start;
+            return msgpack_read_object(reader, obj);
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,320 @@
+#ifndef MSGPACK_INTERNAL_H
+#define MSGPACK_INTERNAL_H
+
+#include "msgpack/msgpack.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Allocation helpers shared by the library's translation units. A NULL
+ * allocator means the C library heap. Zero-byte requests return NULL
+ * without calling into the allocator. */
+static inline void *msgpack_alloc(const msgpack_allocator *a, size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+    return a ? a->allocate(size, a->user_data) : malloc(size);
+}
+
+static inline void *msgpack_realloc(const msgpack_allocator *a, void *ptr, size_t old_size, size_t new_size) {
+    if (!a) {
+        return realloc(ptr, new_size);
+    }
+    if (!ptr) {
+        return a->allocate(new_size, a->user_data);
+    }
+    return a->reallocate(ptr, old_size, new_size, a->user_data);
+}
+
+static inline void msgpack_dealloc(const msgpack_allocator *a, void *ptr, size_t size) {
+    if (!ptr) {
+        return;
+    }
+    if (a) {
+        a->deallocate(ptr, size, a->user_data);
+    } else {
+        free(ptr);
+    }
+}
+
+/* Bulk kernels, picked from msgpack_cpu_features (msgpack_cpu.c). The
+ * tagged forms move n records of one tag byte followed by a big-endian
+ * value, the layout of a float32/64, uint32/64 or int32/64 array element,
+ * to and from native 4 or 8-byte values (any type of that size). The
+ * unpack forms stop at the first record whose tag differs and return how
+ * many they decoded. utf8_invalid returns the offset of the first
+ * ill-formed UTF-8 sequence in s, or n if all of it is well-formed. */
+typedef struct msgpack_kernels {
+    void (*pack_tagged64)(uint8_t *dst, const void *src, size_t n, uint8_t tag);
+    size_t (*unpack_tagged64)(void *dst, const uint8_t *src, size_t n, uint8_t tag);
+    void (*pack_tagged32)(uint8_t *dst, const void *src, size_t n, uint8_t tag);
+    size_t (*unpack_tagged32)(void *dst, const uint8_t *src, size_t n, uint8_t tag);
+    size_t (*utf8_invalid)(const uint8_t *s, size_t n);
+} msgpack_kernels;
+
+const msgpack_kernels *msgpack_cpu_kernels(void);
+
+/* Map entries are walked as a flat run of key/value objects. */
+static_assert(sizeof(msgpack_object_kv) == 2 * sizeof(msgpack_object), "msgpack_object_kv must be two packed msgpack_objects");
+
+static inline bool msgpack_object_is_array(const msgpack_object *obj) {
+    return obj->type == MSGPACK_TYPE_FIXARRAY || obj->type == MSGPACK_TYPE_ARRAY16 || obj->type == MSGPACK_TYPE_ARRAY32;
+}
+
+static inline bool msgpack_object_is_map(const msgpack_object *obj) {
+    return obj->type == MSGPACK_TYPE_FIXMAP || obj->type == MSGPACK_TYPE_MAP16 || obj->type == MSGPACK_TYPE_MAP32;
+}
+
+static inline bool msgpack_object_is_str(const msgpack_object *obj) {
+    return obj->type >= MSGPACK_TYPE_FIXSTR && obj->type <= MSGPACK_TYPE_STR32;
+}
+
+/* Integer wire types decode into as.u (unsigned) or as.i (signed). */
+static inline bool msgpack_object_is_unsigned(const msgpack_object *obj) {
+    return obj->type == MSGPACK_TYPE_POSITIVE_FIXINT || (obj->type >= MSGPACK_TYPE_UINT8 && obj->type <= MSGPACK_TYPE_UINT64);
+}
+
+static inline bool msgpack_object_is_signed(const msgpack_object *obj) {
+    return obj->type == MSGPACK_TYPE_NEGATIVE_FIXINT || (obj->type >= MSGPACK_TYPE_INT8 && obj->type <= MSGPACK_TYPE_INT64);
+}
+
+static inline bool msgpack_object_is_float(const msgpack_object *obj) {
+    return obj->type == MSGPACK_TYPE_FLOAT32 || obj->type == MSGPACK_TYPE_FLOAT64;
+}
+
+/* Number of child objects under a container (2 per map entry). */
+static inline uint64_t msgpack_object_child_count(const msgpack_object *obj) {
+    if (msgpack_object_is_array(obj)) return obj->as.array.size;
+    if (msgpack_object_is_map(obj)) return 2 * (uint64_t)obj->as.map.size;
+    return 0;
+}
+
+static inline msgpack_object *msgpack_object_children(const msgpack_object *obj) {
+    if (msgpack_object_is_array(obj)) return obj->as.array.ptr;
+    if (msgpack_object_is_map(obj)) return (msgpack_object *)obj->as.map.ptr;
+    return NULL;
+}
+
+/* Node storage for decoded trees: the reader's zone if it has one, otherwise
+ * its allocator. */
+static inline void *msgpack_reader_alloc(msgpack_reader *reader, size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+    if (reader->zone) {
+        return msgpack_zone_alloc(reader->zone, size);
+    }
+    return msgpack_alloc(reader->allocator, size);
+}
+
+/* How the decoders treat each first byte. Every byte maps to one entry of
+ * msgpack_formats, which gives the decoded type, the operation that reads
+ * the rest, the width of its length or value field, and how many bytes
+ * follow the first byte before any str/bin/ext payload. Fixext payloads
+ * count as header, so a header is bounds checked once as a whole. */
+typedef enum msgpack_op {
+    MSGPACK_OP_INVALID,
+    MSGPACK_OP_NIL,
+    MSGPACK_OP_FALSE,
+    MSGPACK_OP_TRUE,
+    MSGPACK_OP_POSFIX,
+    MSGPACK_OP_NEGFIX,
+    MSGPACK_OP_UINT8,
+    MSGPACK_OP_UINT16,
+    MSGPACK_OP_UINT32,
+    MSGPACK_OP_UINT64,
+    MSGPACK_OP_INT8,
+    MSGPACK_OP_INT16,
+    MSGPACK_OP_INT32,
+    MSGPACK_OP_INT64,
+    MSGPACK_OP_FLOAT32,
+    MSGPACK_OP_FLOAT64,
+    MSGPACK_OP_FIXSTR,
+    MSGPACK_OP_STR8,
+    MSGPACK_OP_STR16,
+    MSGPACK_OP_STR32,
+    MSGPACK_OP_BIN8,
+    MSGPACK_OP_BIN16,
+    MSGPACK_OP_BIN32,
+    MSGPACK_OP_FIXARRAY,
+    MSGPACK_OP_ARRAY16,
+    MSGPACK_OP_ARRAY32,
+    MSGPACK_OP_FIXMAP,
+    MSGPACK_OP_MAP16,
+    MSGPACK_OP_MAP32,
+    MSGPACK_OP_FIXEXT,
+    MSGPACK_OP_EXT8,
+    MSGPACK_OP_EXT16,
+    MSGPACK_OP_EXT32,
+} msgpack_op;
+
+typedef struct msgpack_format {
+    uint8_t type;
+    uint8_t op;
+    uint8_t width;
+    uint8_t header;
+} msgpack_format;
+
+extern const msgpack_format msgpack_formats[256];
+
+/* Big-endian length field of 1, 2 or 4 bytes. */
+static inline uint32_t msgpack_load_length(const uint8_t *p, uint8_t width) {
+    return width == 1 ? p[0] : width == 2 ? msgpack_load_be16(p) : msgpack_load_be32(p);
+}
+
+/* Byte extent of the value starting at p, not counting its children:
+ * *size is the header plus any str/bin/ext payload and *children the number
+ * of values nested directly inside (2 per map entry). Returns 1 if more than
+ * avail bytes are needed to tell, and -1 for the never-used byte 0xC1. Looks
+ * only at lengths, so it works on incomplete input. */
+#define MSGPACK_EXTENT_NEED_MORE 1
+
+static inline int msgpack_value_extent(const uint8_t *p, size_t avail, size_t *size, uint64_t *children) {
+    if (avail == 0) {
+        return MSGPACK_EXTENT_NEED_MORE;
+    }
+    const msgpack_format *format = &msgpack_formats[p[0]];
+    *children = 0;
+    *size = 1 + (size_t)format->header;
+    switch (format->op) {
+        case MSGPACK_OP_INVALID:
+            return -1;
+        case MSGPACK_OP_FIXSTR:
+            *size += p[0] & 0x1F;
+            return 0;
+        case MSGPACK_OP_FIXARRAY:
+            *children = p[0] & 0x0F;
+            return 0;
+        case MSGPACK_OP_FIXMAP:
+            *children = 2 * (uint64_t)(p[0] & 0x0F);
+            return 0;
+        case MSGPACK_OP_STR8: case MSGPACK_OP_STR16: case MSGPACK_OP_STR32:
+        case MSGPACK_OP_BIN8: case MSGPACK_OP_BIN16: case MSGPACK_OP_BIN32:
+        case MSGPACK_OP_EXT8: case MSGPACK_OP_EXT16: case MSGPACK_OP_EXT32:
+            if (avail < *size) {
+                return MSGPACK_EXTENT_NEED_MORE;
+            }
+            *size += msgpack_load_length(p + 1, format->width);
+            return 0;
+        case MSGPACK_OP_ARRAY16: case MSGPACK_OP_ARRAY32:
+        case MSGPACK_OP_MAP16: case MSGPACK_OP_MAP32:
+            if (avail < *size) {
+                return MSGPACK_EXTENT_NEED_MORE;
+            }
+            *children = msgpack_load_length(p + 1, format->width);
+            if (format->op >= MSGPACK_OP_MAP16) {
+                *children *= 2;
+            }
+            return 0;
+        default:
+            return 0;
+    }
+}
+
+/* Decodes one header from the reader (msgpack_reader.c). Scalars are decoded
+ * fully; arrays and maps get their type and element count with ptr NULL. */
+int msgpack_read_header(msgpack_reader *reader, msgpack_object *obj);
+
+/* Appends the encoding of a whole tree to buf (msgpack.c). */
+int msgpack_pack_object(msgpack_buffer *buf, const msgpack_object *obj, size_t max_depth);
+
+/* Steps *position past count values by their headers alone
+ * (msgpack_reader.c). */
+int msgpack_scan_values(const uint8_t *data, size_t len, size_t *position, uint64_t count);
+
+/* Explicit stack for the iterative tree walkers. The first
+ * MSGPACK_STACK_INLINE frames live inside the struct (on the caller's C
+ * stack); deeper nesting spills to the heap. */
+#define MSGPACK_STACK_INLINE 32
+
+typedef struct msgpack_frame {
+    msgpack_object *items;
+    uint64_t count;
+    uint64_t index;
+    bool is_map;
+} msgpack_frame;
+
+typedef struct msgpack_stack {
+    msgpack_frame *frames;
+    size_t depth;
+    size_t capacity;
+    const msgpack_allocator *allocator;
+    msgpack_frame inline_frames[MSGPACK_STACK_INLINE];
+} msgpack_stack;
+
+static inline void msgpack_stack_init(msgpack_stack *stack, const msgpack_allocator *allocator) {
+    stack->frames = stack->inline_frames;
+    stack->depth = 0;
+    stack->capacity = MSGPACK_STACK_INLINE;
+    stack->allocator = allocator;
+}
+
+static inline void msgpack_stack_free(msgpack_stack *stack) {
+    if (stack->frames != stack->inline_frames) {
+        msgpack_dealloc(stack->allocator, stack->frames, stack->capacity * sizeof(msgpack_frame));
+    }
+    stack->frames = stack->inline_frames;
+    stack->depth = 0;
+    stack->capacity = MSGPACK_STACK_INLINE;
+}
+
+static inline int msgpack_stack_reserve(msgpack_stack *stack, size_t new_capacity) {
+    if (new_capacity <= stack->capacity) {
+        return 0;
+    }
+    msgpack_frame *frames = (msgpack_frame *)msgpack_alloc(stack->allocator, new_capacity * sizeof(msgpack_frame));
+    if (!frames) {
+        return -1;
+    }
+    memcpy(frames, stack->frames, stack->depth * sizeof(msgpack_frame));
+    if (stack->frames != stack->inline_frames) {
+        msgpack_dealloc(stack->allocator, stack->frames, stack->capacity * sizeof(msgpack_frame));
+    }
+    stack->frames = frames;
+    stack->capacity = new_capacity;
+    return 0;
+}
+
+static inline int msgpack_stack_push(msgpack_stack *stack, msgpack_object *items, uint64_t count) {
+    if (stack->depth == stack->capacity && msgpack_stack_reserve(stack, stack->capacity * 2) != 0) {
+        return -1;
+    }
+    stack->frames[stack->depth++] = (msgpack_frame){.items = items, .count = count, .index = 0};
+    return 0;
+}
+
+static inline msgpack_frame *msgpack_stack_top(msgpack_stack *stack) {
+    return &stack->frames[stack->depth - 1];
+}
+
+bool msgpack_reader_depth_exceeded(const msgpack_reader *reader, size_t depth);
+
+/* Called by every public read entry point, so utf8_error_offset only ever
+ * describes the most recent read. */
+static inline void msgpack_reader_clear_error(msgpack_reader *reader) {
+    reader->utf8_error_offset = SIZE_MAX;
+}
+
+/* Compact trees live in one block laid out in pre-order: every container's
+ * children are contiguous and follow the subtrees of its earlier siblings.
+ * The block starts with its own size so it can be handed back to a sized
+ * deallocator. */
+typedef union msgpack_compact_prefix {
+    size_t size;
+    msgpack_object align;
+} msgpack_compact_prefix;
+
+/* The two passes of the compact decoder (msgpack_reader.c): counting the
+ * nodes of one value, then filling them from cursor with a stack reserved
+ * to the counted depth. */
+int msgpack_count_nodes(msgpack_reader *reader, size_t *elements, size_t *entries, size_t *max_stack);
+uint8_t *msgpack_fill_compact(msgpack_reader *reader, msgpack_object *obj, uint8_t *cursor, msgpack_stack *stack);
+
+/* Runs fn(ctx, task, worker) for every task in [0, tasks) across the pool
+ * and returns once all have finished (msgpack_pool.c). Tasks are claimed
+ * one at a time from a shared counter; worker is in [0, thread_count) and
+ * the caller runs as worker 0. */
+typedef void (*msgpack_pool_task)(void *ctx, size_t task, size_t worker);
+void msgpack_pool_run(msgpack_pool *pool, size_t tasks, msgpack_pool_task fn, void *ctx);
+
+#endif
@@ -0,0 +1,145 @@
+#include "msgpack/msgpack.h"
+#include "msgpack_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#define MSGPACK_IOVEC_INITIAL_SEGMENTS 16
+#define MSGPACK_IOVEC_SCRATCH_SIZE 256
+
+int msgpack_iovec_writer_init(msgpack_iovec_writer *w, size_t threshold) {
+    return msgpack_iovec_writer_init_with_allocator(w, threshold, NULL);
+}
+
+/* The scratch buffer, the segment list and the iovec list all use the
+ * allocator; NULL means malloc/realloc/free. */
+int msgpack_iovec_writer_init_with_allocator(msgpack_iovec_writer *w, size_t threshold, const msgpack_allocator *allocator) {
+    if (msgpack_buffer_init_with_allocator(&w->scratch, MSGPACK_IOVEC_SCRATCH_SIZE, allocator) != 0) {
+        return -1;
+    }
+    w->segments = NULL;
+    w->segment_count = 0;
+    w->segment_capacity = 0;
+    w->mark = 0;
+    w->threshold = threshold ? threshold : MSGPACK_IOVEC_DEFAULT_THRESHOLD;
+    w->iov = NULL;
+    w->iov_capacity = 0;
+    return 0;
+}
+
+void msgpack_iovec_writer_free(msgpack_iovec_writer *w) {
+    msgpack_dealloc(w->scratch.allocator, w->segments, w->segment_capacity * sizeof(msgpack_iovec_segment));
+    msgpack_dealloc(w->scratch.allocator, w->iov, w->iov_capacity * sizeof(struct iovec));
+    msgpack_buffer_free(&w->scratch);
+    w->segments = NULL;
+    w->segment_count = 0;
+    w->segment_capacity = 0;
+    w->mark = 0;
+    w->iov = NULL;
+    w->iov_capacity = 0;
+}
+
+void msgpack_iovec_writer_clear(msgpack_iovec_writer *w) {
+    msgpack_buffer_clear(&w->scratch);
+    w->segment_count = 0;
+    w->mark = 0;
+}
+
+static int msgpack_iovec_push(msgpack_iovec_writer *w, const uint8_t *ref, size_t offset, size_t len) {
+    if (w->segment_count == w->segment_capacity) {
+        size_t new_capacity = w->segment_capacity ? w->segment_capacity * 2 : MSGPACK_IOVEC_INITIAL_SEGMENTS;
+        msgpack_iovec_segment *segments = (msgpack_iovec_segment *)msgpack_realloc(w->scratch.allocator, w->segments,
+            w->segment_capacity * sizeof(msgpack_iovec_segment), new_capacity * sizeof(msgpack_iovec_segment));
+        if (!segments) {
+            return -1;
+        }
+        w->segments = segments;
+        w->segment_capacity = new_capacity;
+    }
+    w->segments[w->segment_count++] = (msgpack_iovec_segment){.ref = ref, .offset = offset, .len = len};
+    return 0;
+}
+
+/* Closes the run of scratch bytes written since the last reference, so that
+ * the next segment can point at caller memory. Scratch segments are stored
+ * as offsets because the scratch buffer may still move when it grows. */
+static int msgpack_iovec_seal(msgpack_iovec_writer *w) {
+    if (w->scratch.length == w->mark) {
+        return 0;
+    }
+    if (msgpack_iovec_push(w, NULL, w->mark, w->scratch.length - w->mark) != 0) {
+        return -1;
+    }
+    w->mark = w->scratch.length;
+    return 0;
+}
+
+static int msgpack_iovec_reference(msgpack_iovec_writer *w, const void *data, size_t len) {
+    if (msgpack_iovec_seal(w) != 0) return -1;
+    return msgpack_iovec_push(w, (const uint8_t *)data, 0, len);
+}
+
+int msgpack_iovec_pack_str(msgpack_iovec_writer *w, const char *str, size_t len) {
+    if (len < w->threshold) {
+        return msgpack_pack_str(&w->scratch, str, len);
+    }
+    msgpack_writer cursor;
+    if (msgpack_writer_begin(&cursor, &w->scratch, MSGPACK_WRITER_MAX_SCALAR) != 0) return -1;
+    msgpack_pack_str_header_unchecked(&cursor, len);
+    msgpack_writer_end(&cursor);
+    return msgpack_iovec_reference(w, str, len);
+}
+
+int msgpack_iovec_pack_bin(msgpack_iovec_writer *w, const uint8_t *bin, size_t len) {
+    if (len < w->threshold) {
+        return msgpack_pack_bin(&w->scratch, bin, len);
+    }
+    msgpack_writer cursor;
+    if (msgpack_writer_begin(&cursor, &w->scratch, MSGPACK_WRITER_MAX_SCALAR) != 0) return -1;
+    msgpack_pack_bin_header_unchecked(&cursor, len);
+    msgpack_writer_end(&cursor);
+    return msgpack_iovec_reference(w, bin, len);
+}
+
+int msgpack_iovec_pack_ext(msgpack_iovec_writer *w, int8_t type, const uint8_t *data, size_t len) {
+    if (len < w->threshold) {
+        return msgpack_pack_ext(&w->scratch, type, data, len);
+    }
+    msgpack_writer cursor;
+    if (msgpack_writer_begin(&cursor, &w->scratch, MSGPACK_WRITER_MAX_SCALAR) != 0) return -1;
+    msgpack_pack_ext_header_unchecked(&cursor, type, len);
+    msgpack_writer_end(&cursor);
+    return msgpack_iovec_reference(w, data, len);
+}
+
+int msgpack_iovec_writer_finish(msgpack_iovec_writer *w, const struct iovec **iov, size_t *iovcnt) {
+    if (msgpack_iovec_seal(w) != 0) return -1;
+    if (w->segment_count > w->iov_capacity) {
+        struct iovec *new_iov = (struct iovec *)msgpack_realloc(w->scratch.allocator, w->iov,
+            w->iov_capacity * sizeof(struct iovec), w->segment_count * sizeof(struct iovec));
+        if (!new_iov) {
+            return -1;
+        }
+        w->iov = new_iov;
+        w->iov_capacity = w->segment_count;
+    }
+    for (size_t i = 0; i < w->segment_count; i++) {
+        const msgpack_iovec_segment *seg = &w->segments[i];
+        const uint8_t *base = seg->ref ? seg->ref : w->scratch.data + seg->offset;
+        w->iov[i].iov_base = (void *)base;
+        w->iov[i].iov_len = seg->len;
+    }
+    *iov = w->iov;
+    *iovcnt = w->segment_count;
+    return 0;
+}
+
+size_t msgpack_iovec_writer_length(const msgpack_iovec_writer *w) {
+    size_t total = w->scratch.length;
+    for (size_t i = 0; i < w->segment_count; i++) {
+        if (w->segments[i].ref) {
+            total += w->segments[i].len;
+        }
+    }
+    return total;
+}
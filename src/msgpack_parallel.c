@@ -0,0 +1,397 @@
+#include "msgpack/msgpack.h"
+#include "msgpack_internal.h"
+
+#define MSGPACK_PARALLEL_CHUNKS_PER_THREAD 8
+
+/* A run of consecutive children of the root, with the byte range they
+ * occupy and, after the counting pass, the size of their subtrees. The
+ * last chunk is not scanned up front (open_end): its range runs to the end
+ * of the input until the counting pass finds where its values stop. */
+typedef struct msgpack_decode_chunk {
+    size_t begin;
+    size_t end;
+    bool open_end;
+    size_t first;
+    size_t count;
+    size_t elements;
+    size_t entries;
+    size_t max_stack;
+    size_t utf8_error_offset;
+    uint8_t *cursor;
+    int status;
+} msgpack_decode_chunk;
+
+typedef struct msgpack_decode_job {
+    const msgpack_reader *reader;
+    size_t max_depth;
+    msgpack_decode_chunk *chunks;
+    msgpack_object *children;
+} msgpack_decode_job;
+
+static void msgpack_chunk_reader(const msgpack_decode_job *job, const msgpack_decode_chunk *chunk, msgpack_reader *reader) {
+    msgpack_reader_init(reader, job->reader->data + chunk->begin, chunk->end - chunk->begin);
+    reader->allocator = job->reader->allocator;
+    reader->max_depth = job->max_depth;
+    reader->validate_utf8 = job->reader->validate_utf8;
+}
+
+static void msgpack_count_chunk(void *ctx, size_t task, size_t worker) {
+    (void)worker;
+    msgpack_decode_job *job = (msgpack_decode_job *)ctx;
+    msgpack_decode_chunk *chunk = &job->chunks[task];
+    msgpack_reader reader;
+    msgpack_chunk_reader(job, chunk, &reader);
+    for (size_t i = 0; i < chunk->count; i++) {
+        size_t depth = 0;
+        if (msgpack_count_nodes(&reader, &chunk->elements, &chunk->entries, &depth) != 0) {
+            if (reader.utf8_error_offset != SIZE_MAX) {
+                chunk->utf8_error_offset = chunk->begin + reader.utf8_error_offset;
+            }
+            chunk->status = -1;
+            return;
+        }
+        chunk->max_stack = depth > chunk->max_stack ? depth : chunk->max_stack;
+    }
+    if (chunk->open_end) {
+        chunk->end = chunk->begin + reader.position;
+        return;
+    }
+    /* the split scan and the decoder must agree on where the chunk ends */
+    chunk->status = msgpack_reader_remaining(&reader) == 0 ? 0 : -1;
+}
+
+static void msgpack_fill_chunk(void *ctx, size_t task, size_t worker) {
+    (void)worker;
+    msgpack_decode_job *job = (msgpack_decode_job *)ctx;
+    msgpack_decode_chunk *chunk = &job->chunks[task];
+    msgpack_reader reader;
+    msgpack_chunk_reader(job, chunk, &reader);
+    msgpack_stack stack;
+    msgpack_stack_init(&stack, reader.allocator);
+    if (msgpack_stack_reserve(&stack, chunk->max_stack) != 0) {
+        chunk->status = -1;
+        return;
+    }
+    uint8_t *cursor = chunk->cursor;
+    for (size_t i = 0; i < chunk->count; i++) {
+        cursor = msgpack_fill_compact(&reader, &job->children[chunk->first + i], cursor, &stack);
+    }
+    msgpack_stack_free(&stack);
+}
+
+/* Decodes one value like msgpack_read_object_compact, splitting the
+ * children of a large root array or map across the pool, one chunk per
+ * thread. MessagePack containers do not record their byte length, so the
+ * calling thread finds the cuts with the flat header-only skip of
+ * msgpack_scan_values, and only up to the start of the last chunk. The
+ * pool then counts the nodes of every chunk (which also finds the end of
+ * the last one), one block is allocated for the whole tree, and the pool
+ * fills each chunk into its own slice of it. The layout is the same as the sequential
+ * compact decoder's, so the result is released with
+ * msgpack_object_free_compact. With a zone on the reader the block comes
+ * from the zone instead (allocated on the calling thread, so the zone needs
+ * no locking) and is released with it. Small roots, and pools of one
+ * thread, take the sequential path, which is msgpack_read_object when there
+ * is a zone. Workers nested deeper than the inline stack call the
+ * reader's allocator, which must then be thread-safe. */
+int msgpack_read_object_parallel(msgpack_reader *reader, msgpack_object *obj, msgpack_pool *pool) {
+    msgpack_reader_clear_error(reader);
+    size_t start = reader->position;
+    msgpack_object root;
+    if (msgpack_read_header(reader, &root) != 0) {
+        return -1;
+    }
+    uint64_t children = msgpack_object_child_count(&root);
+    /* with max_depth 1 the children may not be containers, which the
+     * per-chunk readers cannot express */
+    if (pool->thread_count < 2 || children < MSGPACK_PARALLEL_MIN_ELEMENTS || reader->max_depth == 1) {
+        reader->position = start;
+        return reader->zone ? msgpack_read_object(reader, obj) : msgpack_read_object_compact(reader, obj);
+    }
+
+    /* maps are cut between pairs */
+    size_t unit = msgpack_object_is_map(&root) ? 2 : 1;
+    size_t units = (size_t)children / unit;
+    size_t chunk_count = pool->thread_count < units ? pool->thread_count : units;
+    msgpack_decode_chunk *chunks = (msgpack_decode_chunk *)msgpack_alloc(reader->allocator, chunk_count * sizeof(msgpack_decode_chunk));
+    if (!chunks) {
+        reader->position = start;
+        return -1;
+    }
+    size_t position = reader->position;
+    size_t first = 0;
+    for (size_t i = 0; i < chunk_count; i++) {
+        /* the first units % chunk_count chunks take one unit more */
+        size_t count = (units / chunk_count + (i < units % chunk_count)) * unit;
+        chunks[i] = (msgpack_decode_chunk){.begin = position, .first = first, .count = count, .utf8_error_offset = SIZE_MAX};
+        first += count;
+        if (i + 1 == chunk_count) {
+            chunks[i].end = reader->length;
+            chunks[i].open_end = true;
+        } else if (msgpack_scan_values(reader->data, reader->length, &position, count) != 0) {
+            msgpack_dealloc(reader->allocator, chunks, chunk_count * sizeof(msgpack_decode_chunk));
+            reader->position = start;
+            return -1;
+        } else {
+            chunks[i].end = position;
+        }
+    }
+
+    msgpack_decode_job job = {
+        .reader = reader,
+        .max_depth = reader->max_depth ? reader->max_depth - 1 : 0,
+        .chunks = chunks,
+    };
+    msgpack_pool_run(pool, chunk_count, msgpack_count_chunk, &job);
+    size_t nodes = (size_t)children * sizeof(msgpack_object);
+    int ret = 0;
+    for (size_t i = 0; i < chunk_count; i++) {
+        if (chunks[i].status != 0) {
+            /* chunks are in input order, so the first one seen is the
+             * first bad byte */
+            if (ret == 0 && chunks[i].utf8_error_offset != SIZE_MAX) {
+                reader->utf8_error_offset = chunks[i].utf8_error_offset;
+            }
+            ret = -1;
+        }
+        nodes += chunks[i].elements * sizeof(msgpack_object) + chunks[i].entries * sizeof(msgpack_object_kv);
+    }
+    msgpack_compact_prefix *prefix = NULL;
+    size_t size = sizeof(msgpack_compact_prefix) + nodes;
+    if (ret == 0 && reader->zone) {
+        job.children = (msgpack_object *)msgpack_zone_alloc(reader->zone, nodes);
+        ret = job.children ? 0 : -1;
+    } else if (ret == 0) {
+        prefix = (msgpack_compact_prefix *)msgpack_alloc(reader->allocator, size);
+        ret = prefix ? 0 : -1;
+        if (prefix) {
+            prefix->size = size;
+            job.children = (msgpack_object *)(prefix + 1);
+        }
+    }
+    if (ret == 0) {
+        uint8_t *cursor = (uint8_t *)(job.children + children);
+        for (size_t i = 0; i < chunk_count; i++) {
+            chunks[i].cursor = cursor;
+            cursor += chunks[i].elements * sizeof(msgpack_object) + chunks[i].entries * sizeof(msgpack_object_kv);
+        }
+        msgpack_pool_run(pool, chunk_count, msgpack_fill_chunk, &job);
+        for (size_t i = 0; i < chunk_count; i++) {
+            if (chunks[i].status != 0) {
+                ret = -1;
+            }
+        }
+        /* a zone block stays until the zone is reset */
+        if (ret != 0 && prefix) {
+            msgpack_dealloc(reader->allocator, prefix, size);
+        }
+    }
+    size_t end = chunks[chunk_count - 1].end;
+    msgpack_dealloc(reader->allocator, chunks, chunk_count * sizeof(msgpack_decode_chunk));
+    if (ret != 0) {
+        reader->position = start;
+        return -1;
+    }
+
+    *obj = root;
+    if (msgpack_object_is_array(obj)) {
+        obj->as.array.ptr = job.children;
+    } else {
+        obj->as.map.ptr = (msgpack_object_kv *)job.children;
+    }
+    reader->position = end;
+    return 0;
+}
+
+int msgpack_batch_init(msgpack_batch *batch, size_t initial_capacity) {
+    return msgpack_batch_init_with_allocator(batch, initial_capacity, NULL);
+}
+
+int msgpack_batch_init_with_allocator(msgpack_batch *batch, size_t initial_capacity, const msgpack_allocator *allocator) {
+    batch->offsets = NULL;
+    batch->count = 0;
+    batch->offsets_capacity = 0;
+    batch->scratch = NULL;
+    batch->scratch_count = 0;
+    batch->scratch_capacity = 0;
+    batch->max_depth = MSGPACK_DEFAULT_MAX_DEPTH;
+    batch->wrap_array = false;
+    return msgpack_buffer_init_with_allocator(&batch->buffer, initial_capacity, allocator);
+}
+
+void msgpack_batch_free(msgpack_batch *batch) {
+    const msgpack_allocator *allocator = batch->buffer.allocator;
+    for (size_t i = 0; i < batch->scratch_count; i++) {
+        msgpack_buffer_free(&batch->scratch[i]);
+    }
+    msgpack_dealloc(allocator, batch->scratch, batch->scratch_capacity * sizeof(msgpack_buffer));
+    msgpack_dealloc(allocator, batch->offsets, batch->offsets_capacity * sizeof(size_t));
+    msgpack_buffer_free(&batch->buffer);
+    batch->offsets = NULL;
+    batch->count = 0;
+    batch->offsets_capacity = 0;
+    batch->scratch = NULL;
+    batch->scratch_count = 0;
+    batch->scratch_capacity = 0;
+}
+
+void msgpack_batch_set_max_depth(msgpack_batch *batch, size_t max_depth) {
+    batch->max_depth = max_depth;
+}
+
+void msgpack_batch_set_wrap_array(msgpack_batch *batch, bool wrap_array) {
+    batch->wrap_array = wrap_array;
+}
+
+/* A run of consecutive objects, encoded by whichever worker claims it into
+ * that worker's scratch buffer at [begin, end), then copied to base in the
+ * output. */
+typedef struct msgpack_encode_chunk {
+    size_t first;
+    size_t count;
+    size_t worker;
+    size_t begin;
+    size_t end;
+    size_t base;
+    int status;
+} msgpack_encode_chunk;
+
+typedef struct msgpack_encode_job {
+    const msgpack_object *objs;
+    msgpack_batch *batch;
+    msgpack_encode_chunk *chunks;
+} msgpack_encode_job;
+
+/* Object ends are first recorded relative to the chunk's start in scratch
+ * and rebased once the chunk's place in the output is known. */
+static void msgpack_encode_chunk_task(void *ctx, size_t task, size_t worker) {
+    msgpack_encode_job *job = (msgpack_encode_job *)ctx;
+    msgpack_encode_chunk *chunk = &job->chunks[task];
+    msgpack_buffer *scratch = &job->batch->scratch[worker];
+    chunk->worker = worker;
+    chunk->begin = scratch->length;
+    for (size_t i = chunk->first; i < chunk->first + chunk->count; i++) {
+        if (msgpack_pack_object(scratch, &job->objs[i], job->batch->max_depth) != 0) {
+            chunk->status = -1;
+            return;
+        }
+        job->batch->offsets[i + 1] = scratch->length - chunk->begin;
+    }
+    chunk->end = scratch->length;
+}
+
+static void msgpack_copy_chunk_task(void *ctx, size_t task, size_t worker) {
+    (void)worker;
+    msgpack_encode_job *job = (msgpack_encode_job *)ctx;
+    msgpack_encode_chunk *chunk = &job->chunks[task];
+    memcpy(job->batch->buffer.data + chunk->base, job->batch->scratch[chunk->worker].data + chunk->begin, chunk->end - chunk->begin);
+    for (size_t i = chunk->first; i < chunk->first + chunk->count; i++) {
+        job->batch->offsets[i + 1] += chunk->base;
+    }
+}
+
+static int msgpack_batch_prepare(msgpack_batch *batch, size_t n, size_t threads) {
+    const msgpack_allocator *allocator = batch->buffer.allocator;
+    if (n + 1 > batch->offsets_capacity) {
+        size_t *offsets = (size_t *)msgpack_realloc(allocator, batch->offsets, batch->offsets_capacity * sizeof(size_t), (n + 1) * sizeof(size_t));
+        if (!offsets) {
+            return -1;
+        }
+        batch->offsets = offsets;
+        batch->offsets_capacity = n + 1;
+    }
+    /* the array and the buffers in it grow separately, so a buffer that
+     * fails to initialise leaves a capacity the next call and
+     * msgpack_batch_free still release correctly */
+    if (threads > batch->scratch_capacity) {
+        msgpack_buffer *scratch = (msgpack_buffer *)msgpack_realloc(allocator, batch->scratch, batch->scratch_capacity * sizeof(msgpack_buffer), threads * sizeof(msgpack_buffer));
+        if (!scratch) {
+            return -1;
+        }
+        batch->scratch = scratch;
+        batch->scratch_capacity = threads;
+    }
+    while (batch->scratch_count < threads) {
+        if (msgpack_buffer_init_with_allocator(&batch->scratch[batch->scratch_count], 0, allocator) != 0) {
+            return -1;
+        }
+        batch->scratch_count++;
+    }
+    for (size_t i = 0; i < batch->scratch_count; i++) {
+        msgpack_buffer_clear(&batch->scratch[i]);
+    }
+    msgpack_buffer_clear(&batch->buffer);
+    batch->count = 0;
+    return 0;
+}
+
+/* Encodes n independent trees into out as one contiguous buffer with an
+ * offset table. Runs of objects are claimed from the pool's shared task
+ * counter (not work stealing), so threads that finish early keep taking
+ * work; each worker encodes into its own scratch buffer, and the runs are
+ * then copied into place in parallel. With one thread the objects are encoded straight
+ * into the output. Returns -1 if any object fails to encode (for example
+ * nesting beyond max_depth), leaving out empty. Workers grow their scratch
+ * buffers through the batch's allocator, which must then be
+ * thread-safe. */
+int msgpack_serialize_batch(const msgpack_object *objs, size_t n, msgpack_pool *pool, msgpack_batch *out) {
+    if (msgpack_batch_prepare(out, n, pool->thread_count) != 0) {
+        return -1;
+    }
+    if (out->wrap_array) {
+        if (n > UINT32_MAX || msgpack_pack_array(&out->buffer, (uint32_t)n) != 0) {
+            return -1;
+        }
+    }
+    out->offsets[0] = out->buffer.length;
+
+    if (pool->thread_count < 2) {
+        for (size_t i = 0; i < n; i++) {
+            if (msgpack_pack_object(&out->buffer, &objs[i], out->max_depth) != 0) {
+                msgpack_buffer_clear(&out->buffer);
+                return -1;
+            }
+            out->offsets[i + 1] = out->buffer.length;
+        }
+        out->count = n;
+        return 0;
+    }
+
+    size_t wanted = pool->thread_count * MSGPACK_PARALLEL_CHUNKS_PER_THREAD;
+    size_t per_chunk = n > wanted ? (n + wanted - 1) / wanted : 1;
+    size_t chunk_count = n > 0 ? (n + per_chunk - 1) / per_chunk : 0;
+    msgpack_encode_chunk *chunks = (msgpack_encode_chunk *)msgpack_alloc(out->buffer.allocator, chunk_count * sizeof(msgpack_encode_chunk));
+    if (chunk_count > 0 && !chunks) {
+        msgpack_buffer_clear(&out->buffer);
+        return -1;
+    }
+    for (size_t i = 0; i < chunk_count; i++) {
+        size_t first = i * per_chunk;
+        chunks[i] = (msgpack_encode_chunk){.first = first, .count = first + per_chunk <= n ? per_chunk : n - first};
+    }
+    msgpack_encode_job job = {.objs = objs, .batch = out, .chunks = chunks};
+    msgpack_pool_run(pool, chunk_count, msgpack_encode_chunk_task, &job);
+
+    int ret = 0;
+    size_t total = out->buffer.length;
+    for (size_t i = 0; i < chunk_count; i++) {
+        if (chunks[i].status != 0) {
+            ret = -1;
+            break;
+        }
+        chunks[i].base = total;
+        total += chunks[i].end - chunks[i].begin;
+    }
+    if (ret == 0 && msgpack_buffer_reserve(&out->buffer, total - out->buffer.length) != 0) {
+        ret = -1;
+    }
+    if (ret == 0) {
+        msgpack_pool_run(pool, chunk_count, msgpack_copy_chunk_task, &job);
+        out->buffer.length = total;
+        out->count = n;
+    } else {
+        msgpack_buffer_clear(&out->buffer);
+    }
+    msgpack_dealloc(out->buffer.allocator, chunks, chunk_count * sizeof(msgpack_encode_chunk));
+    return ret;
+}
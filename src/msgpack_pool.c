@@ -0,0 +1,165 @@
+#include "msgpack/msgpack.h"
+#include "msgpack_internal.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+/* Workers sleep on wake until the generation changes, drain the shared task
+ * counter, and the last one to finish signals done. run_lock serialises
+ * jobs from different callers on the same pool. */
+struct msgpack_pool_shared {
+    pthread_mutex_t lock;
+    pthread_mutex_t run_lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    pthread_t *threads;
+    size_t started;
+    uint64_t generation;
+    size_t active;
+    bool stopping;
+    msgpack_pool_task fn;
+    void *ctx;
+    size_t tasks;
+    atomic_size_t next;
+};
+
+typedef struct msgpack_pool_worker {
+    struct msgpack_pool_shared *shared;
+    size_t index;
+} msgpack_pool_worker;
+
+static void msgpack_pool_drain(struct msgpack_pool_shared *shared, size_t worker) {
+    size_t task;
+    while ((task = atomic_fetch_add_explicit(&shared->next, 1, memory_order_relaxed)) < shared->tasks) {
+        shared->fn(shared->ctx, task, worker);
+    }
+}
+
+static void *msgpack_pool_main(void *arg) {
+    msgpack_pool_worker *worker = (msgpack_pool_worker *)arg;
+    struct msgpack_pool_shared *shared = worker->shared;
+    size_t index = worker->index;
+    uint64_t seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&shared->lock);
+        while (shared->generation == seen && !shared->stopping) {
+            pthread_cond_wait(&shared->wake, &shared->lock);
+        }
+        if (shared->stopping) {
+            pthread_mutex_unlock(&shared->lock);
+            break;
+        }
+        seen = shared->generation;
+        pthread_mutex_unlock(&shared->lock);
+
+        msgpack_pool_drain(shared, index);
+
+        pthread_mutex_lock(&shared->lock);
+        if (--shared->active == 0) {
+            pthread_cond_signal(&shared->done);
+        }
+        pthread_mutex_unlock(&shared->lock);
+    }
+    return NULL;
+}
+
+static void msgpack_pool_stop(msgpack_pool *pool) {
+    struct msgpack_pool_shared *shared = pool->shared;
+    pthread_mutex_lock(&shared->lock);
+    shared->stopping = true;
+    pthread_cond_broadcast(&shared->wake);
+    pthread_mutex_unlock(&shared->lock);
+    for (size_t i = 0; i < shared->started; i++) {
+        pthread_join(shared->threads[i], NULL);
+    }
+    msgpack_dealloc(pool->allocator, shared->threads, (pool->thread_count - 1) * sizeof(pthread_t));
+    pthread_cond_destroy(&shared->done);
+    pthread_cond_destroy(&shared->wake);
+    pthread_mutex_destroy(&shared->run_lock);
+    pthread_mutex_destroy(&shared->lock);
+    msgpack_dealloc(pool->allocator, shared, sizeof(*shared) + (pool->thread_count - 1) * sizeof(msgpack_pool_worker));
+}
+
+int msgpack_pool_init(msgpack_pool *pool, size_t thread_count) {
+    return msgpack_pool_init_with_allocator(pool, thread_count, NULL);
+}
+
+int msgpack_pool_init_with_allocator(msgpack_pool *pool, size_t thread_count, const msgpack_allocator *allocator) {
+    if (thread_count == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = online > 0 ? (size_t)online : 1;
+    }
+    pool->thread_count = thread_count;
+    pool->allocator = allocator;
+    size_t extra = thread_count - 1;
+    struct msgpack_pool_shared *shared = (struct msgpack_pool_shared *)msgpack_alloc(allocator, sizeof(*shared) + extra * sizeof(msgpack_pool_worker));
+    if (!shared) {
+        pool->shared = NULL;
+        return -1;
+    }
+    pthread_mutex_init(&shared->lock, NULL);
+    pthread_mutex_init(&shared->run_lock, NULL);
+    pthread_cond_init(&shared->wake, NULL);
+    pthread_cond_init(&shared->done, NULL);
+    shared->threads = NULL;
+    shared->started = 0;
+    shared->generation = 0;
+    shared->active = 0;
+    shared->stopping = false;
+    shared->fn = NULL;
+    shared->ctx = NULL;
+    shared->tasks = 0;
+    atomic_init(&shared->next, 0);
+    pool->shared = shared;
+    if (extra == 0) {
+        return 0;
+    }
+
+    shared->threads = (pthread_t *)msgpack_alloc(allocator, extra * sizeof(pthread_t));
+    if (!shared->threads) {
+        msgpack_pool_stop(pool);
+        pool->shared = NULL;
+        return -1;
+    }
+    msgpack_pool_worker *workers = (msgpack_pool_worker *)(shared + 1);
+    for (size_t i = 0; i < extra; i++) {
+        workers[i] = (msgpack_pool_worker){.shared = shared, .index = i + 1};
+        if (pthread_create(&shared->threads[i], NULL, msgpack_pool_main, &workers[i]) != 0) {
+            msgpack_pool_stop(pool);
+            pool->shared = NULL;
+            return -1;
+        }
+        shared->started++;
+    }
+    return 0;
+}
+
+void msgpack_pool_free(msgpack_pool *pool) {
+    if (pool->shared) {
+        msgpack_pool_stop(pool);
+        pool->shared = NULL;
+    }
+}
+
+void msgpack_pool_run(msgpack_pool *pool, size_t tasks, msgpack_pool_task fn, void *ctx) {
+    struct msgpack_pool_shared *shared = pool->shared;
+    pthread_mutex_lock(&shared->run_lock);
+    pthread_mutex_lock(&shared->lock);
+    shared->fn = fn;
+    shared->ctx = ctx;
+    shared->tasks = tasks;
+    atomic_store_explicit(&shared->next, 0, memory_order_relaxed);
+    shared->active = shared->started;
+    shared->generation++;
+    pthread_cond_broadcast(&shared->wake);
+    pthread_mutex_unlock(&shared->lock);
+
+    msgpack_pool_drain(shared, 0);
+
+    pthread_mutex_lock(&shared->lock);
+    while (shared->active > 0) {
+        pthread_cond_wait(&shared->done, &shared->lock);
+    }
+    pthread_mutex_unlock(&shared->lock);
+    pthread_mutex_unlock(&shared->run_lock);
+}
@@ -0,0 +1,228 @@
+#include "msgpack/msgpack.h"
+#include "msgpack_internal.h"
+#include <string.h>
+
+/* Trie of path segments. Node 0 is the root (the message's top-level map);
+ * index 0 doubles as "none" for child/sibling links. A leaf selects its
+ * whole subtree. */
+struct msgpack_projection_node {
+    size_t key_offset;
+    uint32_t key_len;
+    uint32_t first_child;
+    uint32_t next_sibling;
+    uint32_t child_count;
+    bool leaf;
+};
+
+static uint32_t msgpack_projection_child(const msgpack_projection *proj, uint32_t parent, const char *key, size_t key_len) {
+    for (uint32_t c = proj->nodes[parent].first_child; c != 0; c = proj->nodes[c].next_sibling) {
+        const struct msgpack_projection_node *node = &proj->nodes[c];
+        if (node->key_len == key_len && memcmp(proj->keys + node->key_offset, key, key_len) == 0) {
+            return c;
+        }
+    }
+    return 0;
+}
+
+int msgpack_projection_compile(msgpack_projection *proj, const char *const *paths, size_t count) {
+    return msgpack_projection_compile_with_allocator(proj, paths, count, NULL);
+}
+
+/* Builds the trie in two allocations sized up front: one node per path
+ * segment plus the root, and one buffer for the key bytes. A path that is a
+ * prefix of another ("meta" and "meta.region") selects the whole subtree. */
+int msgpack_projection_compile_with_allocator(msgpack_projection *proj, const char *const *paths, size_t count, const msgpack_allocator *allocator) {
+    size_t max_nodes = 1, keys_size = 0;
+    for (size_t i = 0; i < count; i++) {
+        for (const char *p = paths[i]; *p; p++) {
+            max_nodes += *p == '.';
+        }
+        max_nodes++;
+        keys_size += strlen(paths[i]);
+    }
+    proj->allocator = allocator;
+    proj->nodes = (struct msgpack_projection_node *)msgpack_alloc(allocator, max_nodes * sizeof(struct msgpack_projection_node));
+    proj->keys = (char *)msgpack_alloc(allocator, keys_size);
+    proj->keys_size = keys_size;
+    proj->node_count = 1;
+    proj->node_capacity = max_nodes;
+    if (!proj->nodes || (keys_size > 0 && !proj->keys)) {
+        msgpack_projection_free(proj);
+        return -1;
+    }
+    proj->nodes[0] = (struct msgpack_projection_node){0};
+    
+    size_t keys_used = 0;
+    for (size_t i = 0; i < count; i++) {
+        const char *p = paths[i];
+        uint32_t cur = 0;
+        for (;;) {
+            size_t seg_len = strcspn(p, ".");
+            if (seg_len == 0 || seg_len > UINT32_MAX) {
+                msgpack_projection_free(proj);
+                return -1;
+            }
+            if (proj->nodes[cur].leaf) {
+                break;
+            }
+            uint32_t child = msgpack_projection_child(proj, cur, p, seg_len);
+            if (child == 0) {
+                child = (uint32_t)proj->node_count++;
+                memcpy(proj->keys + keys_used, p, seg_len);
+                proj->nodes[child] = (struct msgpack_projection_node){
+                    .key_offset = keys_used,
+                    .key_len = (uint32_t)seg_len,
+                    .next_sibling = proj->nodes[cur].first_child,
+                };
+                keys_used += seg_len;
+                proj->nodes[cur].first_child = child;
+                proj->nodes[cur].child_count++;
+            }
+            cur = child;
+            p += seg_len;
+            if (*p != '.') {
+                proj->nodes[cur].leaf = true;
+                break;
+            }
+            p++;
+        }
+    }
+    return 0;
+}
+
+void msgpack_projection_free(msgpack_projection *proj) {
+    msgpack_dealloc(proj->allocator, proj->nodes, proj->node_capacity * sizeof(struct msgpack_projection_node));
+    msgpack_dealloc(proj->allocator, proj->keys, proj->keys_size);
+    proj->nodes = NULL;
+    proj->keys = NULL;
+    proj->node_count = 0;
+    proj->node_capacity = 0;
+    proj->keys_size = 0;
+}
+
+/* Releases the entries built so far when a projected map fails part-way. */
+static void msgpack_projection_discard(msgpack_reader *reader, msgpack_object_kv *kv, uint32_t matched, uint32_t capacity) {
+    if (reader->zone) {
+        return;
+    }
+    for (uint32_t i = 0; i < matched; i++) {
+        msgpack_object_free_with_allocator(&kv[i].value, reader->allocator);
+    }
+    msgpack_dealloc(reader->allocator, kv, capacity * sizeof(msgpack_object_kv));
+}
+
+/* Decodes a selected subtree whole. It sits inside `enclosing` containers,
+ * so the reader's depth limit is shifted to keep counting from the root. */
+static int msgpack_projection_read_leaf(msgpack_reader *reader, size_t enclosing, msgpack_object *obj) {
+    size_t max_depth = reader->max_depth;
+    if (max_depth != 0 && enclosing >= max_depth) {
+        size_t start = reader->position;
+        msgpack_object header;
+        if (msgpack_read_header(reader, &header) != 0 || msgpack_object_is_array(&header) || msgpack_object_is_map(&header)) {
+            return -1;
+        }
+        reader->position = start;
+        reader->max_depth = 0;
+    } else if (max_depth != 0) {
+        reader->max_depth = max_depth - enclosing;
+    }
+    int ret = msgpack_read_object(reader, obj);
+    reader->max_depth = max_depth;
+    return ret;
+}
+
+/* Builds the projected copy of a map whose header has just been read. Only
+ * entries whose string key matches a child of `node` are kept, in input
+ * order; everything else is skipped at the byte level. Recursion follows the
+ * compiled paths, so it is bounded by the longest path, not by the input. */
+static int msgpack_project_map(msgpack_reader *reader, const msgpack_projection *proj, uint32_t node,
+                               const msgpack_object *header, size_t depth, msgpack_object *obj) {
+    if (reader->max_depth != 0 && depth >= reader->max_depth) {
+        return -1;
+    }
+    uint32_t capacity = proj->nodes[node].child_count;
+    if (capacity > header->as.map.size) {
+        capacity = header->as.map.size;
+    }
+    msgpack_object_kv *kv = (msgpack_object_kv *)msgpack_reader_alloc(reader, capacity * sizeof(msgpack_object_kv));
+    if (capacity > 0 && !kv) {
+        return -1;
+    }
+    uint32_t matched = 0;
+    for (uint32_t n = 0; n < header->as.map.size; n++) {
+        msgpack_object key;
+        if (msgpack_read_header(reader, &key) != 0) {
+            msgpack_projection_discard(reader, kv, matched, capacity);
+            return -1;
+        }
+        uint32_t child = 0;
+        if (matched < capacity && msgpack_object_is_str(&key)) {
+            child = msgpack_projection_child(proj, node, key.as.str.ptr, key.as.str.size);
+        }
+        int ret = 0;
+        if (child != 0 && proj->nodes[child].leaf) {
+            kv[matched].key = key;
+            ret = msgpack_projection_read_leaf(reader, depth + 1, &kv[matched].value);
+            matched += ret == 0;
+        } else if (child != 0) {
+            size_t start = reader->position;
+            msgpack_object value;
+            ret = msgpack_read_header(reader, &value);
+            if (ret == 0 && msgpack_object_is_map(&value)) {
+                kv[matched].key = key;
+                ret = msgpack_project_map(reader, proj, child, &value, depth + 1, &kv[matched].value);
+                matched += ret == 0;
+            } else if (ret == 0) {
+                /* the path expects a map here; the field is absent */
+                reader->position = start;
+                ret = msgpack_skip_object(reader);
+            }
+        } else {
+            /* the rest of a container key, then the value */
+            for (uint64_t pending = msgpack_object_child_count(&key) + 1; pending > 0 && ret == 0; pending--) {
+                ret = msgpack_skip_object(reader);
+            }
+        }
+        if (ret != 0) {
+            msgpack_projection_discard(reader, kv, matched, capacity);
+            return -1;
+        }
+    }
+    
+    if (matched < capacity && !reader->zone) {
+        if (matched == 0) {
+            msgpack_dealloc(reader->allocator, kv, capacity * sizeof(msgpack_object_kv));
+            kv = NULL;
+        } else {
+            msgpack_object_kv *exact = (msgpack_object_kv *)msgpack_realloc(reader->allocator, kv,
+                capacity * sizeof(msgpack_object_kv), matched * sizeof(msgpack_object_kv));
+            if (!exact) {
+                msgpack_projection_discard(reader, kv, matched, capacity);
+                return -1;
+            }
+            kv = exact;
+        }
+    }
+    obj->type = header->type;
+    obj->as.map.size = matched;
+    obj->as.map.ptr = matched ? kv : NULL;
+    return 0;
+}
+
+/* Decodes one message keeping only the projected fields. The top-level value
+ * must be a map; the result is a map holding just the selected entries,
+ * freed like any tree from the same reader (msgpack_object_free_with_allocator
+ * or the reader's zone). Nested fields keep their enclosing maps, so
+ * "meta.region" yields {"meta": {"region": ...}}. */
+int msgpack_read_projected(msgpack_reader *reader, const msgpack_projection *proj, msgpack_object *obj) {
+    msgpack_reader_clear_error(reader);
+    size_t start = reader->position;
+    msgpack_object header;
+    if (msgpack_read_header(reader, &header) != 0 || !msgpack_object_is_map(&header) ||
+        msgpack_project_map(reader, proj, 0, &header, 0, obj) != 0) {
+        reader->position = start;
+        obj->type = MSGPACK_TYPE_NIL;
+        return -1;
+    }
+    return 0;
+}
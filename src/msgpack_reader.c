@@ -1,5 +1,5 @@
 #include "msgpack/msgpack.h"
-#include <stdio.h>
+#include "msgpack_internal.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -7,501 +7,959 @@ int msgpack_reader_init(msgpack_reader *reader, const void *data, size_t len) {
     reader->data = (const uint8_t *)data;
     reader->length = len;
     reader->position = 0;
+    reader->allocator = NULL;
+    reader->zone = NULL;
+    reader->max_depth = MSGPACK_DEFAULT_MAX_DEPTH;
+    reader->validate_utf8 = false;
+    reader->utf8_error_offset = SIZE_MAX;
     return 0;
 }
 
-static int msgpack_read_bytes(msgpack_reader *reader, void *out, size_t len) {
-    if (reader->position + len > reader->length) {
-        return -1;
-    }
-    memcpy(out, reader->data + reader->position, len);
-    reader->position += len;
-    return 0;
+void msgpack_reader_set_allocator(msgpack_reader *reader, const msgpack_allocator *allocator) {
+    reader->allocator = allocator;
 }
 
-int msgpack_read_object(msgpack_reader *reader, msgpack_object *obj) {
-    if (reader->position >= reader->length) {
-        return -1;
-    }
-    
-    uint8_t b = reader->data[reader->position++];
-    
-    if (b == 0xC0) {
-        obj->type = MSGPACK_TYPE_NIL;
+void msgpack_reader_set_zone(msgpack_reader *reader, msgpack_zone *zone) {
+    reader->zone = zone;
+}
+
+void msgpack_reader_set_max_depth(msgpack_reader *reader, size_t max_depth) {
+    reader->max_depth = max_depth;
+}
+
+/* When enabled, every str payload the reader decodes must be well-formed
+ * UTF-8 or the read fails, leaving the offset of the first byte of the bad
+ * sequence in utf8_error_offset. Every read entry point first resets it to
+ * SIZE_MAX, so it always describes the latest read. Covers every decoder
+ * built on the reader; values that are only skipped (msgpack_skip_object,
+ * projections, visitors returning MSGPACK_VISIT_SKIP) are not checked. */
+void msgpack_reader_set_validate_utf8(msgpack_reader *reader, bool validate) {
+    reader->validate_utf8 = validate;
+}
+
+static int msgpack_reader_check_utf8(msgpack_reader *reader, const uint8_t *s, size_t n) {
+    size_t bad = msgpack_cpu_kernels()->utf8_invalid(s, n);
+    if (bad == n) {
         return 0;
     }
-    
-    if (b == 0xC2) {
-        obj->type = MSGPACK_TYPE_BOOL;
-        obj->as.b = false;
-        return 0;
+    reader->utf8_error_offset = (size_t)(s - reader->data) + bad;
+    return -1;
+}
+
+#define MSGPACK_FORMAT(type, op, width, header) {MSGPACK_TYPE_##type, MSGPACK_OP_##op, width, header}
+#define MSGPACK_FORMAT_X4(...) __VA_ARGS__, __VA_ARGS__, __VA_ARGS__, __VA_ARGS__
+#define MSGPACK_FORMAT_X16(...) MSGPACK_FORMAT_X4(MSGPACK_FORMAT_X4(__VA_ARGS__))
+#define MSGPACK_FORMAT_X32(...) MSGPACK_FORMAT_X16(__VA_ARGS__), MSGPACK_FORMAT_X16(__VA_ARGS__)
+
+const msgpack_format msgpack_formats[256] = {
+    /* 0x00 - 0x7F */
+    MSGPACK_FORMAT_X32(MSGPACK_FORMAT(POSITIVE_FIXINT, POSFIX, 0, 0)),
+    MSGPACK_FORMAT_X32(MSGPACK_FORMAT(POSITIVE_FIXINT, POSFIX, 0, 0)),
+    MSGPACK_FORMAT_X32(MSGPACK_FORMAT(POSITIVE_FIXINT, POSFIX, 0, 0)),
+    MSGPACK_FORMAT_X32(MSGPACK_FORMAT(POSITIVE_FIXINT, POSFIX, 0, 0)),
+    /* 0x80 - 0xBF */
+    MSGPACK_FORMAT_X16(MSGPACK_FORMAT(FIXMAP, FIXMAP, 0, 0)),
+    MSGPACK_FORMAT_X16(MSGPACK_FORMAT(FIXARRAY, FIXARRAY, 0, 0)),
+    MSGPACK_FORMAT_X32(MSGPACK_FORMAT(FIXSTR, FIXSTR, 0, 0)),
+    /* 0xC0 - 0xDF */
+    MSGPACK_FORMAT(NIL, NIL, 0, 0),
+    MSGPACK_FORMAT(NIL, INVALID, 0, 0),
+    MSGPACK_FORMAT(BOOL, FALSE, 0, 0),
+    MSGPACK_FORMAT(BOOL, TRUE, 0, 0),
+    MSGPACK_FORMAT(BIN8, BIN8, 1, 1),
+    MSGPACK_FORMAT(BIN16, BIN16, 2, 2),
+    MSGPACK_FORMAT(BIN32, BIN32, 4, 4),
+    MSGPACK_FORMAT(EXT8, EXT8, 1, 2),
+    MSGPACK_FORMAT(EXT16, EXT16, 2, 3),
+    MSGPACK_FORMAT(EXT32, EXT32, 4, 5),
+    MSGPACK_FORMAT(FLOAT32, FLOAT32, 4, 4),
+    MSGPACK_FORMAT(FLOAT64, FLOAT64, 8, 8),
+    MSGPACK_FORMAT(UINT8, UINT8, 1, 1),
+    MSGPACK_FORMAT(UINT16, UINT16, 2, 2),
+    MSGPACK_FORMAT(UINT32, UINT32, 4, 4),
+    MSGPACK_FORMAT(UINT64, UINT64, 8, 8),
+    MSGPACK_FORMAT(INT8, INT8, 1, 1),
+    MSGPACK_FORMAT(INT16, INT16, 2, 2),
+    MSGPACK_FORMAT(INT32, INT32, 4, 4),
+    MSGPACK_FORMAT(INT64, INT64, 8, 8),
+    MSGPACK_FORMAT(FIXEXT1, FIXEXT, 1, 2),
+    MSGPACK_FORMAT(FIXEXT2, FIXEXT, 2, 3),
+    MSGPACK_FORMAT(FIXEXT4, FIXEXT, 4, 5),
+    MSGPACK_FORMAT(FIXEXT8, FIXEXT, 8, 9),
+    MSGPACK_FORMAT(FIXEXT16, FIXEXT, 16, 17),
+    MSGPACK_FORMAT(STR8, STR8, 1, 1),
+    MSGPACK_FORMAT(STR16, STR16, 2, 2),
+    MSGPACK_FORMAT(STR32, STR32, 4, 4),
+    MSGPACK_FORMAT(ARRAY16, ARRAY16, 2, 2),
+    MSGPACK_FORMAT(ARRAY32, ARRAY32, 4, 4),
+    MSGPACK_FORMAT(MAP16, MAP16, 2, 2),
+    MSGPACK_FORMAT(MAP32, MAP32, 4, 4),
+    /* 0xE0 - 0xFF */
+    MSGPACK_FORMAT_X32(MSGPACK_FORMAT(NEGATIVE_FIXINT, NEGFIX, 0, 0)),
+};
+
+/* Ext type -1 with a 4, 8 or 12 byte payload is a timestamp. Only the
+ * seconds are kept: the 64-bit form packs them into the low 34 bits under
+ * 30 bits of nanoseconds, the 96-bit form stores them signed after 32 bits
+ * of nanoseconds. */
+static void msgpack_set_ext(msgpack_object *obj, int8_t type, uint32_t size, const uint8_t *payload) {
+    if (type == -1 && (size == 4 || size == 8 || size == 12)) {
+        obj->type = MSGPACK_TYPE_TIMESTAMP;
+        if (size == 4) {
+            obj->as.timestamp = (int64_t)msgpack_load_be32(payload);
+        } else if (size == 8) {
+            obj->as.timestamp = (int64_t)(msgpack_load_be64(payload) & 0x3FFFFFFFFULL);
+        } else {
+            obj->as.timestamp = (int64_t)msgpack_load_be64(payload + 4);
+        }
+        return;
     }
-    
-    if (b == 0xC3) {
-        obj->type = MSGPACK_TYPE_BOOL;
-        obj->as.b = true;
-        return 0;
+    obj->as.ext.type = type;
+    obj->as.ext.size = size;
+    obj->as.ext.ptr = payload;
+}
+
+/* Decodes one value. Arrays and maps only get their type and element count;
+ * their ptr is left NULL for the caller to fill. The first byte selects a
+ * msgpack_formats entry (positive fixints, the most common byte, skip the
+ * lookup) and everything up to the payload is bounds checked in one
+ * comparison. Each case then advances by a constant or by the decoded
+ * length, so the next header's position never waits on the table load. A
+ * container claiming more elements than there are bytes left is rejected
+ * before anyone allocates for it. On failure the reader has not moved. */
+int msgpack_read_header(msgpack_reader *reader, msgpack_object *obj) {
+    size_t remaining = reader->length - reader->position;
+    if (remaining == 0) {
+        return -1;
     }
-    
-    if (msgpack_is_posfixint(b)) {
+    const uint8_t *p = reader->data + reader->position;
+    uint8_t b = *p++;
+    if (b < 0x80) {
         obj->type = MSGPACK_TYPE_POSITIVE_FIXINT;
         obj->as.u = b;
+        reader->position++;
         return 0;
     }
-    
-    if (msgpack_is_negfixint(b)) {
-        obj->type = MSGPACK_TYPE_NEGATIVE_FIXINT;
-        obj->as.i = (int8_t)b;
-        return 0;
-    }
-    
-    if ((b & 0xE0) == 0xA0) {
-        obj->type = MSGPACK_TYPE_FIXSTR;
-        obj->as.str.size = b & 0x1F;
-        obj->as.str.ptr = (const char *)(reader->data + reader->position);
-        reader->position += obj->as.str.size;
-        return 0;
+    const msgpack_format *format = &msgpack_formats[b];
+    if (format->header >= remaining) {
+        return -1;
     }
-    
-    if (msgpack_is_fixarray(b)) {
-        obj->type = MSGPACK_TYPE_FIXARRAY;
-        obj->as.array.size = b & 0x0F;
-        obj->as.array.ptr = (msgpack_object *)malloc(obj->as.array.size * sizeof(msgpack_object));
-        if (!obj->as.array.ptr) {
+    remaining -= 1 + (size_t)format->header;
+    size_t used;
+    uint32_t n;
+    obj->type = (msgpack_type)format->type;
+    switch ((msgpack_op)format->op) {
+        case MSGPACK_OP_INVALID:
             return -1;
+        case MSGPACK_OP_NIL:
+            used = 1;
+            break;
+        case MSGPACK_OP_FALSE:
+            obj->as.b = false;
+            used = 1;
+            break;
+        case MSGPACK_OP_TRUE:
+            obj->as.b = true;
+            used = 1;
+            break;
+        case MSGPACK_OP_POSFIX:
+            obj->as.u = b;
+            used = 1;
+            break;
+        case MSGPACK_OP_NEGFIX:
+            obj->as.i = (int8_t)b;
+            used = 1;
+            break;
+        case MSGPACK_OP_UINT8:
+            obj->as.u = p[0];
+            used = 2;
+            break;
+        case MSGPACK_OP_UINT16:
+            obj->as.u = msgpack_load_be16(p);
+            used = 3;
+            break;
+        case MSGPACK_OP_UINT32:
+            obj->as.u = msgpack_load_be32(p);
+            used = 5;
+            break;
+        case MSGPACK_OP_UINT64:
+            obj->as.u = msgpack_load_be64(p);
+            used = 9;
+            break;
+        case MSGPACK_OP_INT8:
+            obj->as.i = (int8_t)p[0];
+            used = 2;
+            break;
+        case MSGPACK_OP_INT16:
+            obj->as.i = (int16_t)msgpack_load_be16(p);
+            used = 3;
+            break;
+        case MSGPACK_OP_INT32:
+            obj->as.i = (int32_t)msgpack_load_be32(p);
+            used = 5;
+            break;
+        case MSGPACK_OP_INT64:
+            obj->as.i = (int64_t)msgpack_load_be64(p);
+            used = 9;
+            break;
+        case MSGPACK_OP_FLOAT32: {
+            uint32_t bits = msgpack_load_be32(p);
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            obj->as.f = f;
+            used = 5;
+            break;
         }
-        for (uint32_t i = 0; i < obj->as.array.size; i++) {
-            if (msgpack_read_object(reader, &obj->as.array.ptr[i]) != 0) {
-                return -1;
-            }
+        case MSGPACK_OP_FLOAT64: {
+            uint64_t bits = msgpack_load_be64(p);
+            memcpy(&obj->as.f, &bits, sizeof(obj->as.f));
+            used = 9;
+            break;
         }
-        return 0;
-    }
-    
-    if (msgpack_is_fixmap(b)) {
-        obj->type = MSGPACK_TYPE_FIXMAP;
-        obj->as.map.size = b & 0x0F;
-        obj->as.map.ptr = (msgpack_object_kv *)malloc(obj->as.map.size * sizeof(msgpack_object_kv));
-        if (!obj->as.map.ptr) {
+        case MSGPACK_OP_FIXSTR:
+        case MSGPACK_OP_STR8:
+        case MSGPACK_OP_STR16:
+        case MSGPACK_OP_STR32:
+            n = format->op == MSGPACK_OP_FIXSTR ? (uint32_t)(b & 0x1F) : msgpack_load_length(p, format->width);
+            if (n > remaining) return -1;
+            if (reader->validate_utf8 && msgpack_reader_check_utf8(reader, p + format->header, n) != 0) return -1;
+            obj->as.str.size = n;
+            obj->as.str.ptr = (const char *)p + format->header;
+            used = 1 + (size_t)format->header + n;
+            break;
+        case MSGPACK_OP_BIN8:
+        case MSGPACK_OP_BIN16:
+        case MSGPACK_OP_BIN32:
+            n = msgpack_load_length(p, format->width);
+            if (n > remaining) return -1;
+            obj->as.bin.size = n;
+            obj->as.bin.ptr = p + format->header;
+            used = 1 + (size_t)format->header + n;
+            break;
+        case MSGPACK_OP_FIXARRAY:
+            obj->as.array.size = b & 0x0F;
+            obj->as.array.ptr = NULL;
+            used = 1;
+            break;
+        case MSGPACK_OP_ARRAY16:
+            n = msgpack_load_be16(p);
+            if (n > remaining) return -1;
+            obj->as.array.size = n;
+            obj->as.array.ptr = NULL;
+            used = 3;
+            break;
+        case MSGPACK_OP_ARRAY32:
+            n = msgpack_load_be32(p);
+            if (n > remaining) return -1;
+            obj->as.array.size = n;
+            obj->as.array.ptr = NULL;
+            used = 5;
+            break;
+        case MSGPACK_OP_FIXMAP:
+            n = b & 0x0F;
+            if (2 * n > remaining) return -1;
+            obj->as.map.size = n;
+            obj->as.map.ptr = NULL;
+            used = 1;
+            break;
+        case MSGPACK_OP_MAP16:
+            n = msgpack_load_be16(p);
+            if (2 * (uint64_t)n > remaining) return -1;
+            obj->as.map.size = n;
+            obj->as.map.ptr = NULL;
+            used = 3;
+            break;
+        case MSGPACK_OP_MAP32:
+            n = msgpack_load_be32(p);
+            if (2 * (uint64_t)n > remaining) return -1;
+            obj->as.map.size = n;
+            obj->as.map.ptr = NULL;
+            used = 5;
+            break;
+        case MSGPACK_OP_FIXEXT:
+            msgpack_set_ext(obj, (int8_t)p[0], format->width, p + 1);
+            used = 1 + (size_t)format->header;
+            break;
+        case MSGPACK_OP_EXT8:
+        case MSGPACK_OP_EXT16:
+        case MSGPACK_OP_EXT32:
+            n = msgpack_load_length(p, format->width);
+            if (n > remaining) return -1;
+            msgpack_set_ext(obj, (int8_t)p[format->width], n, p + format->header);
+            used = 1 + (size_t)format->header + n;
+            break;
+        default:
             return -1;
-        }
-        for (uint32_t i = 0; i < obj->as.map.size; i++) {
-            if (msgpack_read_object(reader, &obj->as.map.ptr[i].key) != 0) {
-                return -1;
-            }
-            if (msgpack_read_object(reader, &obj->as.map.ptr[i].value) != 0) {
-                return -1;
-            }
-        }
-        return 0;
     }
-    
-    if (msgpack_is_fixext(b)) {
-        if (b == 0xD6) {
-            int8_t ext_type;
-            if (msgpack_read_bytes(reader, &ext_type, 1) != 0) return -1;
-            if (ext_type != -1) return -1;
-            uint32_t sec;
-            if (msgpack_read_bytes(reader, &sec, 4) != 0) return -1;
-            uint8_t *bytes = (uint8_t *)&sec;
-            sec = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | 
-                  ((uint32_t)bytes[2] << 8) | (uint32_t)bytes[3];
-            obj->type = MSGPACK_TYPE_TIMESTAMP;
-            obj->as.timestamp = (int64_t)sec;
-            return 0;
-        }
-        if (b == 0xD7) {
-            uint8_t data[8];
-            if (msgpack_read_bytes(reader, data, 8) != 0) return -1;
-            uint64_t val = ((uint64_t)data[0] << 56) | ((uint64_t)data[1] << 48) |
-                           ((uint64_t)data[2] << 40) | ((uint64_t)data[3] << 32) |
-                           ((uint64_t)data[4] << 24) | ((uint64_t)data[5] << 16) |
-                           ((uint64_t)data[6] << 8) | (uint64_t)data[7];
-            obj->type = MSGPACK_TYPE_TIMESTAMP;
-            obj->as.timestamp = (int64_t)val;
-            return 0;
-        }
-        obj->type = (msgpack_type)b;
-        obj->as.ext.type = msgpack_fixext_type(b);
-        obj->as.ext.size = msgpack_fixext_size(b);
-        obj->as.ext.ptr = reader->data + reader->position;
-        reader->position += obj->as.ext.size;
-        return 0;
+    reader->position += used;
+    return 0;
+}
+
+/* Pull parser: decodes the next header without allocating or building a
+ * tree. On failure (including end of input) the reader is left where it was,
+ * so callers can tell a clean end from truncation with
+ * msgpack_reader_remaining. */
+int msgpack_cursor_next(msgpack_reader *reader, msgpack_token *token) {
+    msgpack_reader_clear_error(reader);
+    size_t start = reader->position;
+    msgpack_object obj;
+    if (msgpack_read_header(reader, &obj) != 0) {
+        reader->position = start;
+        return -1;
     }
-    
-    switch (b) {
-        case 0xCC:
-            obj->type = MSGPACK_TYPE_UINT8;
-            if (msgpack_read_bytes(reader, &obj->as.u, 1) != 0) return -1;
-            return 0;
-        case 0xCD:
-            obj->type = MSGPACK_TYPE_UINT16;
-            if (msgpack_read_bytes(reader, &obj->as.u, 2) != 0) return -1;
-            {
-                uint16_t v = (uint16_t)obj->as.u;
-                obj->as.u = (uint16_t)((v >> 8) | ((v & 0xFF) << 8));
-            }
-            return 0;
-        case 0xCE:
-            obj->type = MSGPACK_TYPE_UINT32;
-            if (msgpack_read_bytes(reader, &obj->as.u, 4) != 0) return -1;
-            {
-                uint32_t v = (uint32_t)obj->as.u;
-                obj->as.u = ((v & 0xFF) << 24) | ((v & 0xFF00) << 8) | ((v >> 8) & 0xFF00) | ((v >> 24) & 0xFF);
-            }
-            return 0;
-        case 0xCF:
-            obj->type = MSGPACK_TYPE_UINT64;
-            {
-                uint64_t v;
-                if (msgpack_read_bytes(reader, &v, 8) != 0) return -1;
-                uint8_t b[8];
-                memcpy(b, &v, 8);
-                uint64_t r = ((uint64_t)b[0] << 56) | ((uint64_t)b[1] << 48) | 
-                           ((uint64_t)b[2] << 40) | ((uint64_t)b[3] << 32) |
-                           ((uint64_t)b[4] << 24) | ((uint64_t)b[5] << 16) |
-                           ((uint64_t)b[6] << 8) | (uint64_t)b[7];
-                obj->as.u = r;
-            }
-            return 0;
-        case 0xD0:
-            obj->type = MSGPACK_TYPE_INT8;
-            {
-                int8_t v;
-                if (msgpack_read_bytes(reader, &v, 1) != 0) return -1;
-                obj->as.i = v;
-            }
-            return 0;
-        case 0xD1:
-            obj->type = MSGPACK_TYPE_INT16;
-            {
-                int16_t v;
-                if (msgpack_read_bytes(reader, &v, 2) != 0) return -1;
-                v = (int16_t)((((uint16_t)v >> 8) & 0xFF) | (((uint16_t)v & 0xFF) << 8));
-                obj->as.i = v;
-            }
-            return 0;
-        case 0xD2:
-            obj->type = MSGPACK_TYPE_INT32;
-            {
-                int32_t v;
-                if (msgpack_read_bytes(reader, &v, 4) != 0) return -1;
-                uint32_t uv = (uint32_t)v;
-                uv = ((uv >> 24) & 0xFF) | ((uv >> 8) & 0xFF00) | ((uv & 0xFF00) << 8) | ((uv & 0xFF) << 24);
-                obj->as.i = (int32_t)uv;
-            }
-            return 0;
-        case 0xD3:
-            obj->type = MSGPACK_TYPE_INT64;
-            {
-                int64_t v;
-                if (msgpack_read_bytes(reader, &v, 8) != 0) return -1;
-                uint8_t b[8];
-                memcpy(b, &v, 8);
-                int64_t r = ((int64_t)b[0] << 56) | ((int64_t)b[1] << 48) | 
-                           ((int64_t)b[2] << 40) | ((int64_t)b[3] << 32) |
-                           ((int64_t)b[4] << 24) | ((int64_t)b[5] << 16) |
-                           ((int64_t)b[6] << 8) | (int64_t)b[7];
-                obj->as.i = r;
-            }
-            return 0;
-            return 0;
-        case 0xCA: {
-            obj->type = MSGPACK_TYPE_FLOAT32;
-            uint8_t bytes[4];
-            if (msgpack_read_bytes(reader, bytes, 4) != 0) return -1;
-            float f32;
-            uint8_t *fbytes = (uint8_t *)&f32;
-            fbytes[0] = bytes[3];
-            fbytes[1] = bytes[2];
-            fbytes[2] = bytes[1];
-            fbytes[3] = bytes[0];
-            obj->as.f = f32;
-            return 0;
-        }
-        case 0xCB: {
-            obj->type = MSGPACK_TYPE_FLOAT64;
-            uint8_t bytes[8];
-            if (msgpack_read_bytes(reader, bytes, 8) != 0) return -1;
-            double f64;
-            uint8_t *fbytes = (uint8_t *)&f64;
-            fbytes[0] = bytes[7];
-            fbytes[1] = bytes[6];
-            fbytes[2] = bytes[5];
-            fbytes[3] = bytes[4];
-            fbytes[4] = bytes[3];
-            fbytes[5] = bytes[2];
-            fbytes[6] = bytes[1];
-            fbytes[7] = bytes[0];
-            obj->as.f = f64;
-            return 0;
-        }
-        case 0xD9:
-            obj->type = MSGPACK_TYPE_STR8;
-            if (msgpack_read_bytes(reader, &obj->as.str.size, 1) != 0) return -1;
-            obj->as.str.ptr = (const char *)(reader->data + reader->position);
-            reader->position += obj->as.str.size;
-            return 0;
-        case 0xDA: {
-            uint16_t size;
-            if (msgpack_read_bytes(reader, &size, 2) != 0) return -1;
-            obj->type = MSGPACK_TYPE_STR16;
-            obj->as.str.size = (uint16_t)((((uint16_t)size >> 8) & 0xFF) | ((((uint16_t)size & 0xFF) << 8)));
-            obj->as.str.ptr = (const char *)(reader->data + reader->position);
-            reader->position += obj->as.str.size;
-            return 0;
-        }
-        case 0xDB: {
-            uint32_t size;
-            if (msgpack_read_bytes(reader, &size, 4) != 0) return -1;
-            obj->type = MSGPACK_TYPE_STR32;
-            obj->as.str.size = ((size >> 24) | ((size >> 8) & 0xFF00) | ((size & 0xFF) << 8) | ((size & 0xFF) << 24));
-            obj->as.str.ptr = (const char *)(reader->data + reader->position);
-            reader->position += obj->as.str.size;
-            return 0;
-        }
-        case 0xC4:
-            obj->type = MSGPACK_TYPE_BIN8;
-            if (msgpack_read_bytes(reader, &obj->as.bin.size, 1) != 0) return -1;
-            obj->as.bin.ptr = reader->data + reader->position;
-            reader->position += obj->as.bin.size;
-            return 0;
-        case 0xC5: {
-            uint16_t size;
-            if (msgpack_read_bytes(reader, &size, 2) != 0) return -1;
-            obj->type = MSGPACK_TYPE_BIN16;
-            obj->as.bin.size = ((size >> 8) | ((size & 0xFF) << 8));
-            obj->as.bin.ptr = reader->data + reader->position;
-            reader->position += obj->as.bin.size;
-            return 0;
-        }
-        case 0xC6: {
-            uint32_t size;
-            if (msgpack_read_bytes(reader, &size, 4) != 0) return -1;
-            obj->type = MSGPACK_TYPE_BIN32;
-            obj->as.bin.size = ((size >> 24) | ((size >> 8) & 0xFF00) | ((size & 0xFF) << 8) | ((size & 0xFF) << 24));
-            obj->as.bin.ptr = reader->data + reader->position;
-            reader->position += obj->as.bin.size;
-            return 0;
-        }
-        case 0xDC: {
-            uint16_t size;
-            if (msgpack_read_bytes(reader, &size, 2) != 0) return -1;
-            obj->type = MSGPACK_TYPE_ARRAY16;
-            obj->as.array.size = ((size >> 8) | ((size & 0xFF) << 8));
-            obj->as.array.ptr = (msgpack_object *)malloc(obj->as.array.size * sizeof(msgpack_object));
-            if (!obj->as.array.ptr) {
-                return -1;
-            }
-            for (uint32_t i = 0; i < obj->as.array.size; i++) {
-                if (msgpack_read_object(reader, &obj->as.array.ptr[i]) != 0) {
-                    return -1;
-                }
-            }
-            return 0;
-        }
-        case 0xDD: {
-            uint32_t size;
-            if (msgpack_read_bytes(reader, &size, 4) != 0) return -1;
-            obj->type = MSGPACK_TYPE_ARRAY32;
-            obj->as.array.size = ((size >> 24) | ((size >> 8) & 0xFF00) | ((size & 0xFF) << 8) | ((size & 0xFF) << 24));
-            obj->as.array.ptr = (msgpack_object *)malloc(obj->as.array.size * sizeof(msgpack_object));
-            if (!obj->as.array.ptr) {
-                return -1;
+    token->type = obj.type;
+    switch (obj.type) {
+        case MSGPACK_TYPE_NIL:
+            break;
+        case MSGPACK_TYPE_BOOL:
+            token->as.b = obj.as.b;
+            break;
+        case MSGPACK_TYPE_POSITIVE_FIXINT:
+        case MSGPACK_TYPE_UINT8:
+        case MSGPACK_TYPE_UINT16:
+        case MSGPACK_TYPE_UINT32:
+        case MSGPACK_TYPE_UINT64:
+            token->as.u = obj.as.u;
+            break;
+        case MSGPACK_TYPE_NEGATIVE_FIXINT:
+        case MSGPACK_TYPE_INT8:
+        case MSGPACK_TYPE_INT16:
+        case MSGPACK_TYPE_INT32:
+        case MSGPACK_TYPE_INT64:
+            token->as.i = obj.as.i;
+            break;
+        case MSGPACK_TYPE_FLOAT32:
+        case MSGPACK_TYPE_FLOAT64:
+            token->as.f = obj.as.f;
+            break;
+        case MSGPACK_TYPE_FIXSTR:
+        case MSGPACK_TYPE_STR8:
+        case MSGPACK_TYPE_STR16:
+        case MSGPACK_TYPE_STR32:
+            token->as.str.size = obj.as.str.size;
+            token->as.str.ptr = obj.as.str.ptr;
+            break;
+        case MSGPACK_TYPE_BIN8:
+        case MSGPACK_TYPE_BIN16:
+        case MSGPACK_TYPE_BIN32:
+            token->as.bin.size = obj.as.bin.size;
+            token->as.bin.ptr = obj.as.bin.ptr;
+            break;
+        case MSGPACK_TYPE_FIXARRAY:
+        case MSGPACK_TYPE_ARRAY16:
+        case MSGPACK_TYPE_ARRAY32:
+            token->as.count = obj.as.array.size;
+            break;
+        case MSGPACK_TYPE_FIXMAP:
+        case MSGPACK_TYPE_MAP16:
+        case MSGPACK_TYPE_MAP32:
+            token->as.count = obj.as.map.size;
+            break;
+        case MSGPACK_TYPE_TIMESTAMP:
+            token->as.timestamp = obj.as.timestamp;
+            break;
+        default:
+            token->as.ext.type = obj.as.ext.type;
+            token->as.ext.size = obj.as.ext.size;
+            token->as.ext.ptr = obj.as.ext.ptr;
+            break;
+    }
+    return 0;
+}
+
+bool msgpack_reader_depth_exceeded(const msgpack_reader *reader, size_t depth) {
+    return reader->max_depth != 0 && depth >= reader->max_depth;
+}
+
+/* Decodes a whole tree with an explicit stack instead of recursion, so
+ * hostile nesting is bounded by max_depth and costs heap frames rather than
+ * C stack. Children are zeroed on allocation so a failed decode can free the
+ * partial tree. */
+int msgpack_read_object(msgpack_reader *reader, msgpack_object *obj) {
+    msgpack_reader_clear_error(reader);
+    if (msgpack_read_header(reader, obj) != 0) {
+        return -1;
+    }
+    msgpack_stack stack;
+    msgpack_stack_init(&stack, reader->allocator);
+    msgpack_object *node = obj;
+    int ret = 0;
+    for (;;) {
+        if (msgpack_object_is_array(node) || msgpack_object_is_map(node)) {
+            if (msgpack_reader_depth_exceeded(reader, stack.depth)) {
+                ret = -1;
+                break;
             }
-            for (uint32_t i = 0; i < obj->as.array.size; i++) {
-                if (msgpack_read_object(reader, &obj->as.array.ptr[i]) != 0) {
-                    return -1;
+            uint64_t count = msgpack_object_child_count(node);
+            if (count > 0) {
+                msgpack_object *items = (msgpack_object *)msgpack_reader_alloc(reader, count * sizeof(msgpack_object));
+                if (!items) {
+                    ret = -1;
+                    break;
                 }
-            }
-            return 0;
-        }
-        case 0xDE: {
-            uint16_t size;
-            if (msgpack_read_bytes(reader, &size, 2) != 0) return -1;
-            obj->type = MSGPACK_TYPE_MAP16;
-            obj->as.map.size = ((size >> 8) | ((size & 0xFF) << 8));
-            obj->as.map.ptr = (msgpack_object_kv *)malloc(obj->as.map.size * sizeof(msgpack_object_kv));
-            if (!obj->as.map.ptr) {
-                return -1;
-            }
-            for (uint32_t i = 0; i < obj->as.map.size; i++) {
-                if (msgpack_read_object(reader, &obj->as.map.ptr[i].key) != 0) {
-                    return -1;
+                memset(items, 0, count * sizeof(msgpack_object));
+                if (msgpack_object_is_array(node)) {
+                    node->as.array.ptr = items;
+                } else {
+                    node->as.map.ptr = (msgpack_object_kv *)items;
                 }
-                if (msgpack_read_object(reader, &obj->as.map.ptr[i].value) != 0) {
-                    return -1;
+                if (msgpack_stack_push(&stack, items, count) != 0) {
+                    ret = -1;
+                    break;
                 }
             }
-            return 0;
-        }
-        case 0xDF: {
-            uint32_t size;
-            if (msgpack_read_bytes(reader, &size, 4) != 0) return -1;
-            obj->type = MSGPACK_TYPE_MAP32;
-            obj->as.map.size = ((size >> 24) | ((size >> 8) & 0xFF00) | ((size & 0xFF) << 8) | ((size & 0xFF) << 24));
-            obj->as.map.ptr = (msgpack_object_kv *)malloc(obj->as.map.size * sizeof(msgpack_object_kv));
-            if (!obj->as.map.ptr) {
-                return -1;
+        }
+        while (stack.depth > 0 && msgpack_stack_top(&stack)->index == msgpack_stack_top(&stack)->count) {
+            stack.depth--;
+        }
+        if (stack.depth == 0) {
+            break;
+        }
+        msgpack_frame *top = msgpack_stack_top(&stack);
+        node = &top->items[top->index++];
+        if (msgpack_read_header(reader, node) != 0) {
+            ret = -1;
+            break;
+        }
+    }
+    msgpack_stack_free(&stack);
+    if (ret != 0 && !reader->zone) {
+        msgpack_object_free_with_allocator(obj, reader->allocator);
+        obj->type = MSGPACK_TYPE_NIL;
+    }
+    return ret;
+}
+
+int msgpack_count_nodes(msgpack_reader *reader, size_t *elements, size_t *entries, size_t *max_stack) {
+    msgpack_stack stack;
+    msgpack_stack_init(&stack, reader->allocator);
+    msgpack_object header;
+    int ret = 0;
+    for (;;) {
+        if (msgpack_read_header(reader, &header) != 0) {
+            ret = -1;
+            break;
+        }
+        if (msgpack_object_is_array(&header) || msgpack_object_is_map(&header)) {
+            if (msgpack_reader_depth_exceeded(reader, stack.depth)) {
+                ret = -1;
+                break;
             }
-            for (uint32_t i = 0; i < obj->as.map.size; i++) {
-                if (msgpack_read_object(reader, &obj->as.map.ptr[i].key) != 0) {
-                    return -1;
-                }
-                if (msgpack_read_object(reader, &obj->as.map.ptr[i].value) != 0) {
-                    return -1;
-                }
+            uint64_t count = msgpack_object_child_count(&header);
+            if (msgpack_object_is_array(&header)) {
+                *elements += header.as.array.size;
+            } else {
+                *entries += header.as.map.size;
             }
-            return 0;
-        }
-        case 0xC7: {
-            int8_t ext_type;
-            uint8_t size;
-            if (msgpack_read_bytes(reader, &size, 1) != 0) return -1;
-            if (msgpack_read_bytes(reader, &ext_type, 1) != 0) return -1;
-            if (ext_type == -1) {
-                if (size == 4) {
-                    uint32_t ns, sec;
-                    if (msgpack_read_bytes(reader, &ns, 4) != 0) return -1;
-                    if (msgpack_read_bytes(reader, &sec, 4) != 0) return -1;
-                    obj->type = MSGPACK_TYPE_TIMESTAMP;
-                    obj->as.timestamp = (int64_t)sec;
-                    return 0;
-                } else if (size == 8) {
-                    uint64_t val;
-                    if (msgpack_read_bytes(reader, &val, 8) != 0) return -1;
-                    obj->type = MSGPACK_TYPE_TIMESTAMP;
-                    obj->as.timestamp = (int64_t)val;
-                    return 0;
-                } else if (size == 12) {
-                    uint32_t ns;
-                    int64_t sec;
-                    if (msgpack_read_bytes(reader, &ns, 4) != 0) return -1;
-                    if (msgpack_read_bytes(reader, &sec, 8) != 0) return -1;
-                    obj->type = MSGPACK_TYPE_TIMESTAMP;
-                    obj->as.timestamp = sec;
-                    return 0;
-                }
+            if (count > 0 && msgpack_stack_push(&stack, NULL, count) != 0) {
+                ret = -1;
+                break;
             }
-            obj->type = MSGPACK_TYPE_EXT8;
-            obj->as.ext.type = ext_type;
-            obj->as.ext.size = size;
-            obj->as.ext.ptr = reader->data + reader->position;
-            reader->position += size;
-            return 0;
-        }
-        case 0xC8: {
-            uint16_t size;
-            if (msgpack_read_bytes(reader, &size, 2) != 0) return -1;
-            int8_t ext_type;
-            if (msgpack_read_bytes(reader, &ext_type, 1) != 0) return -1;
-            obj->type = MSGPACK_TYPE_EXT16;
-            obj->as.ext.size = ((size >> 8) | ((size & 0xFF) << 8));
-            obj->as.ext.ptr = reader->data + reader->position;
-            reader->position += obj->as.ext.size;
-            return 0;
-        }
-        case 0xC9: {
-            uint32_t size;
-            if (msgpack_read_bytes(reader, &size, 4) != 0) return -1;
-            int8_t ext_type;
-            if (msgpack_read_bytes(reader, &ext_type, 1) != 0) return -1;
-            obj->type = MSGPACK_TYPE_EXT32;
-            obj->as.ext.size = ((size >> 24) | ((size >> 8) & 0xFF00) | ((size & 0xFF) << 8) | ((size & 0xFF) << 24));
-            obj->as.ext.ptr = reader->data + reader->position;
-            reader->position += obj->as.ext.size;
-            return 0;
-        }
-        case 0xD4:
-            obj->type = MSGPACK_TYPE_FIXEXT1;
-            if (msgpack_read_bytes(reader, &obj->as.ext.type, 1) != 0) return -1;
-            obj->as.ext.size = 1;
-            obj->as.ext.ptr = reader->data + reader->position;
-            reader->position += 1;
-            return 0;
-        case 0xD5:
-            obj->type = MSGPACK_TYPE_FIXEXT2;
-            if (msgpack_read_bytes(reader, &obj->as.ext.type, 1) != 0) return -1;
-            obj->as.ext.size = 2;
-            obj->as.ext.ptr = reader->data + reader->position;
-            reader->position += 2;
-            return 0;
-        case 0xD6:
-            printf("DEBUG: Hit case 0xD6\n");
-            obj->type = MSGPACK_TYPE_FIXEXT4;
-            if (msgpack_read_bytes(reader, &obj->as.ext.type, 1) != 0) return -1;
-            printf("DEBUG: ext.type = %d\n", obj->as.ext.type);
-            if (obj->as.ext.type == -1) {
-                uint32_t sec;
-                if (msgpack_read_bytes(reader, &sec, 4) != 0) return -1;
-                printf("DEBUG: sec (raw) = %u\n", sec);
-                sec = ((sec >> 24) & 0xFF) | ((sec >> 8) & 0xFF00) | ((sec & 0xFF00) << 8) | ((sec & 0xFF) << 24);
-                printf("DEBUG: sec (swapped) = %u\n", sec);
-                obj->type = MSGPACK_TYPE_TIMESTAMP;
-                obj->as.timestamp = (int64_t)sec;
-                printf("DEBUG: Set timestamp to %lld\n", (long long)obj->as.timestamp);
-                return 0;
+            if (stack.depth > *max_stack) {
+                *max_stack = stack.depth;
             }
-            obj->as.ext.size = 4;
-            obj->as.ext.ptr = reader->data + reader->position;
-            reader->position += 4;
-            return 0;
-        case 0xD7:
-            obj->type = MSGPACK_TYPE_FIXEXT8;
-            if (msgpack_read_bytes(reader, &obj->as.ext.type, 1) != 0) return -1;
-            if (obj->as.ext.type == -1) {
-                uint8_t data[8];
-                if (msgpack_read_bytes(reader, data, 8) != 0) return -1;
-                uint64_t val = ((uint64_t)data[0] << 56) | ((uint64_t)data[1] << 48) |
-                               ((uint64_t)data[2] << 40) | ((uint64_t)data[3] << 32) |
-                               ((uint64_t)data[4] << 24) | ((uint64_t)data[5] << 16) |
-                               ((uint64_t)data[6] << 8) | (uint64_t)data[7];
-                obj->type = MSGPACK_TYPE_TIMESTAMP;
-                obj->as.timestamp = (int64_t)val;
-                return 0;
+        }
+        while (stack.depth > 0 && msgpack_stack_top(&stack)->index == msgpack_stack_top(&stack)->count) {
+            stack.depth--;
+        }
+        if (stack.depth == 0) {
+            break;
+        }
+        msgpack_stack_top(&stack)->index++;
+    }
+    msgpack_stack_free(&stack);
+    return ret;
+}
+
+/* Cannot fail: msgpack_count_nodes has already decoded every header and
+ * checked the nesting (and UTF-8, if enabled, so this pass decodes through
+ * a copy of the reader with the check off), and the block holds exactly
+ * the counted nodes. The stack is sized up front from the same pass.
+ * Returns the cursor past the nodes used. */
+uint8_t *msgpack_fill_compact(msgpack_reader *reader, msgpack_object *obj, uint8_t *cursor, msgpack_stack *stack) {
+    msgpack_reader headers = *reader;
+    headers.validate_utf8 = false;
+    msgpack_object *node = obj;
+    for (;;) {
+        msgpack_read_header(&headers, node);
+        uint64_t count = msgpack_object_child_count(node);
+        if (count > 0) {
+            if (msgpack_object_is_array(node)) {
+                node->as.array.ptr = (msgpack_object *)cursor;
+            } else {
+                node->as.map.ptr = (msgpack_object_kv *)cursor;
             }
-            obj->as.ext.size = 8;
-            obj->as.ext.ptr = reader->data + reader->position;
-            reader->position += 8;
-            return 0;
-        case 0xD8:
-            obj->type = MSGPACK_TYPE_FIXEXT16;
-            if (msgpack_read_bytes(reader, &obj->as.ext.type, 1) != 0) return -1;
-            obj->as.ext.size = 16;
-            obj->as.ext.ptr = reader->data + reader->position;
-            reader->position += 16;
-            return 0;
+            msgpack_stack_push(stack, (msgpack_object *)cursor, count);
+            cursor += count * sizeof(msgpack_object);
+        }
+        while (stack->depth > 0 && msgpack_stack_top(stack)->index == msgpack_stack_top(stack)->count) {
+            stack->depth--;
+        }
+        if (stack->depth == 0) {
+            break;
+        }
+        msgpack_frame *top = msgpack_stack_top(stack);
+        node = &top->items[top->index++];
+    }
+    reader->position = headers.position;
+    return cursor;
+}
+
+int msgpack_read_object_compact(msgpack_reader *reader, msgpack_object *obj) {
+    msgpack_reader_clear_error(reader);
+    size_t start = reader->position;
+    size_t elements = 0, entries = 0, max_stack = 0;
+    if (msgpack_count_nodes(reader, &elements, &entries, &max_stack) != 0) {
+        reader->position = start;
+        return -1;
     }
+    size_t end = reader->position;
+    reader->position = start;
     
-    return -1;
+    msgpack_stack stack;
+    msgpack_stack_init(&stack, reader->allocator);
+    if (msgpack_stack_reserve(&stack, max_stack) != 0) {
+        return -1;
+    }
+    uint8_t *cursor = NULL;
+    size_t nodes = elements * sizeof(msgpack_object) + entries * sizeof(msgpack_object_kv);
+    if (nodes > 0) {
+        size_t size = sizeof(msgpack_compact_prefix) + nodes;
+        msgpack_compact_prefix *prefix = (msgpack_compact_prefix *)msgpack_alloc(reader->allocator, size);
+        if (!prefix) {
+            msgpack_stack_free(&stack);
+            return -1;
+        }
+        prefix->size = size;
+        cursor = (uint8_t *)(prefix + 1);
+    }
+    msgpack_fill_compact(reader, obj, cursor, &stack);
+    msgpack_stack_free(&stack);
+    reader->position = end;
+    return 0;
+}
+
+void msgpack_object_free_compact(msgpack_object *obj, const msgpack_allocator *allocator) {
+    void *block = NULL;
+    if (msgpack_object_is_array(obj)) {
+        block = obj->as.array.ptr;
+        obj->as.array.ptr = NULL;
+    } else if (msgpack_object_is_map(obj)) {
+        block = obj->as.map.ptr;
+        obj->as.map.ptr = NULL;
+    }
+    if (block) {
+        msgpack_compact_prefix *prefix = (msgpack_compact_prefix *)block - 1;
+        msgpack_dealloc(allocator, prefix, prefix->size);
+    }
+}
+
+/* Decodes up to max back-to-back messages into objs, stopping early at the
+ * end of input or at a malformed message (the reader is left at its start).
+ * With a zone every tree goes there; otherwise a first pass counts the nodes
+ * of the whole batch and they are filled into one block, released with
+ * msgpack_object_free_many. Returns -1 only if no message was decoded. */
+int msgpack_read_many(msgpack_reader *reader, msgpack_object *objs, size_t max, size_t *count) {
+    msgpack_reader_clear_error(reader);
+    *count = 0;
+    if (reader->zone) {
+        while (*count < max && msgpack_reader_remaining(reader) > 0) {
+            size_t start = reader->position;
+            if (msgpack_read_object(reader, &objs[*count]) != 0) {
+                reader->position = start;
+                break;
+            }
+            (*count)++;
+        }
+        return *count > 0 ? 0 : -1;
+    }
+    
+    size_t start = reader->position;
+    size_t elements = 0, entries = 0, max_stack = 0, messages = 0;
+    while (messages < max && msgpack_reader_remaining(reader) > 0) {
+        size_t message_start = reader->position;
+        size_t e = 0, n = 0, depth = 0;
+        if (msgpack_count_nodes(reader, &e, &n, &depth) != 0) {
+            reader->position = message_start;
+            break;
+        }
+        elements += e;
+        entries += n;
+        max_stack = depth > max_stack ? depth : max_stack;
+        messages++;
+    }
+    if (messages == 0) {
+        return -1;
+    }
+    size_t end = reader->position;
+    reader->position = start;
+    
+    msgpack_stack stack;
+    msgpack_stack_init(&stack, reader->allocator);
+    if (msgpack_stack_reserve(&stack, max_stack) != 0) {
+        return -1;
+    }
+    uint8_t *cursor = NULL;
+    size_t nodes = elements * sizeof(msgpack_object) + entries * sizeof(msgpack_object_kv);
+    if (nodes > 0) {
+        size_t size = sizeof(msgpack_compact_prefix) + nodes;
+        msgpack_compact_prefix *prefix = (msgpack_compact_prefix *)msgpack_alloc(reader->allocator, size);
+        if (!prefix) {
+            msgpack_stack_free(&stack);
+            return -1;
+        }
+        prefix->size = size;
+        cursor = (uint8_t *)(prefix + 1);
+    }
+    for (size_t i = 0; i < messages; i++) {
+        cursor = msgpack_fill_compact(reader, &objs[i], cursor, &stack);
+    }
+    msgpack_stack_free(&stack);
+    reader->position = end;
+    *count = messages;
+    return 0;
+}
+
+/* Releases a batch from msgpack_read_many made without a zone. The block
+ * starts at the children of the first container that has any. */
+void msgpack_object_free_many(msgpack_object *objs, size_t count, const msgpack_allocator *allocator) {
+    for (size_t i = 0; i < count; i++) {
+        if (msgpack_object_children(&objs[i])) {
+            msgpack_object_free_compact(&objs[i], allocator);
+            break;
+        }
+    }
 }
 
 void msgpack_object_free(msgpack_object *obj) {
+    msgpack_object_free_with_allocator(obj, NULL);
+}
+
+/* Only used when the explicit stack cannot grow; nesting that deep is rare
+ * and bounded by the reader's max_depth for decoded trees. */
+static void msgpack_object_free_recursive(msgpack_object *obj, const msgpack_allocator *allocator) {
+    msgpack_object *items = msgpack_object_children(obj);
+    if (!items) return;
+    uint64_t count = msgpack_object_child_count(obj);
+    for (uint64_t i = 0; i < count; i++) {
+        msgpack_object_free_recursive(&items[i], allocator);
+    }
+    msgpack_dealloc(allocator, items, count * sizeof(msgpack_object));
+}
+
+void msgpack_object_free_with_allocator(msgpack_object *obj, const msgpack_allocator *allocator) {
     if (!obj) return;
     
-    switch (obj->type) {
+    msgpack_stack stack;
+    msgpack_stack_init(&stack, allocator);
+    msgpack_object *node = obj;
+    for (;;) {
+        msgpack_object *items = msgpack_object_children(node);
+        if (items && msgpack_stack_push(&stack, items, msgpack_object_child_count(node)) != 0) {
+            msgpack_object_free_recursive(node, allocator);
+        }
+        while (stack.depth > 0 && msgpack_stack_top(&stack)->index == msgpack_stack_top(&stack)->count) {
+            msgpack_frame *top = msgpack_stack_top(&stack);
+            msgpack_dealloc(allocator, top->items, top->count * sizeof(msgpack_object));
+            stack.depth--;
+        }
+        if (stack.depth == 0) {
+            break;
+        }
+        msgpack_frame *top = msgpack_stack_top(&stack);
+        node = &top->items[top->index++];
+    }
+    msgpack_stack_free(&stack);
+}
+
+/* Consumes count complete values without building anything. Pending element
+ * counts are summed instead of stacked, so skipping needs no memory however
+ * deep the input nests. */
+/* Skipped strings are not decoded, so they are not UTF-8 checked either;
+ * the headers go through a copy of the reader with the check off. */
+static int msgpack_skip_values(msgpack_reader *reader, uint64_t count) {
+    msgpack_reader headers = *reader;
+    headers.validate_utf8 = false;
+    while (count > 0) {
+        msgpack_object header;
+        if (msgpack_read_header(&headers, &header) != 0) {
+            return -1;
+        }
+        count--;
+        if (msgpack_object_is_array(&header) || msgpack_object_is_map(&header)) {
+            count += msgpack_object_child_count(&header);
+        }
+    }
+    reader->position = headers.position;
+    return 0;
+}
+
+/* Advances past one complete value. On failure the reader is left where it
+ * was. */
+int msgpack_skip_object(msgpack_reader *reader) {
+    msgpack_reader_clear_error(reader);
+    size_t start = reader->position;
+    if (msgpack_skip_values(reader, 1) != 0) {
+        reader->position = start;
+        return -1;
+    }
+    return 0;
+}
+
+/* Steps *position past count complete values using only their headers.
+ * Returns 0, MSGPACK_UNPACK_NEED_MORE if the data ends first, or -1 for a
+ * malformed header; *position is only advanced on success. */
+int msgpack_scan_values(const uint8_t *data, size_t len, size_t *position, uint64_t count) {
+    size_t cursor = *position;
+    uint64_t pending = count;
+    while (pending > 0) {
+        size_t size;
+        uint64_t children;
+        int ret = msgpack_value_extent(data + cursor, len - cursor, &size, &children);
+        if (ret != 0) {
+            return ret;
+        }
+        /* every pending value takes at least a byte, so more of them than
+         * bytes left cannot complete inside this buffer */
+        if (size > len - cursor || pending - 1 + children > len - cursor - size) {
+            return MSGPACK_UNPACK_NEED_MORE;
+        }
+        cursor += size;
+        pending += children - 1;
+    }
+    *position = cursor;
+    return 0;
+}
+
+/* Records where each complete message starts, followed by where the last
+ * one ends, so message i spans [offsets[i], offsets[i + 1]). max is the
+ * number of entries in offsets, end marker included, so at most max - 1
+ * messages are recorded. Only headers are read: str, bin and ext payloads
+ * are stepped over and container counts are summed, so no stack or tree is
+ * built. Returns 0 when scanning stopped on a message boundary (end of
+ * data, or offsets full), MSGPACK_UNPACK_NEED_MORE if the data ends inside
+ * a message, or -1 for a malformed header or max 0. In every case but max
+ * 0, *count messages were recorded and offsets[*count] is where scanning
+ * stopped. */
+int msgpack_scan_boundaries(const void *data, size_t len, size_t *offsets, size_t max, size_t *count) {
+    *count = 0;
+    if (max == 0) {
+        return -1;
+    }
+    size_t position = 0;
+    size_t found = 0;
+    int ret = 0;
+    while (found < max - 1 && position < len) {
+        size_t start = position;
+        ret = msgpack_scan_values((const uint8_t *)data, len, &position, 1);
+        if (ret != 0) {
+            break;
+        }
+        offsets[found++] = start;
+    }
+    offsets[found] = position;
+    *count = found;
+    return ret;
+}
+
+static bool msgpack_within_limit(uint32_t size, uint32_t limit) {
+    return limit == 0 || size <= limit;
+}
+
+static bool msgpack_header_within_limits(const msgpack_object *header, const msgpack_limits *limits) {
+    switch (header->type) {
+        case MSGPACK_TYPE_FIXSTR:
+        case MSGPACK_TYPE_STR8:
+        case MSGPACK_TYPE_STR16:
+        case MSGPACK_TYPE_STR32:
+            return msgpack_within_limit(header->as.str.size, limits->max_str_size);
+        case MSGPACK_TYPE_BIN8:
+        case MSGPACK_TYPE_BIN16:
+        case MSGPACK_TYPE_BIN32:
+            return msgpack_within_limit(header->as.bin.size, limits->max_bin_size);
+        case MSGPACK_TYPE_FIXEXT1:
+        case MSGPACK_TYPE_FIXEXT2:
+        case MSGPACK_TYPE_FIXEXT4:
+        case MSGPACK_TYPE_FIXEXT8:
+        case MSGPACK_TYPE_FIXEXT16:
+        case MSGPACK_TYPE_EXT8:
+        case MSGPACK_TYPE_EXT16:
+        case MSGPACK_TYPE_EXT32:
+            return msgpack_within_limit(header->as.ext.size, limits->max_ext_size);
         case MSGPACK_TYPE_FIXARRAY:
         case MSGPACK_TYPE_ARRAY16:
         case MSGPACK_TYPE_ARRAY32:
-            if (obj->as.array.ptr) {
-                for (uint32_t i = 0; i < obj->as.array.size; i++) {
-                    msgpack_object_free(&obj->as.array.ptr[i]);
-                }
-                free(obj->as.array.ptr);
-            }
-            break;
+            return msgpack_within_limit(header->as.array.size, limits->max_container_size);
         case MSGPACK_TYPE_FIXMAP:
         case MSGPACK_TYPE_MAP16:
         case MSGPACK_TYPE_MAP32:
-            if (obj->as.map.ptr) {
-                for (uint32_t i = 0; i < obj->as.map.size; i++) {
-                    msgpack_object_free(&obj->as.map.ptr[i].key);
-                    msgpack_object_free(&obj->as.map.ptr[i].value);
+            return msgpack_within_limit(header->as.map.size, limits->max_container_size);
+        default:
+            return true;
+    }
+}
+
+/* Checks that data holds exactly one well-formed value within limits,
+ * without building a tree. With NULL limits only the structure is checked,
+ * and nesting is capped at MSGPACK_DEFAULT_MAX_DEPTH. The depth is only
+ * tracked (on the explicit stack) when a limit is set; otherwise pending
+ * element counts are summed as in msgpack_skip_object. */
+int msgpack_validate(const void *data, size_t len, const msgpack_limits *limits) {
+    msgpack_reader reader;
+    msgpack_reader_init(&reader, data, len);
+    const msgpack_limits unlimited = {0};
+    size_t max_depth = limits ? limits->max_depth : MSGPACK_DEFAULT_MAX_DEPTH;
+    if (!limits) {
+        limits = &unlimited;
+    }
+    
+    msgpack_stack stack;
+    msgpack_stack_init(&stack, NULL);
+    msgpack_stack_push(&stack, NULL, 1);
+    int ret = 0;
+    while (stack.depth > 0) {
+        msgpack_frame *top = msgpack_stack_top(&stack);
+        if (top->index == top->count) {
+            stack.depth--;
+            continue;
+        }
+        top->index++;
+        msgpack_object header;
+        if (msgpack_read_header(&reader, &header) != 0 || !msgpack_header_within_limits(&header, limits)) {
+            ret = -1;
+            break;
+        }
+        if (msgpack_object_is_array(&header) || msgpack_object_is_map(&header)) {
+            uint64_t count = msgpack_object_child_count(&header);
+            if (max_depth == 0) {
+                /* no depth to enforce: fold the children into this frame */
+                top->count += count;
+            } else if (stack.depth > max_depth || (count > 0 && msgpack_stack_push(&stack, NULL, count) != 0)) {
+                ret = -1;
+                break;
+            }
+        }
+    }
+    msgpack_stack_free(&stack);
+    if (ret == 0 && reader.position != len) {
+        return -1;
+    }
+    return ret;
+}
+
+static int msgpack_visit_scalar(const msgpack_visitor *visitor, void *ctx, const msgpack_object *obj) {
+    switch (obj->type) {
+        case MSGPACK_TYPE_NIL:
+            return visitor->on_nil ? visitor->on_nil(ctx) : 0;
+        case MSGPACK_TYPE_BOOL:
+            return visitor->on_bool ? visitor->on_bool(ctx, obj->as.b) : 0;
+        case MSGPACK_TYPE_POSITIVE_FIXINT:
+        case MSGPACK_TYPE_UINT8:
+        case MSGPACK_TYPE_UINT16:
+        case MSGPACK_TYPE_UINT32:
+        case MSGPACK_TYPE_UINT64:
+            return visitor->on_uint ? visitor->on_uint(ctx, obj->as.u) : 0;
+        case MSGPACK_TYPE_NEGATIVE_FIXINT:
+        case MSGPACK_TYPE_INT8:
+        case MSGPACK_TYPE_INT16:
+        case MSGPACK_TYPE_INT32:
+        case MSGPACK_TYPE_INT64:
+            return visitor->on_int ? visitor->on_int(ctx, obj->as.i) : 0;
+        case MSGPACK_TYPE_FLOAT32:
+        case MSGPACK_TYPE_FLOAT64:
+            return visitor->on_float ? visitor->on_float(ctx, obj->as.f) : 0;
+        case MSGPACK_TYPE_FIXSTR:
+        case MSGPACK_TYPE_STR8:
+        case MSGPACK_TYPE_STR16:
+        case MSGPACK_TYPE_STR32:
+            return visitor->on_str ? visitor->on_str(ctx, obj->as.str.ptr, obj->as.str.size) : 0;
+        case MSGPACK_TYPE_BIN8:
+        case MSGPACK_TYPE_BIN16:
+        case MSGPACK_TYPE_BIN32:
+            return visitor->on_bin ? visitor->on_bin(ctx, obj->as.bin.ptr, obj->as.bin.size) : 0;
+        case MSGPACK_TYPE_TIMESTAMP:
+            return visitor->on_timestamp ? visitor->on_timestamp(ctx, obj->as.timestamp) : 0;
+        default:
+            return visitor->on_ext ? visitor->on_ext(ctx, obj->as.ext.type, obj->as.ext.ptr, obj->as.ext.size) : 0;
+    }
+}
+
+/* Streams one value through the visitor's callbacks. Containers are tracked
+ * on an explicit stack of remaining-element counts (2n for maps, so an even
+ * index is a key), bounded by the reader's max_depth. */
+int msgpack_parse(msgpack_reader *reader, const msgpack_visitor *visitor, void *ctx) {
+    msgpack_reader_clear_error(reader);
+    msgpack_stack stack;
+    msgpack_stack_init(&stack, reader->allocator);
+    /* the value itself is the only element of a virtual outermost frame */
+    msgpack_stack_push(&stack, NULL, 1);
+    int ret = 0;
+    while (stack.depth > 0) {
+        msgpack_frame *top = msgpack_stack_top(&stack);
+        if (top->index == top->count) {
+            bool is_map = top->is_map;
+            stack.depth--;
+            if (stack.depth == 0) {
+                break;
+            }
+            int (*on_end)(void *) = is_map ? visitor->on_map_end : visitor->on_array_end;
+            if (on_end && on_end(ctx) < 0) {
+                ret = -1;
+                break;
+            }
+            continue;
+        }
+        if (top->is_map && top->index % 2 == 0 && visitor->on_map_key) {
+            int r = visitor->on_map_key(ctx, (uint32_t)(top->index / 2));
+            if (r < 0) {
+                ret = -1;
+                break;
+            }
+            if (r == MSGPACK_VISIT_SKIP) {
+                top->index += 2;
+                if (msgpack_skip_values(reader, 2) != 0) {
+                    ret = -1;
+                    break;
                 }
-                free(obj->as.map.ptr);
+                continue;
             }
+        }
+        top->index++;
+        
+        msgpack_object header;
+        if (msgpack_read_header(reader, &header) != 0) {
+            ret = -1;
             break;
-        default:
+        }
+        bool is_map = msgpack_object_is_map(&header);
+        if (!is_map && !msgpack_object_is_array(&header)) {
+            if (msgpack_visit_scalar(visitor, ctx, &header) < 0) {
+                ret = -1;
+                break;
+            }
+            continue;
+        }
+        
+        int (*on_begin)(void *, uint32_t) = is_map ? visitor->on_map_begin : visitor->on_array_begin;
+        int r = on_begin ? on_begin(ctx, is_map ? header.as.map.size : header.as.array.size) : MSGPACK_VISIT_CONTINUE;
+        uint64_t count = msgpack_object_child_count(&header);
+        if (r < 0) {
+            ret = -1;
+            break;
+        }
+        if (r == MSGPACK_VISIT_SKIP) {
+            if (msgpack_skip_values(reader, count) != 0) {
+                ret = -1;
+                break;
+            }
+            continue;
+        }
+        if (msgpack_reader_depth_exceeded(reader, stack.depth - 1) || msgpack_stack_push(&stack, NULL, count) != 0) {
+            ret = -1;
             break;
+        }
+        msgpack_stack_top(&stack)->is_map = is_map;
     }
+    msgpack_stack_free(&stack);
+    return ret;
 }
@@ -0,0 +1,215 @@
+#include "msgpack/msgpack.h"
+#include "msgpack_internal.h"
+#include <string.h>
+
+#define MSGPACK_TAPE_MIN_CAPACITY 16
+
+int msgpack_tape_init(msgpack_tape *tape, size_t initial_capacity) {
+    return msgpack_tape_init_with_allocator(tape, initial_capacity, NULL);
+}
+
+int msgpack_tape_init_with_allocator(msgpack_tape *tape, size_t initial_capacity, const msgpack_allocator *allocator) {
+    tape->entries = NULL;
+    tape->count = 0;
+    tape->capacity = 0;
+    tape->children = NULL;
+    tape->children_count = 0;
+    tape->children_capacity = 0;
+    tape->data = NULL;
+    tape->length = 0;
+    tape->allocator = allocator;
+    if (initial_capacity > 0) {
+        tape->entries = (msgpack_tape_entry *)msgpack_alloc(allocator, initial_capacity * sizeof(msgpack_tape_entry));
+        if (!tape->entries) {
+            return -1;
+        }
+        tape->capacity = initial_capacity;
+    }
+    return 0;
+}
+
+void msgpack_tape_free(msgpack_tape *tape) {
+    msgpack_dealloc(tape->allocator, tape->entries, tape->capacity * sizeof(msgpack_tape_entry));
+    tape->entries = NULL;
+    tape->count = 0;
+    tape->capacity = 0;
+    msgpack_dealloc(tape->allocator, tape->children, tape->children_capacity * sizeof(size_t));
+    tape->children = NULL;
+    tape->children_count = 0;
+    tape->children_capacity = 0;
+}
+
+static msgpack_tape_entry *msgpack_tape_push(msgpack_tape *tape) {
+    if (tape->count == tape->capacity) {
+        size_t new_capacity = tape->capacity < MSGPACK_TAPE_MIN_CAPACITY ? MSGPACK_TAPE_MIN_CAPACITY : tape->capacity * 2;
+        msgpack_tape_entry *entries = (msgpack_tape_entry *)msgpack_realloc(tape->allocator, tape->entries,
+            tape->capacity * sizeof(msgpack_tape_entry), new_capacity * sizeof(msgpack_tape_entry));
+        if (!entries) {
+            return NULL;
+        }
+        tape->entries = entries;
+        tape->capacity = new_capacity;
+    }
+    return &tape->entries[tape->count++];
+}
+
+static bool msgpack_tape_is_container(const msgpack_tape_entry *entry, bool map) {
+    msgpack_object header = {.type = entry->type};
+    return map ? msgpack_object_is_map(&header) : msgpack_object_is_array(&header);
+}
+
+/* Records the element indexes of a closed array in the children table. The
+ * element subtrees are closed, so their next links are final and the walk
+ * is linear in the element count. */
+static int msgpack_tape_index_children(msgpack_tape *tape, size_t index) {
+    uint32_t count = tape->entries[index].count;
+    if (tape->children_capacity - tape->children_count < count) {
+        size_t new_capacity = tape->children_capacity < MSGPACK_TAPE_MIN_CAPACITY ? MSGPACK_TAPE_MIN_CAPACITY : tape->children_capacity * 2;
+        if (new_capacity - tape->children_count < count) {
+            new_capacity = tape->children_count + count;
+        }
+        size_t *children = (size_t *)msgpack_realloc(tape->allocator, tape->children,
+            tape->children_capacity * sizeof(size_t), new_capacity * sizeof(size_t));
+        if (!children) {
+            return -1;
+        }
+        tape->children = children;
+        tape->children_capacity = new_capacity;
+    }
+    tape->entries[index].children = tape->children_count;
+    size_t child = index + 1;
+    for (uint32_t n = 0; n < count; n++) {
+        tape->children[tape->children_count++] = child;
+        child = tape->entries[child].next;
+    }
+    return 0;
+}
+
+/* Indexes one value from the reader. While a container is open its entry's
+ * next field links to the enclosing open container, so only the remaining
+ * element counts need a stack; the link is replaced by the real next index
+ * when the container closes. An array whose subtree is longer than its
+ * element count holds a container, and gets its element indexes recorded so
+ * msgpack_tape_array_at stays constant time. On failure the tape is empty
+ * and the reader is back where it started. */
+int msgpack_tape_build(msgpack_tape *tape, msgpack_reader *reader) {
+    msgpack_reader_clear_error(reader);
+    const size_t none = SIZE_MAX;
+    size_t start = reader->position;
+    tape->count = 0;
+    tape->children_count = 0;
+    tape->data = reader->data;
+    tape->length = reader->length;
+    
+    msgpack_stack stack;
+    msgpack_stack_init(&stack, reader->allocator);
+    msgpack_stack_push(&stack, NULL, 1);
+    size_t open = none;
+    int ret = 0;
+    while (stack.depth > 0) {
+        msgpack_frame *top = msgpack_stack_top(&stack);
+        if (top->index == top->count) {
+            stack.depth--;
+            if (open != none && stack.depth > 0) {
+                size_t index = open;
+                msgpack_tape_entry *closed = &tape->entries[index];
+                open = closed->next;
+                closed->next = tape->count;
+                closed->end = reader->position;
+                if (msgpack_tape_is_container(closed, false) && closed->next - index - 1 != closed->count &&
+                    msgpack_tape_index_children(tape, index) != 0) {
+                    ret = -1;
+                    break;
+                }
+            }
+            continue;
+        }
+        top->index++;
+        
+        size_t index = tape->count;
+        msgpack_tape_entry *entry = msgpack_tape_push(tape);
+        if (!entry) {
+            ret = -1;
+            break;
+        }
+        entry->offset = reader->position;
+        msgpack_object header;
+        if (msgpack_read_header(reader, &header) != 0) {
+            ret = -1;
+            break;
+        }
+        entry->type = header.type;
+        entry->count = 0;
+        entry->end = reader->position;
+        entry->next = index + 1;
+        entry->children = none;
+        if (!msgpack_object_is_array(&header) && !msgpack_object_is_map(&header)) {
+            continue;
+        }
+        entry->count = msgpack_object_is_map(&header) ? header.as.map.size : header.as.array.size;
+        uint64_t children = msgpack_object_child_count(&header);
+        if (reader->max_depth != 0 && stack.depth > reader->max_depth) {
+            ret = -1;
+            break;
+        }
+        if (children == 0) {
+            continue;
+        }
+        if (msgpack_stack_push(&stack, NULL, children) != 0) {
+            ret = -1;
+            break;
+        }
+        entry->next = open;
+        open = index;
+    }
+    msgpack_stack_free(&stack);
+    if (ret != 0) {
+        tape->count = 0;
+        tape->children_count = 0;
+        reader->position = start;
+    }
+    return ret;
+}
+
+/* Decodes the value at a tape index. Containers get their type and element
+ * count with ptr NULL; use the tape to reach their elements. */
+int msgpack_tape_read(const msgpack_tape *tape, size_t index, msgpack_object *obj) {
+    if (index >= tape->count) {
+        return -1;
+    }
+    msgpack_reader reader;
+    msgpack_reader_init(&reader, tape->data, tape->entries[index].end);
+    reader.position = tape->entries[index].offset;
+    return msgpack_read_header(&reader, obj);
+}
+
+/* Finds element i of the array at index in constant time: through the
+ * children table when the array holds a container, else by position. */
+int msgpack_tape_array_at(const msgpack_tape *tape, size_t index, uint32_t i, size_t *out) {
+    if (index >= tape->count || !msgpack_tape_is_container(&tape->entries[index], false) || i >= tape->entries[index].count) {
+        return -1;
+    }
+    const msgpack_tape_entry *array = &tape->entries[index];
+    *out = array->children == SIZE_MAX ? index + 1 + i : tape->children[array->children + i];
+    return 0;
+}
+
+/* Finds the value stored under a string key in the map at index. Non-string
+ * keys are skipped; the first match wins. */
+int msgpack_tape_map_find(const msgpack_tape *tape, size_t index, const char *key, size_t key_len, size_t *out) {
+    if (index >= tape->count || !msgpack_tape_is_container(&tape->entries[index], true)) {
+        return -1;
+    }
+    size_t child = index + 1;
+    for (uint32_t n = 0; n < tape->entries[index].count; n++) {
+        size_t value = tape->entries[child].next;
+        msgpack_object k;
+        if (msgpack_tape_read(tape, child, &k) == 0 && msgpack_object_is_str(&k) &&
+            k.as.str.size == key_len && memcmp(k.as.str.ptr, key, key_len) == 0) {
+            *out = value;
+            return 0;
+        }
+        child = tape->entries[value].next;
+    }
+    return -1;
+}
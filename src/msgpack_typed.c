@@ -0,0 +1,356 @@
+#include "msgpack/msgpack.h"
+#include "msgpack_internal.h"
+
+/* Elements encoded per writer reservation. Bounded buffers get smaller
+ * chunks that fit their capacity. */
+#define MSGPACK_TYPED_CHUNK 1024
+
+typedef uint8_t *(*msgpack_typed_encoder)(uint8_t *p, const void *values, size_t n, const msgpack_kernels *kernels);
+
+/* Integers take the same smallest encoding as msgpack_pack_int, so the
+ * output matches packing them one by one. Runs that share a one-byte
+ * fixint form or a 9-byte form are handed over as a block; anything else
+ * goes through the unchecked writer. */
+static uint8_t *msgpack_encode_int64(uint8_t *p, const void *values, size_t n, const msgpack_kernels *kernels) {
+    const int64_t *v = (const int64_t *)values;
+    size_t i = 0;
+    while (i < n) {
+        size_t j = i + 1;
+        if (v[i] >= -32 && v[i] <= 127) {
+            while (j < n && v[j] >= -32 && v[j] <= 127) {
+                j++;
+            }
+            for (; i < j; i++) {
+                *p++ = (uint8_t)v[i];
+            }
+        } else if (v[i] > (int64_t)UINT32_MAX) {
+            while (j < n && v[j] > (int64_t)UINT32_MAX) {
+                j++;
+            }
+            kernels->pack_tagged64(p, v + i, j - i, 0xCF);
+            p += 9 * (j - i);
+            i = j;
+        } else if (v[i] < INT32_MIN) {
+            while (j < n && v[j] < INT32_MIN) {
+                j++;
+            }
+            kernels->pack_tagged64(p, v + i, j - i, 0xD3);
+            p += 9 * (j - i);
+            i = j;
+        } else {
+            msgpack_writer w = {.ptr = p};
+            msgpack_pack_int_unchecked(&w, v[i++]);
+            p = w.ptr;
+        }
+    }
+    return p;
+}
+
+static uint8_t *msgpack_encode_uint64(uint8_t *p, const void *values, size_t n, const msgpack_kernels *kernels) {
+    const uint64_t *v = (const uint64_t *)values;
+    size_t i = 0;
+    while (i < n) {
+        size_t j = i + 1;
+        if (v[i] <= 127) {
+            while (j < n && v[j] <= 127) {
+                j++;
+            }
+            for (; i < j; i++) {
+                *p++ = (uint8_t)v[i];
+            }
+        } else if (v[i] > UINT32_MAX) {
+            while (j < n && v[j] > UINT32_MAX) {
+                j++;
+            }
+            kernels->pack_tagged64(p, v + i, j - i, 0xCF);
+            p += 9 * (j - i);
+            i = j;
+        } else {
+            msgpack_writer w = {.ptr = p};
+            msgpack_pack_uint_unchecked(&w, v[i++]);
+            p = w.ptr;
+        }
+    }
+    return p;
+}
+
+static uint8_t *msgpack_encode_double(uint8_t *p, const void *values, size_t n, const msgpack_kernels *kernels) {
+    kernels->pack_tagged64(p, values, n, 0xCB);
+    return p + 9 * n;
+}
+
+static uint8_t *msgpack_encode_float(uint8_t *p, const void *values, size_t n, const msgpack_kernels *kernels) {
+    kernels->pack_tagged32(p, values, n, 0xCA);
+    return p + 5 * n;
+}
+
+/* Array header, then the elements in chunks, each reserving max_width
+ * bytes per element up front. A bounded buffer too small for one element at
+ * max_width takes them one at a time through msgpack_buffer_append. */
+static int msgpack_pack_typed(msgpack_buffer *buf, const void *values, size_t n, size_t size, size_t max_width, msgpack_typed_encoder encode) {
+    if (n > UINT32_MAX || msgpack_pack_array(buf, (uint32_t)n) != 0) {
+        return -1;
+    }
+    const msgpack_kernels *kernels = msgpack_cpu_kernels();
+    const uint8_t *in = (const uint8_t *)values;
+    msgpack_writer w;
+    if (msgpack_writer_begin(&w, buf, 0) != 0) {
+        return -1;
+    }
+    while (n > 0) {
+        size_t chunk = n < MSGPACK_TYPED_CHUNK ? n : MSGPACK_TYPED_CHUNK;
+        if (buf->flush && chunk * max_width > buf->capacity) {
+            chunk = buf->capacity / max_width;
+        }
+        if (chunk == 0) {
+            uint8_t one[9];
+            size_t len = (size_t)(encode(one, in, 1, kernels) - one);
+            msgpack_writer_end(&w);
+            if (msgpack_buffer_append(buf, one, len) != 0 || msgpack_writer_begin(&w, buf, 0) != 0) {
+                return -1;
+            }
+            chunk = 1;
+        } else {
+            if (msgpack_writer_ensure(&w, chunk * max_width) != 0) {
+                return -1;
+            }
+            w.ptr = encode(w.ptr, in, chunk, kernels);
+        }
+        in += chunk * size;
+        n -= chunk;
+    }
+    msgpack_writer_end(&w);
+    return 0;
+}
+
+int msgpack_pack_int64_array(msgpack_buffer *buf, const int64_t *values, size_t n) {
+    return msgpack_pack_typed(buf, values, n, sizeof(*values), 9, msgpack_encode_int64);
+}
+
+int msgpack_pack_uint64_array(msgpack_buffer *buf, const uint64_t *values, size_t n) {
+    return msgpack_pack_typed(buf, values, n, sizeof(*values), 9, msgpack_encode_uint64);
+}
+
+/* Every element is written as float64 (float32 for msgpack_pack_float_array),
+ * without msgpack_pack_float's narrowing, so the array is fixed-width. */
+int msgpack_pack_double_array(msgpack_buffer *buf, const double *values, size_t n) {
+    return msgpack_pack_typed(buf, values, n, sizeof(*values), 9, msgpack_encode_double);
+}
+
+int msgpack_pack_float_array(msgpack_buffer *buf, const float *values, size_t n) {
+    return msgpack_pack_typed(buf, values, n, sizeof(*values), 5, msgpack_encode_float);
+}
+
+/* Reads the array header and checks it against max. *count is set even
+ * when the array is too long, so the caller can size a retry. */
+static int msgpack_read_typed_header(msgpack_reader *reader, size_t max, size_t *count) {
+    msgpack_object obj;
+    if (msgpack_read_header(reader, &obj) != 0 || !msgpack_object_is_array(&obj)) {
+        return -1;
+    }
+    *count = obj.as.array.size;
+    return *count <= max ? 0 : -1;
+}
+
+static bool msgpack_is_fixint(uint8_t b) {
+    return b <= 0x7F || b >= 0xE0;
+}
+
+/* Each element loop takes runs of the common fixed forms in bulk and falls
+ * back to msgpack_read_header for anything else, converting the way the
+ * msgpack_view_get_* accessors do. */
+static int msgpack_read_int64_elements(msgpack_reader *reader, int64_t *values, size_t n, const msgpack_kernels *kernels) {
+    size_t i = 0;
+    while (i < n) {
+        const uint8_t *p = reader->data + reader->position;
+        size_t left = msgpack_reader_remaining(reader);
+        if (left > 0 && msgpack_is_fixint(p[0])) {
+            size_t run = n - i < left ? n - i : left;
+            size_t k = 0;
+            while (k < run && msgpack_is_fixint(p[k])) {
+                values[i + k] = (int8_t)p[k];
+                k++;
+            }
+            i += k;
+            reader->position += k;
+            continue;
+        }
+        if (left > 0 && (p[0] == 0xD3 || p[0] == 0xCF)) {
+            size_t run = n - i < left / 9 ? n - i : left / 9;
+            size_t got = kernels->unpack_tagged64(values + i, p, run, p[0]);
+            for (size_t k = 0; p[0] == 0xCF && k < got; k++) {
+                if (values[i + k] < 0) {
+                    return -1;
+                }
+            }
+            if (got > 0) {
+                i += got;
+                reader->position += 9 * got;
+                continue;
+            }
+        }
+        msgpack_object obj;
+        if (msgpack_read_header(reader, &obj) != 0) {
+            return -1;
+        }
+        if (msgpack_object_is_signed(&obj)) {
+            values[i++] = obj.as.i;
+        } else if (msgpack_object_is_unsigned(&obj) && obj.as.u <= INT64_MAX) {
+            values[i++] = (int64_t)obj.as.u;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int msgpack_read_uint64_elements(msgpack_reader *reader, uint64_t *values, size_t n, const msgpack_kernels *kernels) {
+    size_t i = 0;
+    while (i < n) {
+        const uint8_t *p = reader->data + reader->position;
+        size_t left = msgpack_reader_remaining(reader);
+        if (left > 0 && p[0] <= 0x7F) {
+            size_t run = n - i < left ? n - i : left;
+            size_t k = 0;
+            while (k < run && p[k] <= 0x7F) {
+                values[i + k] = p[k];
+                k++;
+            }
+            i += k;
+            reader->position += k;
+            continue;
+        }
+        if (left > 0 && p[0] == 0xCF) {
+            size_t run = n - i < left / 9 ? n - i : left / 9;
+            size_t got = kernels->unpack_tagged64(values + i, p, run, 0xCF);
+            if (got > 0) {
+                i += got;
+                reader->position += 9 * got;
+                continue;
+            }
+        }
+        msgpack_object obj;
+        if (msgpack_read_header(reader, &obj) != 0) {
+            return -1;
+        }
+        if (msgpack_object_is_unsigned(&obj)) {
+            values[i++] = obj.as.u;
+        } else if (msgpack_object_is_signed(&obj) && obj.as.i >= 0) {
+            values[i++] = (uint64_t)obj.as.i;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int msgpack_read_double_elements(msgpack_reader *reader, double *values, size_t n, const msgpack_kernels *kernels) {
+    size_t i = 0;
+    while (i < n) {
+        const uint8_t *p = reader->data + reader->position;
+        size_t left = msgpack_reader_remaining(reader);
+        if (left > 0 && p[0] == 0xCB) {
+            size_t run = n - i < left / 9 ? n - i : left / 9;
+            size_t got = kernels->unpack_tagged64(values + i, p, run, 0xCB);
+            if (got > 0) {
+                i += got;
+                reader->position += 9 * got;
+                continue;
+            }
+        }
+        msgpack_object obj;
+        if (msgpack_read_header(reader, &obj) != 0) {
+            return -1;
+        }
+        if (msgpack_object_is_float(&obj)) {
+            values[i++] = obj.as.f;
+        } else if (msgpack_object_is_unsigned(&obj)) {
+            values[i++] = (double)obj.as.u;
+        } else if (msgpack_object_is_signed(&obj)) {
+            values[i++] = (double)obj.as.i;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int msgpack_read_float_elements(msgpack_reader *reader, float *values, size_t n, const msgpack_kernels *kernels) {
+    size_t i = 0;
+    while (i < n) {
+        const uint8_t *p = reader->data + reader->position;
+        size_t left = msgpack_reader_remaining(reader);
+        if (left > 0 && p[0] == 0xCA) {
+            size_t run = n - i < left / 5 ? n - i : left / 5;
+            size_t got = kernels->unpack_tagged32(values + i, p, run, 0xCA);
+            if (got > 0) {
+                i += got;
+                reader->position += 5 * got;
+                continue;
+            }
+        }
+        msgpack_object obj;
+        if (msgpack_read_header(reader, &obj) != 0) {
+            return -1;
+        }
+        if (msgpack_object_is_float(&obj)) {
+            values[i++] = (float)obj.as.f;
+        } else if (msgpack_object_is_unsigned(&obj)) {
+            values[i++] = (float)obj.as.u;
+        } else if (msgpack_object_is_signed(&obj)) {
+            values[i++] = (float)obj.as.i;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Decodes one array of numbers straight into values, which must have room
+ * for max elements. Returns -1 if the next value is not an array, has more
+ * than max elements (*count still reports how many), or holds an element
+ * that does not convert; values may then be partly written, and the reader
+ * has not moved. */
+int msgpack_read_int64_array(msgpack_reader *reader, int64_t *values, size_t max, size_t *count) {
+    msgpack_reader_clear_error(reader);
+    size_t start = reader->position;
+    if (msgpack_read_typed_header(reader, max, count) != 0 ||
+        msgpack_read_int64_elements(reader, values, *count, msgpack_cpu_kernels()) != 0) {
+        reader->position = start;
+        return -1;
+    }
+    return 0;
+}
+
+int msgpack_read_uint64_array(msgpack_reader *reader, uint64_t *values, size_t max, size_t *count) {
+    msgpack_reader_clear_error(reader);
+    size_t start = reader->position;
+    if (msgpack_read_typed_header(reader, max, count) != 0 ||
+        msgpack_read_uint64_elements(reader, values, *count, msgpack_cpu_kernels()) != 0) {
+        reader->position = start;
+        return -1;
+    }
+    return 0;
+}
+
+int msgpack_read_double_array(msgpack_reader *reader, double *values, size_t max, size_t *count) {
+    msgpack_reader_clear_error(reader);
+    size_t start = reader->position;
+    if (msgpack_read_typed_header(reader, max, count) != 0 ||
+        msgpack_read_double_elements(reader, values, *count, msgpack_cpu_kernels()) != 0) {
+        reader->position = start;
+        return -1;
+    }
+    return 0;
+}
+
+int msgpack_read_float_array(msgpack_reader *reader, float *values, size_t max, size_t *count) {
+    msgpack_reader_clear_error(reader);
+    size_t start = reader->position;
+    if (msgpack_read_typed_header(reader, max, count) != 0 ||
+        msgpack_read_float_elements(reader, values, *count, msgpack_cpu_kernels()) != 0) {
+        reader->position = start;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include "msgpack/msgpack.h"
+#include "msgpack_internal.h"
+#include <string.h>
+
+int msgpack_unpacker_init(msgpack_unpacker *unpacker, size_t initial_capacity) {
+    return msgpack_unpacker_init_with_allocator(unpacker, initial_capacity, NULL);
+}
+
+int msgpack_unpacker_init_with_allocator(msgpack_unpacker *unpacker, size_t initial_capacity, const msgpack_allocator *allocator) {
+    unpacker->consumed = 0;
+    unpacker->scanned = 0;
+    unpacker->pending = 0;
+    unpacker->elements = 0;
+    unpacker->zone = NULL;
+    unpacker->max_depth = MSGPACK_DEFAULT_MAX_DEPTH;
+    unpacker->max_message_size = MSGPACK_UNPACKER_DEFAULT_MAX_MESSAGE_SIZE;
+    unpacker->max_elements = 0;
+    unpacker->validate_utf8 = false;
+    unpacker->utf8_error_offset = SIZE_MAX;
+    return msgpack_buffer_init_with_allocator(&unpacker->buffer, initial_capacity, allocator);
+}
+
+void msgpack_unpacker_free(msgpack_unpacker *unpacker) {
+    msgpack_buffer_free(&unpacker->buffer);
+    unpacker->consumed = 0;
+    unpacker->scanned = 0;
+    unpacker->pending = 0;
+    unpacker->elements = 0;
+}
+
+/* Drops every buffered byte and the scan of the current message, keeping
+ * the settings and the buffer's memory. This is the way out after
+ * msgpack_unpacker_next fails on a malformed header or a limit: the input
+ * then has no known message boundary, so every later call fails the same
+ * way until the unpacker is reset and fed input that starts on a message
+ * boundary, such as a new connection. */
+void msgpack_unpacker_reset(msgpack_unpacker *unpacker) {
+    msgpack_buffer_clear(&unpacker->buffer);
+    unpacker->consumed = 0;
+    unpacker->scanned = 0;
+    unpacker->pending = 0;
+    unpacker->elements = 0;
+    unpacker->utf8_error_offset = SIZE_MAX;
+}
+
+void msgpack_unpacker_set_zone(msgpack_unpacker *unpacker, msgpack_zone *zone) {
+    unpacker->zone = zone;
+}
+
+void msgpack_unpacker_set_max_depth(msgpack_unpacker *unpacker, size_t max_depth) {
+    unpacker->max_depth = max_depth;
+}
+
+/* Caps the encoded size of one message (MSGPACK_UNPACKER_DEFAULT_MAX_MESSAGE_SIZE
+ * by default); 0 disables the limit. */
+void msgpack_unpacker_set_max_message_size(msgpack_unpacker *unpacker, size_t max_message_size) {
+    unpacker->max_message_size = max_message_size;
+}
+
+/* Caps the number of values nested in one message: array elements plus map
+ * keys and values, at any depth. 0 (the default) leaves only the bound the
+ * message size implies. */
+void msgpack_unpacker_set_max_elements(msgpack_unpacker *unpacker, uint64_t max_elements) {
+    unpacker->max_elements = max_elements;
+}
+
+/* Checks every str in the messages msgpack_unpacker_next returns, as
+ * msgpack_reader_set_validate_utf8 does. A message that fails leaves the
+ * offset of its first bad byte, counted from the message's first byte, in
+ * utf8_error_offset. */
+void msgpack_unpacker_set_validate_utf8(msgpack_unpacker *unpacker, bool validate) {
+    unpacker->validate_utf8 = validate;
+}
+
+/* Every value still pending needs at least one more byte, so a header that
+ * claims a huge payload or element count fails as soon as it is scanned,
+ * before the unpacker buffers anything it promises. */
+static bool msgpack_unpacker_over_limit(const msgpack_unpacker *unpacker, size_t size, uint64_t children) {
+    if (unpacker->max_elements != 0 && children > unpacker->max_elements - unpacker->elements) {
+        return true;
+    }
+    if (unpacker->max_message_size != 0) {
+        size_t left = unpacker->max_message_size - (unpacker->scanned - unpacker->consumed);
+        if (size > left || unpacker->pending - 1 + children > left - size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Drops the bytes of messages already returned. This moves the buffer, so
+ * objects from earlier msgpack_unpacker_next calls must be finished with
+ * before more input is added. */
+static void msgpack_unpacker_compact(msgpack_unpacker *unpacker) {
+    size_t consumed = unpacker->consumed;
+    if (consumed == 0) {
+        return;
+    }
+    msgpack_buffer *buf = &unpacker->buffer;
+    memmove(buf->data, buf->data + consumed, buf->length - consumed);
+    buf->length -= consumed;
+    unpacker->scanned -= consumed;
+    unpacker->consumed = 0;
+}
+
+int msgpack_unpacker_feed(msgpack_unpacker *unpacker, const void *data, size_t len) {
+    msgpack_unpacker_compact(unpacker);
+    return msgpack_buffer_append(&unpacker->buffer, data, len);
+}
+
+/* Returns space for len more bytes so a socket can read straight into the
+ * unpacker; report how many arrived with msgpack_unpacker_commit. */
+uint8_t *msgpack_unpacker_reserve(msgpack_unpacker *unpacker, size_t len) {
+    msgpack_unpacker_compact(unpacker);
+    if (msgpack_buffer_reserve(&unpacker->buffer, len) != 0) {
+        return NULL;
+    }
+    return unpacker->buffer.data + unpacker->buffer.length;
+}
+
+void msgpack_unpacker_commit(msgpack_unpacker *unpacker, size_t len) {
+    unpacker->buffer.length += len;
+}
+
+/* Yields the next complete message. Returns 0 with obj filled,
+ * MSGPACK_UNPACK_NEED_MORE if the buffered bytes end mid-message (the scan
+ * position is kept), or -1. A message that is complete but does not decode
+ * (too deep, bad UTF-8) is dropped, and the next call goes on with the
+ * message after it. A malformed header or a message over the size or
+ * element limits leaves no way to find the next message: -1 is then
+ * returned on every call until msgpack_unpacker_reset. str/bin/ext in obj
+ * point into the unpacker's buffer and stay valid until the next feed or
+ * reserve. */
+int msgpack_unpacker_next(msgpack_unpacker *unpacker, msgpack_object *obj) {
+    const uint8_t *data = unpacker->buffer.data;
+    size_t length = unpacker->buffer.length;
+    if (unpacker->pending == 0) {
+        if (unpacker->consumed == length) {
+            return MSGPACK_UNPACK_NEED_MORE;
+        }
+        unpacker->pending = 1;
+        unpacker->elements = 0;
+    }
+    while (unpacker->pending > 0) {
+        size_t size;
+        uint64_t children;
+        int ret = msgpack_value_extent(data + unpacker->scanned, length - unpacker->scanned, &size, &children);
+        if (ret != 0) {
+            return ret;
+        }
+        if (msgpack_unpacker_over_limit(unpacker, size, children)) {
+            return -1;
+        }
+        if (size > length - unpacker->scanned) {
+            return MSGPACK_UNPACK_NEED_MORE;
+        }
+        unpacker->scanned += size;
+        unpacker->pending += children - 1;
+        unpacker->elements += children;
+    }
+    
+    msgpack_reader reader;
+    msgpack_reader_init(&reader, data + unpacker->consumed, unpacker->scanned - unpacker->consumed);
+    reader.allocator = unpacker->buffer.allocator;
+    reader.zone = unpacker->zone;
+    reader.max_depth = unpacker->max_depth;
+    reader.validate_utf8 = unpacker->validate_utf8;
+    int ret = msgpack_read_object(&reader, obj);
+    unpacker->utf8_error_offset = reader.utf8_error_offset;
+    unpacker->consumed = unpacker->scanned;
+    return ret;
+}
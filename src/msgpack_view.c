@@ -0,0 +1,165 @@
+#include "msgpack/msgpack.h"
+#include "msgpack_internal.h"
+#include <string.h>
+
+int msgpack_view_init(msgpack_view *view, const void *data, size_t len) {
+    view->data = (const uint8_t *)data;
+    view->length = len;
+    return 0;
+}
+
+/* Moves the reader from a map header to the value stored under key. Keys
+ * that don't match are compared in place and skipped along with their
+ * values. */
+static int msgpack_view_find_key(msgpack_reader *reader, uint32_t entries, const char *key, size_t key_len) {
+    for (uint32_t n = 0; n < entries; n++) {
+        msgpack_object k;
+        if (msgpack_read_header(reader, &k) != 0) {
+            return -1;
+        }
+        if (msgpack_object_is_str(&k) && k.as.str.size == key_len && memcmp(k.as.str.ptr, key, key_len) == 0) {
+            return 0;
+        }
+        /* the rest of a container key, then the value */
+        for (uint64_t pending = msgpack_object_child_count(&k) + 1; pending > 0; pending--) {
+            if (msgpack_skip_object(reader) != 0) {
+                return -1;
+            }
+        }
+    }
+    return -1;
+}
+
+/* Resolves a path such as "user.tags[3]" from the start of view: segments
+ * are map keys separated by '.', and [n] indexes an array. Keys containing
+ * '.' or '[' cannot be addressed. An empty path is the view itself. */
+int msgpack_view_get(const msgpack_view *view, const char *path, msgpack_view *out) {
+    msgpack_reader reader;
+    msgpack_reader_init(&reader, view->data, view->length);
+    const char *p = path;
+    while (*p) {
+        msgpack_object header;
+        if (msgpack_read_header(&reader, &header) != 0) {
+            return -1;
+        }
+        if (*p == '[') {
+            if (p[1] < '0' || p[1] > '9') {
+                return -1;
+            }
+            char *end;
+            unsigned long long index = strtoull(p + 1, &end, 10);
+            if (*end != ']' || !msgpack_object_is_array(&header) || index >= header.as.array.size) {
+                return -1;
+            }
+            for (unsigned long long i = 0; i < index; i++) {
+                if (msgpack_skip_object(&reader) != 0) {
+                    return -1;
+                }
+            }
+            p = end + 1;
+        } else {
+            size_t key_len = strcspn(p, ".[");
+            if (key_len == 0 || !msgpack_object_is_map(&header) ||
+                msgpack_view_find_key(&reader, header.as.map.size, p, key_len) != 0) {
+                return -1;
+            }
+            p += key_len;
+        }
+        if (*p == '.') {
+            p++;
+            if (*p == '\0' || *p == '.' || *p == '[') {
+                return -1;
+            }
+        }
+    }
+    out->data = view->data + reader.position;
+    out->length = view->length - reader.position;
+    return 0;
+}
+
+/* Decodes the value a view starts at. Containers get their type and element
+ * count with ptr NULL. */
+int msgpack_view_read(const msgpack_view *view, msgpack_object *obj) {
+    msgpack_reader reader;
+    msgpack_reader_init(&reader, view->data, view->length);
+    return msgpack_read_header(&reader, obj);
+}
+
+static int msgpack_view_lookup(const msgpack_view *view, const char *path, msgpack_object *obj) {
+    msgpack_view target;
+    if (msgpack_view_get(view, path, &target) != 0) {
+        return -1;
+    }
+    return msgpack_view_read(&target, obj);
+}
+
+int msgpack_view_get_bool(const msgpack_view *view, const char *path, bool *out) {
+    msgpack_object obj;
+    if (msgpack_view_lookup(view, path, &obj) != 0 || obj.type != MSGPACK_TYPE_BOOL) {
+        return -1;
+    }
+    *out = obj.as.b;
+    return 0;
+}
+
+/* Integer accessors accept any integer encoding whose value fits. */
+int msgpack_view_get_int(const msgpack_view *view, const char *path, int64_t *out) {
+    msgpack_object obj;
+    if (msgpack_view_lookup(view, path, &obj) != 0) {
+        return -1;
+    }
+    if (msgpack_object_is_signed(&obj)) {
+        *out = obj.as.i;
+        return 0;
+    }
+    if (msgpack_object_is_unsigned(&obj) && obj.as.u <= INT64_MAX) {
+        *out = (int64_t)obj.as.u;
+        return 0;
+    }
+    return -1;
+}
+
+int msgpack_view_get_uint(const msgpack_view *view, const char *path, uint64_t *out) {
+    msgpack_object obj;
+    if (msgpack_view_lookup(view, path, &obj) != 0) {
+        return -1;
+    }
+    if (msgpack_object_is_unsigned(&obj)) {
+        *out = obj.as.u;
+        return 0;
+    }
+    if (msgpack_object_is_signed(&obj) && obj.as.i >= 0) {
+        *out = (uint64_t)obj.as.i;
+        return 0;
+    }
+    return -1;
+}
+
+/* Accepts floats and integers (converted). */
+int msgpack_view_get_float(const msgpack_view *view, const char *path, double *out) {
+    msgpack_object obj;
+    if (msgpack_view_lookup(view, path, &obj) != 0) {
+        return -1;
+    }
+    if (msgpack_object_is_float(&obj)) {
+        *out = obj.as.f;
+    } else if (msgpack_object_is_unsigned(&obj)) {
+        *out = (double)obj.as.u;
+    } else if (msgpack_object_is_signed(&obj)) {
+        *out = (double)obj.as.i;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/* The string is returned as a slice of the view's buffer, not terminated. */
+int msgpack_view_get_str(const msgpack_view *view, const char *path, const char **ptr, uint32_t *size) {
+    msgpack_object obj;
+    if (msgpack_view_lookup(view, path, &obj) != 0 || !msgpack_object_is_str(&obj)) {
+        return -1;
+    }
+    *ptr = obj.as.str.ptr;
+    *size = obj.as.str.size;
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include "msgpack/msgpack.h"
+#include "msgpack_internal.h"
+#include <stdalign.h>
+#include <string.h>
+
+#define MSGPACK_ZONE_ALIGN alignof(max_align_t)
+
+struct msgpack_zone_chunk {
+    struct msgpack_zone_chunk *next;
+    size_t size;
+    alignas(max_align_t) uint8_t data[];
+};
+
+static size_t msgpack_zone_align(size_t size) {
+    return (size + MSGPACK_ZONE_ALIGN - 1) & ~(MSGPACK_ZONE_ALIGN - 1);
+}
+
+int msgpack_zone_init(msgpack_zone *zone, size_t chunk_size) {
+    return msgpack_zone_init_with_allocator(zone, chunk_size, NULL);
+}
+
+int msgpack_zone_init_with_allocator(msgpack_zone *zone, size_t chunk_size, const msgpack_allocator *allocator) {
+    zone->chunks = NULL;
+    zone->ptr = NULL;
+    zone->end = NULL;
+    zone->chunk_size = chunk_size ? chunk_size : MSGPACK_ZONE_DEFAULT_CHUNK_SIZE;
+    zone->used = 0;
+    zone->high_water = 0;
+    zone->allocator = allocator;
+    return 0;
+}
+
+static struct msgpack_zone_chunk *msgpack_zone_new_chunk(msgpack_zone *zone, size_t size) {
+    struct msgpack_zone_chunk *chunk = (struct msgpack_zone_chunk *)msgpack_alloc(zone->allocator, sizeof(struct msgpack_zone_chunk) + size);
+    if (chunk) {
+        chunk->next = NULL;
+        chunk->size = size;
+    }
+    return chunk;
+}
+
+static void msgpack_zone_use_chunk(msgpack_zone *zone, struct msgpack_zone_chunk *chunk) {
+    chunk->next = zone->chunks;
+    zone->chunks = chunk;
+    zone->ptr = chunk->data;
+    zone->end = chunk->data + chunk->size;
+}
+
+static int msgpack_zone_push_chunk(msgpack_zone *zone, size_t size) {
+    struct msgpack_zone_chunk *chunk = msgpack_zone_new_chunk(zone, size);
+    if (!chunk) {
+        return -1;
+    }
+    msgpack_zone_use_chunk(zone, chunk);
+    return 0;
+}
+
+/* Frees every chunk except keep, which may be NULL. */
+static void msgpack_zone_release_chunks(msgpack_zone *zone, struct msgpack_zone_chunk *keep) {
+    struct msgpack_zone_chunk *chunk = zone->chunks;
+    while (chunk) {
+        struct msgpack_zone_chunk *next = chunk->next;
+        if (chunk != keep) {
+            msgpack_dealloc(zone->allocator, chunk, sizeof(struct msgpack_zone_chunk) + chunk->size);
+        }
+        chunk = next;
+    }
+    zone->chunks = NULL;
+    zone->ptr = NULL;
+    zone->end = NULL;
+}
+
+void *msgpack_zone_alloc(msgpack_zone *zone, size_t size) {
+    if (size > SIZE_MAX - sizeof(struct msgpack_zone_chunk) - MSGPACK_ZONE_ALIGN) {
+        return NULL;
+    }
+    size = msgpack_zone_align(size ? size : 1);
+    if (size > (size_t)(zone->end - zone->ptr)) {
+        size_t chunk_size = size > zone->chunk_size ? size : zone->chunk_size;
+        if (msgpack_zone_push_chunk(zone, chunk_size) != 0) {
+            return NULL;
+        }
+    }
+    void *p = zone->ptr;
+    zone->ptr += size;
+    zone->used += size;
+    return p;
+}
+
+/* Keeps a single chunk large enough for the biggest message decoded so far,
+ * so steady-state reuse never touches the underlying allocator. The larger
+ * chunk is allocated before the old ones are freed; if that fails the
+ * largest existing chunk is kept instead, so a reset never leaves the zone
+ * with less memory than its biggest chunk. */
+void msgpack_zone_reset(msgpack_zone *zone) {
+    if (zone->used > zone->high_water) {
+        zone->high_water = zone->used;
+    }
+    zone->used = 0;
+    if (!zone->chunks) {
+        return;
+    }
+    if (zone->chunks->next || zone->chunks->size < zone->high_water) {
+        size_t size = zone->high_water > zone->chunk_size ? zone->high_water : zone->chunk_size;
+        struct msgpack_zone_chunk *keep = msgpack_zone_new_chunk(zone, size);
+        if (!keep) {
+            keep = zone->chunks;
+            for (struct msgpack_zone_chunk *chunk = keep->next; chunk; chunk = chunk->next) {
+                if (chunk->size > keep->size) {
+                    keep = chunk;
+                }
+            }
+        }
+        msgpack_zone_release_chunks(zone, keep);
+        msgpack_zone_use_chunk(zone, keep);
+        return;
+    }
+    zone->ptr = zone->chunks->data;
+}
+
+void msgpack_zone_free(msgpack_zone *zone) {
+    msgpack_zone_release_chunks(zone, NULL);
+    zone->used = 0;
+    zone->high_water = 0;
+}
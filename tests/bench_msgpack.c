@@ -0,0 +1,549 @@
+/* msgpack micro-benchmarks */
+#define _POSIX_C_SOURCE 200809L
+#include "msgpack/msgpack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_ROWS 200000
+#define BENCH_ITERATIONS 10
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void report(const char *name, double total_ns, size_t ops, const char *unit) {
+    printf("%-40s %10.2f ns/%s\n", name, total_ns / (double)ops, unit);
+}
+
+/* Worker threads for the pool-based rows: MSGPACK_BENCH_THREADS if set,
+ * else one per online CPU. */
+static size_t bench_threads(void) {
+    const char *env = getenv("MSGPACK_BENCH_THREADS");
+    return env ? (size_t)strtoul(env, NULL, 10) : 0;
+}
+
+/* Builds [ {"id": i, "name": "row-name", "score": i * 0.5}, ... ] */
+static msgpack_object make_rows(size_t rows) {
+    msgpack_object root = {.type = MSGPACK_TYPE_ARRAY};
+    root.as.array.size = (uint32_t)rows;
+    root.as.array.ptr = malloc(rows * sizeof(msgpack_object));
+    for (size_t i = 0; i < rows; i++) {
+        msgpack_object_kv *kv = malloc(3 * sizeof(msgpack_object_kv));
+        kv[0].key = (msgpack_object){.type = MSGPACK_TYPE_STR, .as.str.ptr = "id", .as.str.size = 2};
+        kv[0].value = (msgpack_object){.type = MSGPACK_TYPE_UINT64, .as.u = i};
+        kv[1].key = (msgpack_object){.type = MSGPACK_TYPE_STR, .as.str.ptr = "name", .as.str.size = 4};
+        kv[1].value = (msgpack_object){.type = MSGPACK_TYPE_STR, .as.str.ptr = "row-name", .as.str.size = 8};
+        kv[2].key = (msgpack_object){.type = MSGPACK_TYPE_STR, .as.str.ptr = "score", .as.str.size = 5};
+        kv[2].value = (msgpack_object){.type = MSGPACK_TYPE_FLOAT64, .as.f = (double)i * 0.1};
+        root.as.array.ptr[i] = (msgpack_object){.type = MSGPACK_TYPE_MAP, .as.map.ptr = kv, .as.map.size = 3};
+    }
+    return root;
+}
+
+static void free_rows(msgpack_object *root) {
+    for (uint32_t i = 0; i < root->as.array.size; i++) {
+        free(root->as.array.ptr[i].as.map.ptr);
+    }
+    free(root->as.array.ptr);
+}
+
+static void bench_serialize(const msgpack_object *root) {
+    double growth_ns = 0, sized_ns = 0, each_ns = 0, batch_ns = 0;
+    msgpack_pool pool;
+    msgpack_pool_init(&pool, bench_threads());
+    msgpack_batch batch;
+    msgpack_batch_init(&batch, 0);
+    msgpack_buffer out;
+    msgpack_buffer_init(&out, 0);
+    for (int iter = 0; iter < BENCH_ITERATIONS; iter++) {
+        msgpack_serializer serializer;
+        msgpack_serializer_init(&serializer, 0);
+        double start = now_ns();
+        msgpack_serialize(&serializer, root);
+        growth_ns += now_ns() - start;
+        msgpack_serializer_free(&serializer);
+
+        msgpack_serializer_init(&serializer, 0);
+        start = now_ns();
+        msgpack_serialize_sized(&serializer, root);
+        sized_ns += now_ns() - start;
+
+        /* every row as its own message */
+        msgpack_buffer_clear(&out);
+        start = now_ns();
+        for (uint32_t i = 0; i < root->as.array.size; i++) {
+            msgpack_serialize(&serializer, &root->as.array.ptr[i]);
+            msgpack_buffer_append(&out, serializer.buffer.data, serializer.buffer.length);
+        }
+        each_ns += now_ns() - start;
+        msgpack_serializer_free(&serializer);
+
+        start = now_ns();
+        msgpack_serialize_batch(root->as.array.ptr, root->as.array.size, &pool, &batch);
+        batch_ns += now_ns() - start;
+    }
+    msgpack_buffer_free(&out);
+    msgpack_batch_free(&batch);
+    size_t ops = (size_t)BENCH_ITERATIONS * root->as.array.size;
+    report("serialize (growth path)", growth_ns, ops, "row");
+    report("serialize (sized path)", sized_ns, ops, "row");
+    report("serialize rows one at a time", each_ns, ops, "row");
+    char name[48];
+    snprintf(name, sizeof(name), "serialize_batch (%zu threads)", pool.thread_count);
+    report(name, batch_ns, ops, "row");
+    msgpack_pool_free(&pool);
+}
+
+/* Small RPC-style payload: {"method": "get", "id": n, "ok": true} */
+static void bench_pack_small_maps(void) {
+    msgpack_buffer buf;
+    msgpack_buffer_init(&buf, 0);
+    double checked_ns = 0, unchecked_ns = 0;
+    for (int iter = 0; iter < BENCH_ITERATIONS; iter++) {
+        msgpack_buffer_clear(&buf);
+        double start = now_ns();
+        for (uint64_t i = 0; i < BENCH_ROWS; i++) {
+            msgpack_pack_map(&buf, 3);
+            msgpack_pack_str(&buf, "method", 6);
+            msgpack_pack_str(&buf, "get", 3);
+            msgpack_pack_str(&buf, "id", 2);
+            msgpack_pack_uint(&buf, i);
+            msgpack_pack_str(&buf, "ok", 2);
+            msgpack_pack_bool(&buf, true);
+        }
+        checked_ns += now_ns() - start;
+
+        msgpack_buffer_clear(&buf);
+        start = now_ns();
+        msgpack_writer w;
+        msgpack_writer_begin(&w, &buf, 0);
+        for (uint64_t i = 0; i < BENCH_ROWS; i++) {
+            msgpack_writer_ensure(&w, 32);
+            msgpack_pack_map_unchecked(&w, 3);
+            msgpack_pack_str_unchecked(&w, "method", 6);
+            msgpack_pack_str_unchecked(&w, "get", 3);
+            msgpack_pack_str_unchecked(&w, "id", 2);
+            msgpack_pack_uint_unchecked(&w, i);
+            msgpack_pack_str_unchecked(&w, "ok", 2);
+            msgpack_pack_bool_unchecked(&w, true);
+        }
+        msgpack_writer_end(&w);
+        unchecked_ns += now_ns() - start;
+    }
+    msgpack_buffer_free(&buf);
+    size_t ops = (size_t)BENCH_ITERATIONS * BENCH_ROWS;
+    report("pack small map (msgpack_pack_*)", checked_ns, ops, "map");
+    report("pack small map (unchecked writer)", unchecked_ns, ops, "map");
+}
+
+static int sum_uint(void *ctx, uint64_t u) {
+    *(uint64_t *)ctx += u;
+    return MSGPACK_VISIT_CONTINUE;
+}
+
+static void bench_decode(const msgpack_object *root) {
+    msgpack_serializer serializer;
+    msgpack_serializer_init(&serializer, 0);
+    msgpack_serialize_sized(&serializer, root);
+
+    double malloc_ns = 0, zone_ns = 0, compact_ns = 0, parallel_ns = 0, split_scan_ns = 0, cursor_ns = 0, parse_ns = 0, validate_ns = 0, tape_ns = 0, view_ns = 0;
+    msgpack_pool pool;
+    msgpack_pool_init(&pool, bench_threads());
+    msgpack_zone zone;
+    msgpack_zone_init(&zone, 0);
+    msgpack_tape tape;
+    msgpack_tape_init(&tape, 0);
+    for (int iter = 0; iter < BENCH_ITERATIONS; iter++) {
+        msgpack_reader reader;
+        msgpack_reader_init(&reader, serializer.buffer.data, serializer.buffer.length);
+        msgpack_object out = {0};
+        double start = now_ns();
+        msgpack_read_object(&reader, &out);
+        msgpack_object_free(&out);
+        malloc_ns += now_ns() - start;
+
+        msgpack_reader_init(&reader, serializer.buffer.data, serializer.buffer.length);
+        msgpack_reader_set_zone(&reader, &zone);
+        start = now_ns();
+        msgpack_read_object(&reader, &out);
+        msgpack_zone_reset(&zone);
+        zone_ns += now_ns() - start;
+
+        msgpack_reader_init(&reader, serializer.buffer.data, serializer.buffer.length);
+        start = now_ns();
+        msgpack_read_object_compact(&reader, &out);
+        msgpack_object_free_compact(&out, NULL);
+        compact_ns += now_ns() - start;
+
+        msgpack_reader_init(&reader, serializer.buffer.data, serializer.buffer.length);
+        start = now_ns();
+        msgpack_read_object_parallel(&reader, &out, &pool);
+        msgpack_object_free_compact(&out, NULL);
+        parallel_ns += now_ns() - start;
+
+        /* the serial part of the parallel decode is the flat header skip
+         * over all but the last chunk; this times it over the whole root */
+        size_t bounds[2], found;
+        start = now_ns();
+        msgpack_scan_boundaries(serializer.buffer.data, serializer.buffer.length, bounds, 2, &found);
+        split_scan_ns += now_ns() - start;
+
+        msgpack_reader_init(&reader, serializer.buffer.data, serializer.buffer.length);
+        start = now_ns();
+        msgpack_token token;
+        uint64_t sum = 0;
+        while (msgpack_cursor_next(&reader, &token) == 0) {
+            if (token.type == MSGPACK_TYPE_UINT64 || token.type <= MSGPACK_TYPE_UINT32) sum += token.as.u;
+        }
+        cursor_ns += now_ns() - start;
+        if (sum == 0) printf("cursor visited nothing\n");
+
+        msgpack_reader_init(&reader, serializer.buffer.data, serializer.buffer.length);
+        msgpack_visitor visitor = {.on_uint = sum_uint};
+        sum = 0;
+        start = now_ns();
+        msgpack_parse(&reader, &visitor, &sum);
+        parse_ns += now_ns() - start;
+        if (sum == 0) printf("parse visited nothing\n");
+
+        start = now_ns();
+        if (msgpack_validate(serializer.buffer.data, serializer.buffer.length, NULL) != 0) printf("validate failed\n");
+        validate_ns += now_ns() - start;
+
+        msgpack_reader_init(&reader, serializer.buffer.data, serializer.buffer.length);
+        start = now_ns();
+        size_t row, score;
+        if (msgpack_tape_build(&tape, &reader) != 0 || msgpack_tape_array_at(&tape, 0, BENCH_ROWS - 1, &row) != 0 ||
+            msgpack_tape_map_find(&tape, row, "score", 5, &score) != 0) printf("tape lookup failed\n");
+        tape_ns += now_ns() - start;
+
+        char path[32];
+        snprintf(path, sizeof(path), "[%d].score", BENCH_ROWS - 1);
+        msgpack_view view;
+        msgpack_view_init(&view, serializer.buffer.data, serializer.buffer.length);
+        double score_value;
+        start = now_ns();
+        if (msgpack_view_get_float(&view, path, &score_value) != 0) printf("view lookup failed\n");
+        view_ns += now_ns() - start;
+    }
+    msgpack_tape_free(&tape);
+    msgpack_zone_free(&zone);
+    msgpack_serializer_free(&serializer);
+    size_t ops = (size_t)BENCH_ITERATIONS * root->as.array.size;
+    report("decode + free (malloc)", malloc_ns, ops, "row");
+    report("decode + reset (zone)", zone_ns, ops, "row");
+    report("decode + free (two-pass compact)", compact_ns, ops, "row");
+    char name[48];
+    snprintf(name, sizeof(name), "decode + free (parallel, %zu threads)", pool.thread_count);
+    report(name, parallel_ns, ops, "row");
+    report("parallel split scan (whole root)", split_scan_ns, ops, "row");
+    double threads = (double)pool.thread_count;
+    printf("  parallel vs two-pass compact: %.2fx, split scan included; at most %.0f%% of it is the serial scan\n",
+           compact_ns / parallel_ns, pool.thread_count > 1 ? 100.0 * split_scan_ns * (threads - 1) / threads / parallel_ns : 0.0);
+    msgpack_pool_free(&pool);
+    report("pull cursor (no tree)", cursor_ns, ops, "row");
+    report("visitor parse (no tree)", parse_ns, ops, "row");
+    report("validate (no tree)", validate_ns, ops, "row");
+    report("tape build + last-row lookup", tape_ns, ops, "row");
+    report("view last-row lookup", view_ns, ops, "row");
+}
+
+/* One array of mixed scalars, so the cost is dominated by header
+ * dispatch rather than allocation. */
+static void bench_decode_values(void) {
+    const size_t count = 1000000;
+    msgpack_buffer buf;
+    msgpack_buffer_init(&buf, 0);
+    msgpack_pack_array(&buf, (uint32_t)count);
+    const uint8_t blob[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    for (size_t i = 0; i < count; i++) {
+        switch (i % 10) {
+            case 0: msgpack_pack_uint(&buf, i % 100); break;
+            case 1: msgpack_pack_uint(&buf, 1000 + i); break;
+            case 2: msgpack_pack_int(&buf, -(int64_t)(i % 30)); break;
+            case 3: msgpack_pack_int(&buf, -100000 - (int64_t)i); break;
+            case 4: msgpack_pack_float(&buf, (double)i * 0.25); break;
+            case 5: msgpack_pack_str(&buf, "short", 5); break;
+            case 6: msgpack_pack_str(&buf, "a string that needs a str8 header", 33); break;
+            case 7: msgpack_pack_bin(&buf, blob, sizeof(blob)); break;
+            case 8: msgpack_pack_bool(&buf, i & 1); break;
+            default: msgpack_pack_timestamp(&buf, 1700000000 + (int64_t)i, 0); break;
+        }
+    }
+    double cursor_ns = 0, tree_ns = 0;
+    msgpack_zone zone;
+    msgpack_zone_init(&zone, 0);
+    for (int iter = 0; iter < BENCH_ITERATIONS; iter++) {
+        msgpack_reader reader;
+        msgpack_reader_init(&reader, buf.data, buf.length);
+        msgpack_token token;
+        size_t seen = 0;
+        double start = now_ns();
+        while (msgpack_cursor_next(&reader, &token) == 0) {
+            seen++;
+        }
+        cursor_ns += now_ns() - start;
+        if (seen != count + 1) printf("cursor stopped early\n");
+
+        msgpack_reader_init(&reader, buf.data, buf.length);
+        msgpack_reader_set_zone(&reader, &zone);
+        msgpack_object out;
+        start = now_ns();
+        if (msgpack_read_object(&reader, &out) != 0) printf("decode failed\n");
+        msgpack_zone_reset(&zone);
+        tree_ns += now_ns() - start;
+    }
+    msgpack_zone_free(&zone);
+    msgpack_buffer_free(&buf);
+    size_t ops = (size_t)BENCH_ITERATIONS * count;
+    report("header dispatch, mixed scalars (cursor)", cursor_ns, ops, "value");
+    report("decode mixed scalars (zone)", tree_ns, ops, "value");
+}
+
+/* Metrics-style numeric arrays: nanosecond timestamps (9-byte uint64) and
+ * doubles, element by element versus the typed-array calls at the scalar
+ * and the best detected kernel level. */
+static void bench_typed_arrays(void) {
+    const size_t count = 1000000;
+    int64_t *ints = malloc(count * sizeof(*ints));
+    double *doubles = malloc(count * sizeof(*doubles));
+    for (size_t i = 0; i < count; i++) {
+        ints[i] = 1700000000000000000LL + (int64_t)i * 1000;
+        doubles[i] = (double)i * 0.1;
+    }
+    msgpack_buffer buf;
+    msgpack_buffer_init(&buf, 0);
+    const unsigned levels[2] = {0, ~0u};
+    double ints_ns[3] = {0}, doubles_ns[3] = {0}, read_ns[3] = {0};
+    msgpack_zone zone;
+    msgpack_zone_init(&zone, 0);
+    for (int iter = 0; iter < BENCH_ITERATIONS; iter++) {
+        msgpack_buffer_clear(&buf);
+        double start = now_ns();
+        msgpack_pack_array(&buf, (uint32_t)count);
+        for (size_t i = 0; i < count; i++) {
+            msgpack_pack_int(&buf, ints[i]);
+        }
+        ints_ns[0] += now_ns() - start;
+
+        msgpack_buffer_clear(&buf);
+        start = now_ns();
+        msgpack_pack_array(&buf, (uint32_t)count);
+        for (size_t i = 0; i < count; i++) {
+            msgpack_pack_float(&buf, doubles[i]);
+        }
+        doubles_ns[0] += now_ns() - start;
+
+        msgpack_reader reader;
+        msgpack_reader_init(&reader, buf.data, buf.length);
+        msgpack_reader_set_zone(&reader, &zone);
+        msgpack_object out;
+        start = now_ns();
+        if (msgpack_read_object(&reader, &out) != 0) printf("decode failed\n");
+        msgpack_zone_reset(&zone);
+        read_ns[0] += now_ns() - start;
+
+        for (int l = 0; l < 2; l++) {
+            msgpack_cpu_set_features(levels[l]);
+            msgpack_buffer_clear(&buf);
+            start = now_ns();
+            msgpack_pack_int64_array(&buf, ints, count);
+            ints_ns[l + 1] += now_ns() - start;
+
+            msgpack_buffer_clear(&buf);
+            start = now_ns();
+            msgpack_pack_double_array(&buf, doubles, count);
+            doubles_ns[l + 1] += now_ns() - start;
+
+            size_t n;
+            msgpack_reader_init(&reader, buf.data, buf.length);
+            start = now_ns();
+            if (msgpack_read_double_array(&reader, doubles, count, &n) != 0) printf("typed read failed\n");
+            read_ns[l + 1] += now_ns() - start;
+        }
+    }
+    msgpack_cpu_set_features(~0u);
+    msgpack_zone_free(&zone);
+    msgpack_buffer_free(&buf);
+    free(doubles);
+    free(ints);
+    size_t ops = (size_t)BENCH_ITERATIONS * count;
+    char name[64];
+    report("pack int64, pack_int per element", ints_ns[0], ops, "value");
+    report("pack_int64_array (scalar kernels)", ints_ns[1], ops, "value");
+    snprintf(name, sizeof(name), "pack_int64_array (cpu features 0x%x)", msgpack_cpu_features());
+    report(name, ints_ns[2], ops, "value");
+    report("pack doubles, pack_float per element", doubles_ns[0], ops, "value");
+    report("pack_double_array (scalar kernels)", doubles_ns[1], ops, "value");
+    snprintf(name, sizeof(name), "pack_double_array (cpu features 0x%x)", msgpack_cpu_features());
+    report(name, doubles_ns[2], ops, "value");
+    report("read doubles as object tree (zone)", read_ns[0], ops, "value");
+    report("read_double_array (scalar kernels)", read_ns[1], ops, "value");
+    snprintf(name, sizeof(name), "read_double_array (cpu features 0x%x)", msgpack_cpu_features());
+    report(name, read_ns[2], ops, "value");
+}
+
+/* Rows as a stream of separate messages: decoded whole, projected to "id",
+ * and filtered down to 1% of rows. */
+static void bench_message_stream(const msgpack_object *root) {
+    msgpack_serializer serializer;
+    msgpack_serializer_init(&serializer, 0);
+    msgpack_buffer stream;
+    msgpack_buffer_init(&stream, 0);
+    for (uint32_t i = 0; i < root->as.array.size; i++) {
+        msgpack_serialize(&serializer, &root->as.array.ptr[i]);
+        msgpack_buffer_append(&stream, serializer.buffer.data, serializer.buffer.length);
+    }
+    const char *paths[] = {"id"};
+    msgpack_projection proj;
+    msgpack_projection_compile(&proj, paths, 1);
+
+    msgpack_predicate rare = {.path = "id", .op = MSGPACK_PREDICATE_LT, .value = {.type = MSGPACK_TYPE_UINT64, .as.u = BENCH_ROWS / 100}};
+    msgpack_filter filter;
+    msgpack_filter_compile(&filter, &rare, 1);
+
+    double full_ns = 0, projected_ns = 0, filtered_ns = 0, unpacker_ns = 0, batch_ns = 0, batch_zone_ns = 0, scan_ns = 0;
+    size_t *offsets = malloc((root->as.array.size + 1) * sizeof(size_t));
+    for (int iter = 0; iter < BENCH_ITERATIONS; iter++) {
+        msgpack_reader reader;
+        msgpack_object out;
+        msgpack_reader_init(&reader, stream.data, stream.length);
+        double start = now_ns();
+        while (msgpack_reader_remaining(&reader) > 0 && msgpack_read_object(&reader, &out) == 0) {
+            msgpack_object_free(&out);
+        }
+        full_ns += now_ns() - start;
+
+        msgpack_reader_init(&reader, stream.data, stream.length);
+        start = now_ns();
+        while (msgpack_reader_remaining(&reader) > 0 && msgpack_read_projected(&reader, &proj, &out) == 0) {
+            msgpack_object_free(&out);
+        }
+        projected_ns += now_ns() - start;
+
+        msgpack_reader_init(&reader, stream.data, stream.length);
+        start = now_ns();
+        while (msgpack_read_filtered(&reader, &filter, &out) == 0) {
+            msgpack_object_free(&out);
+        }
+        filtered_ns += now_ns() - start;
+
+        /* the same stream arriving in MTU-sized chunks */
+        msgpack_unpacker unpacker;
+        msgpack_unpacker_init(&unpacker, 0);
+        start = now_ns();
+        for (size_t off = 0; off < stream.length; off += 1500) {
+            size_t chunk = stream.length - off < 1500 ? stream.length - off : 1500;
+            msgpack_unpacker_feed(&unpacker, stream.data + off, chunk);
+            while (msgpack_unpacker_next(&unpacker, &out) == 0) {
+                msgpack_object_free(&out);
+            }
+        }
+        unpacker_ns += now_ns() - start;
+        msgpack_unpacker_free(&unpacker);
+
+        msgpack_object batch[256];
+        size_t count;
+        msgpack_reader_init(&reader, stream.data, stream.length);
+        start = now_ns();
+        while (msgpack_read_many(&reader, batch, 256, &count) == 0) {
+            msgpack_object_free_many(batch, count, NULL);
+        }
+        batch_ns += now_ns() - start;
+
+        msgpack_zone zone;
+        msgpack_zone_init(&zone, 0);
+        msgpack_reader_init(&reader, stream.data, stream.length);
+        msgpack_reader_set_zone(&reader, &zone);
+        start = now_ns();
+        while (msgpack_read_many(&reader, batch, 256, &count) == 0) {
+            msgpack_zone_reset(&zone);
+        }
+        batch_zone_ns += now_ns() - start;
+        msgpack_zone_free(&zone);
+
+        size_t found;
+        start = now_ns();
+        msgpack_scan_boundaries(stream.data, stream.length, offsets, root->as.array.size + 1, &found);
+        scan_ns += now_ns() - start;
+    }
+    free(offsets);
+    msgpack_filter_free(&filter);
+    msgpack_projection_free(&proj);
+    msgpack_buffer_free(&stream);
+    msgpack_serializer_free(&serializer);
+    size_t ops = (size_t)BENCH_ITERATIONS * root->as.array.size;
+    report("per-message decode + free (full)", full_ns, ops, "msg");
+    report("per-message decode + free (projected)", projected_ns, ops, "msg");
+    report("per-message filter, decode 1% matches", filtered_ns, ops, "msg");
+    report("unpacker, 1500-byte chunks", unpacker_ns, ops, "msg");
+    report("read_many, batches of 256", batch_ns, ops, "msg");
+    report("read_many, batches of 256 (zone)", batch_zone_ns, ops, "msg");
+    report("scan_boundaries, offsets only", scan_ns, ops, "msg");
+}
+
+/* Zone decode of an array of text strings (mostly ASCII, some accented and
+ * CJK), with UTF-8 validation off, on with the scalar validator and on
+ * with the detected vector level. */
+static void bench_utf8_validation(void) {
+    const size_t count = 100000;
+    const char *samples[] = {
+        "GET /api/v2/users/profile?include=settings HTTP/1.1",
+        "Caf\xC3\xA9 cr\xC3\xA8me br\xC3\xBBl\xC3\xA9" "e, na\xC3\xAFve fa\xC3\xA7" "ade",
+        "\xE6\x9D\xB1\xE4\xBA\xAC\xE9\x83\xBD\xE6\xB8\x8B\xE8\xB0\xB7\xE5\x8C\xBA shibuya-ku, tokyo 150-0002",
+        "the quick brown fox jumps over the lazy dog, again and again",
+    };
+    msgpack_buffer buf;
+    msgpack_buffer_init(&buf, 0);
+    msgpack_pack_array(&buf, (uint32_t)count);
+    for (size_t i = 0; i < count; i++) {
+        const char *str = samples[i % 4];
+        msgpack_pack_str(&buf, str, strlen(str));
+    }
+    msgpack_zone zone;
+    msgpack_zone_init(&zone, 0);
+    double ns[3] = {0};
+    for (int iter = 0; iter < BENCH_ITERATIONS; iter++) {
+        for (int mode = 0; mode < 3; mode++) {
+            msgpack_cpu_set_features(mode == 1 ? 0 : ~0u);
+            msgpack_reader reader;
+            msgpack_reader_init(&reader, buf.data, buf.length);
+            msgpack_reader_set_zone(&reader, &zone);
+            msgpack_reader_set_validate_utf8(&reader, mode != 0);
+            msgpack_object out;
+            double start = now_ns();
+            if (msgpack_read_object(&reader, &out) != 0) printf("decode failed\n");
+            msgpack_zone_reset(&zone);
+            ns[mode] += now_ns() - start;
+        }
+    }
+    msgpack_cpu_set_features(~0u);
+    msgpack_zone_free(&zone);
+    msgpack_buffer_free(&buf);
+    size_t ops = (size_t)BENCH_ITERATIONS * count;
+    char name[64];
+    report("read strings (zone), no UTF-8 check", ns[0], ops, "str");
+    report("read strings (zone), UTF-8 scalar", ns[1], ops, "str");
+    snprintf(name, sizeof(name), "read strings (zone), UTF-8 features 0x%x", msgpack_cpu_features());
+    report(name, ns[2], ops, "str");
+}
+
+int main(void) {
+    printf("=== msgpack-c Benchmarks ===\n\n");
+
+    msgpack_object rows = make_rows(BENCH_ROWS);
+    bench_serialize(&rows);
+    bench_decode(&rows);
+    bench_decode_values();
+    bench_typed_arrays();
+    bench_utf8_validation();
+    bench_message_stream(&rows);
+    free_rows(&rows);
+    bench_pack_small_maps();
+
+    return 0;
+}
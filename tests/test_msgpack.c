@@ -2,6 +2,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/uio.h>
+#endif
 
 static int tests_passed = 0;
 static int tests_failed = 0;
@@ -387,10 +390,128 @@ int test_timestamp(void) {
     if (ret != 0) return ret;
     if (out.type != MSGPACK_TYPE_TIMESTAMP) return -1;
     
+    /* timestamp64 is 30 bits of nanoseconds above 34 bits of seconds, from
+     * both encoders; a 34-bit seconds value decodes whole */
+    const uint8_t ts64[] = {0xD7, 0xFF, 0x00, 0x00, 0x07, 0xD0, 0x65, 0x92, 0x00, 0x80};
+    const uint8_t ts64_max[] = {0xD7, 0xFF, 0xEE, 0x6B, 0x27, 0xFC, 0xFF, 0xFF, 0xFF, 0xFF};
+    msgpack_buffer buf;
+    msgpack_buffer_init(&buf, 0);
+    msgpack_pack_timestamp(&buf, 1704067200, 500);
+    msgpack_pack_timestamp(&buf, 0xFFFFFFFFLL, 999999999);
+    msgpack_writer w;
+    if (msgpack_writer_begin(&w, &buf, 2 * MSGPACK_WRITER_MAX_SCALAR) != 0) return -1;
+    msgpack_pack_timestamp_unchecked(&w, 1704067200, 500);
+    msgpack_pack_timestamp_unchecked(&w, 0xFFFFFFFFLL, 999999999);
+    msgpack_writer_end(&w);
+    if (buf.length != 40) return -1;
+    for (size_t i = 0; i < 40; i += 20) {
+        if (memcmp(buf.data + i, ts64, 10) != 0 || memcmp(buf.data + i + 10, ts64_max, 10) != 0) return -1;
+    }
+    const uint8_t ts64_wide[] = {0xD7, 0xFF, 0x00, 0x00, 0x00, 0x03, 0xFF, 0xFF, 0xFF, 0xFF};
+    msgpack_reader_init(&reader, ts64_wide, sizeof(ts64_wide));
+    if (msgpack_read_object(&reader, &out) != 0 || out.as.timestamp != 0x3FFFFFFFFLL) return -1;
+    
+    /* seconds in [2^32, 2^34) stay in timestamp64 and round-trip; 2^34
+     * moves to timestamp96 */
+    const int64_t wide[] = {0x100000000LL, 0x2DEADBEEFLL, 0x3FFFFFFFFLL, 0x400000000LL};
+    for (size_t i = 0; i < 4; i++) {
+        msgpack_buffer_clear(&buf);
+        if (msgpack_pack_timestamp(&buf, wide[i], 999999999) != 0) return -1;
+        if (msgpack_writer_begin(&w, &buf, MSGPACK_WRITER_MAX_SCALAR) != 0) return -1;
+        if (msgpack_pack_timestamp_unchecked(&w, wide[i], 999999999) != 0) return -1;
+        msgpack_writer_end(&w);
+        size_t size = i < 3 ? 10 : 15;
+        if (buf.length != 2 * size || memcmp(buf.data, buf.data + size, size) != 0) return -1;
+        if (buf.data[0] != (i < 3 ? 0xD7 : 0xC7)) return -1;
+        msgpack_reader_init(&reader, buf.data, buf.length);
+        if (msgpack_read_object(&reader, &out) != 0 || out.type != MSGPACK_TYPE_TIMESTAMP || out.as.timestamp != wide[i]) return -1;
+    }
+    
+    /* a second or more of nanoseconds is rejected by both encoders before
+     * anything is written */
+    msgpack_buffer_clear(&buf);
+    if (msgpack_pack_timestamp(&buf, 1, 1000000000) == 0 || msgpack_pack_timestamp(&buf, 0x100000000LL, UINT32_MAX) == 0) return -1;
+    if (msgpack_pack_timestamp(&buf, -1, 1000000000) == 0 || buf.length != 0) return -1;
+    if (msgpack_writer_begin(&w, &buf, MSGPACK_WRITER_MAX_SCALAR) != 0) return -1;
+    if (msgpack_pack_timestamp_unchecked(&w, 1, 1u << 30) == 0 || w.ptr != buf.data) return -1;
+    msgpack_writer_end(&w);
+    if (buf.length != 0) return -1;
+    msgpack_buffer_free(&buf);
+    
     msgpack_serializer_free(&serializer);
     return 0;
 }
 
+int test_ext_formats(void) {
+    /* fixext with a user type stays an ext; type -1 with 4, 8 or 12 bytes is a timestamp */
+    const uint8_t fixext4[] = {0xD6, 0x05, 1, 2, 3, 4};
+    const uint8_t fixext8[] = {0xD7, 0x05, 1, 2, 3, 4, 5, 6, 7, 8};
+    const uint8_t ts96[] = {0xC7, 12, 0xFF, 0, 0, 0, 0, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFE};
+    msgpack_reader reader;
+    msgpack_object out;
+    msgpack_reader_init(&reader, fixext4, sizeof(fixext4));
+    if (msgpack_read_object(&reader, &out) != 0 || out.type != MSGPACK_TYPE_FIXEXT4) return -1;
+    if (out.as.ext.type != 5 || out.as.ext.size != 4 || out.as.ext.ptr != fixext4 + 2) return -1;
+    msgpack_reader_init(&reader, fixext8, sizeof(fixext8));
+    if (msgpack_read_object(&reader, &out) != 0 || out.type != MSGPACK_TYPE_FIXEXT8) return -1;
+    if (out.as.ext.size != 8 || msgpack_reader_remaining(&reader) != 0) return -1;
+    msgpack_reader_init(&reader, ts96, sizeof(ts96));
+    if (msgpack_read_object(&reader, &out) != 0 || out.type != MSGPACK_TYPE_TIMESTAMP) return -1;
+    if (out.as.timestamp != -2) return -1;
+    
+    /* every fixext width: payload size, decoded type, and timestamps only
+     * for type -1 at the 4 and 8-byte widths */
+    uint8_t fixext[18] = {0};
+    const uint8_t sizes[] = {1, 2, 4, 8, 16};
+    for (uint8_t b = 0xD4; b <= 0xD8; b++) {
+        size_t size = msgpack_fixext_size(b);
+        if (size != sizes[b - 0xD4]) return -1;
+        for (int type = -1; type <= 5; type += 6) {
+            fixext[0] = b;
+            fixext[1] = (uint8_t)type;
+            msgpack_reader_init(&reader, fixext, 2 + size);
+            if (msgpack_read_object(&reader, &out) != 0 || msgpack_reader_remaining(&reader) != 0) return -1;
+            if (type == -1 && (b == 0xD6 || b == 0xD7)) {
+                if (out.type != MSGPACK_TYPE_TIMESTAMP) return -1;
+                continue;
+            }
+            if (out.type != (msgpack_type)(MSGPACK_TYPE_FIXEXT1 + (b - 0xD4))) return -1;
+            if (out.as.ext.type != type || out.as.ext.size != size || out.as.ext.ptr != fixext + 2) return -1;
+        }
+    }
+
+    msgpack_buffer buf;
+    msgpack_buffer_init(&buf, 0);
+    msgpack_pack_timestamp(&buf, 1704067200, 1);
+    msgpack_pack_timestamp(&buf, 1704067200, 0);
+    msgpack_pack_timestamp(&buf, -1, 0);
+    if (buf.data[0] != 0xD7 || buf.data[2] != 0 || buf.data[5] != 4) return -1;
+    int64_t expected[] = {1704067200, 1704067200, -1};
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    for (size_t i = 0; i < 3; i++) {
+        if (msgpack_read_object(&reader, &out) != 0 || out.type != MSGPACK_TYPE_TIMESTAMP) return -1;
+        if (out.as.timestamp != expected[i]) return -1;
+    }
+    msgpack_buffer_free(&buf);
+
+    /* every lead byte: the header decoder and the skipper agree on validity and length */
+    uint8_t bytes[48] = {0};
+    for (int b = 0; b < 256; b++) {
+        bytes[0] = (uint8_t)b;
+        msgpack_token token;
+        msgpack_reader_init(&reader, bytes, sizeof(bytes));
+        int decoded = msgpack_cursor_next(&reader, &token);
+        size_t header_end = reader.position;
+        msgpack_reader_init(&reader, bytes, sizeof(bytes));
+        int skipped = msgpack_skip_object(&reader);
+        if ((decoded == 0) != (skipped == 0)) return -1;
+        bool container = token.type >= MSGPACK_TYPE_FIXARRAY && token.type <= MSGPACK_TYPE_MAP32;
+        if (decoded == 0 && !container && header_end != reader.position) return -1;
+        if (decoded == 0 && container && header_end > reader.position) return -1;
+    }
+    return 0;
+}
+
 int test_nested(void) {
     msgpack_serializer serializer;
     msgpack_serializer_init(&serializer, 256);
@@ -431,6 +552,1794 @@ int test_nested(void) {
     return 0;
 }
 
+int test_buffer_growth(void) {
+    msgpack_buffer buf;
+    if (msgpack_buffer_init(&buf, 16) != 0) return -1;
+    if (msgpack_buffer_set_growth(&buf, 1.0, 0) == 0) return -1;
+    if (msgpack_buffer_set_growth(&buf, 2.0, 4096) != 0) return -1;
+    
+    size_t reallocs = 0;
+    size_t last_capacity = buf.capacity;
+    for (int i = 0; i < 100000; i++) {
+        if (msgpack_pack_int(&buf, i) != 0) return -1;
+        if (buf.capacity != last_capacity) {
+            if (buf.capacity - last_capacity > 4096 && last_capacity > 4096) return -1;
+            last_capacity = buf.capacity;
+            reallocs++;
+        }
+    }
+    if (reallocs > 200) return -1;
+    
+    msgpack_reader reader;
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    for (int i = 0; i < 100000; i++) {
+        msgpack_object out = {0};
+        if (msgpack_read_object(&reader, &out) != 0) return -1;
+        if (out.as.i != i) return -1;
+    }
+    
+    msgpack_buffer_clear(&buf);
+    if (msgpack_buffer_shrink_to_fit(&buf) != 0) return -1;
+    if (buf.capacity != 1) return -1;
+    if (msgpack_buffer_reserve(&buf, 1000) != 0) return -1;
+    if (buf.capacity != 1000) return -1;
+    uint8_t *data = buf.data;
+    for (int i = 0; i < 1000; i++) {
+        if (msgpack_pack_nil(&buf) != 0) return -1;
+    }
+    if (buf.data != data || buf.capacity != 1000) return -1;
+    
+    msgpack_buffer_free(&buf);
+    return 0;
+}
+
+int test_packed_size(void) {
+    static char payload[70000];
+    static uint8_t ext_data[300];
+    memset(payload, 'p', sizeof(payload));
+    
+    uint64_t uints[] = {0, 127, 128, 255, 256, 65535, 65536, 0xFFFFFFFFULL, 0x100000000ULL};
+    int64_t ints[] = {-1, -32, -33, -128, -129, -32768, -32769, -2147483648LL, -2147483649LL};
+    double floats[] = {1.5, 3.14159265358979};
+    size_t lens[] = {0, 31, 32, 255, 256, 65535, 65536};
+    size_t ext_lens[] = {1, 2, 3, 4, 8, 16, 17, 256};
+    int64_t timestamps[] = {0, 1704067200, 0x100000000LL, -1};
+    
+    size_t n = 0;
+    msgpack_object items[64];
+    for (size_t i = 0; i < sizeof(uints) / sizeof(uints[0]); i++) {
+        items[n++] = (msgpack_object){.type = MSGPACK_TYPE_UINT64, .as.u = uints[i]};
+    }
+    for (size_t i = 0; i < sizeof(ints) / sizeof(ints[0]); i++) {
+        items[n++] = (msgpack_object){.type = MSGPACK_TYPE_INT64, .as.i = ints[i]};
+    }
+    for (size_t i = 0; i < sizeof(floats) / sizeof(floats[0]); i++) {
+        items[n++] = (msgpack_object){.type = MSGPACK_TYPE_FLOAT64, .as.f = floats[i]};
+    }
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        items[n++] = (msgpack_object){.type = MSGPACK_TYPE_STR, .as.str.ptr = payload, .as.str.size = (uint32_t)lens[i]};
+        items[n++] = (msgpack_object){.type = MSGPACK_TYPE_BIN8, .as.bin.ptr = (const uint8_t *)payload, .as.bin.size = (uint32_t)lens[i]};
+    }
+    for (size_t i = 0; i < sizeof(ext_lens) / sizeof(ext_lens[0]); i++) {
+        items[n++] = (msgpack_object){.type = MSGPACK_TYPE_EXT8, .as.ext.type = 5, .as.ext.ptr = ext_data, .as.ext.size = (uint32_t)ext_lens[i]};
+    }
+    for (size_t i = 0; i < sizeof(timestamps) / sizeof(timestamps[0]); i++) {
+        items[n++] = (msgpack_object){.type = MSGPACK_TYPE_TIMESTAMP, .as.timestamp = timestamps[i]};
+    }
+    items[n++] = (msgpack_object){.type = MSGPACK_TYPE_NIL};
+    items[n++] = (msgpack_object){.type = MSGPACK_TYPE_BOOL, .as.b = true};
+    
+    msgpack_object_kv kv = {
+        .key = {.type = MSGPACK_TYPE_STR, .as.str.ptr = "items", .as.str.size = 5},
+        .value = {.type = MSGPACK_TYPE_ARRAY, .as.array.ptr = items, .as.array.size = (uint32_t)n},
+    };
+    msgpack_object root = {.type = MSGPACK_TYPE_MAP, .as.map.ptr = &kv, .as.map.size = 1};
+    
+    msgpack_serializer serializer;
+    msgpack_serializer_init(&serializer, 64);
+    for (size_t i = 0; i < n; i++) {
+        size_t size;
+        if (msgpack_object_packed_size(&items[i], &size) != 0) return -1;
+        if (msgpack_serialize(&serializer, &items[i]) != 0) return -1;
+        if (size != serializer.buffer.length) return -1;
+    }
+    
+    size_t size;
+    if (msgpack_object_packed_size(&root, &size) != 0) return -1;
+    msgpack_serializer_free(&serializer);
+    msgpack_serializer_init(&serializer, 16);
+    if (msgpack_serialize_sized(&serializer, &root) != 0) return -1;
+    if (serializer.buffer.length != size || serializer.buffer.capacity != size) return -1;
+    
+    msgpack_object bad = {.type = (msgpack_type)0x7F};
+    if (msgpack_object_packed_size(&bad, &size) == 0) return -1;
+    
+    msgpack_serializer_free(&serializer);
+    return 0;
+}
+
+int test_writer_unchecked(void) {
+    static uint8_t payload[70000];
+    memset(payload, 0x5A, sizeof(payload));
+    uint64_t uints[] = {0, 127, 128, 255, 256, 65535, 65536, 0xFFFFFFFFULL, 0x100000000ULL, UINT64_MAX};
+    int64_t ints[] = {-1, -32, -33, -128, -129, -32768, -32769, -2147483648LL, -2147483649LL, INT64_MIN};
+    size_t lens[] = {0, 1, 2, 4, 8, 16, 31, 32, 255, 256, 65535, 65536};
+    int64_t timestamps[] = {0, 1704067200, 0x100000000LL, -1};
+    
+    msgpack_buffer checked, unchecked;
+    msgpack_buffer_init(&checked, 0);
+    msgpack_buffer_init(&unchecked, 8);
+    msgpack_writer w;
+    if (msgpack_writer_begin(&w, &unchecked, 4) != 0) return -1;
+    
+    for (size_t i = 0; i < sizeof(uints) / sizeof(uints[0]); i++) {
+        msgpack_pack_uint(&checked, uints[i]);
+        msgpack_pack_int(&checked, ints[i]);
+        msgpack_pack_float(&checked, (double)ints[i] / 3.0);
+        if (msgpack_writer_ensure(&w, 3 * MSGPACK_WRITER_MAX_SCALAR) != 0) return -1;
+        msgpack_pack_uint_unchecked(&w, uints[i]);
+        msgpack_pack_int_unchecked(&w, ints[i]);
+        msgpack_pack_float_unchecked(&w, (double)ints[i] / 3.0);
+    }
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        uint32_t n = (uint32_t)lens[i];
+        msgpack_pack_array(&checked, n);
+        msgpack_pack_map(&checked, n);
+        msgpack_pack_str(&checked, (const char *)payload, n);
+        msgpack_pack_bin(&checked, payload, n);
+        msgpack_pack_ext(&checked, 7, payload, n);
+        if (msgpack_writer_ensure(&w, 5 * MSGPACK_WRITER_MAX_SCALAR + 3 * n) != 0) return -1;
+        msgpack_pack_array_unchecked(&w, n);
+        msgpack_pack_map_unchecked(&w, n);
+        msgpack_pack_str_unchecked(&w, (const char *)payload, n);
+        msgpack_pack_bin_unchecked(&w, payload, n);
+        msgpack_pack_ext_unchecked(&w, 7, payload, n);
+    }
+    for (size_t i = 0; i < sizeof(timestamps) / sizeof(timestamps[0]); i++) {
+        msgpack_pack_timestamp(&checked, timestamps[i], 0);
+        msgpack_pack_timestamp(&checked, timestamps[i], 500);
+        msgpack_pack_nil(&checked);
+        msgpack_pack_bool(&checked, i & 1);
+        if (msgpack_writer_ensure(&w, 32) != 0) return -1;
+        msgpack_pack_timestamp_unchecked(&w, timestamps[i], 0);
+        msgpack_pack_timestamp_unchecked(&w, timestamps[i], 500);
+        msgpack_pack_nil_unchecked(&w);
+        msgpack_pack_bool_unchecked(&w, i & 1);
+    }
+    msgpack_writer_end(&w);
+    
+    if (checked.length != unchecked.length) return -1;
+    if (memcmp(checked.data, unchecked.data, checked.length) != 0) return -1;
+    
+    /* the documented reserve covers the widest call, a timestamp96 */
+    msgpack_buffer_free(&unchecked);
+    msgpack_buffer_init(&unchecked, 1);
+    if (msgpack_writer_begin(&w, &unchecked, MSGPACK_WRITER_MAX_SCALAR) != 0) return -1;
+    if (unchecked.capacity != MSGPACK_WRITER_MAX_SCALAR) return -1;
+    msgpack_pack_timestamp_unchecked(&w, INT64_MIN, 999999999);
+    if (w.ptr > w.end) return -1;
+    msgpack_writer_end(&w);
+    if (unchecked.length != 15 || unchecked.data[0] != 0xC7 || unchecked.data[1] != 12) return -1;
+    
+    msgpack_buffer_free(&checked);
+    msgpack_buffer_free(&unchecked);
+    return 0;
+}
+
+/* With limit set, allocations past the limit-th fail. */
+typedef struct {
+    size_t live_bytes;
+    size_t allocations;
+    size_t limit;
+} tracking_heap;
+
+static void *tracking_allocate(size_t size, void *user_data) {
+    tracking_heap *heap = (tracking_heap *)user_data;
+    if (heap->limit && heap->allocations >= heap->limit) return NULL;
+    heap->live_bytes += size;
+    heap->allocations++;
+    return malloc(size);
+}
+
+static void *tracking_reallocate(void *ptr, size_t old_size, size_t new_size, void *user_data) {
+    tracking_heap *heap = (tracking_heap *)user_data;
+    if (heap->limit && heap->allocations >= heap->limit) return NULL;
+    heap->live_bytes += new_size - old_size;
+    heap->allocations++;
+    return realloc(ptr, new_size);
+}
+
+static void tracking_deallocate(void *ptr, size_t size, void *user_data) {
+    tracking_heap *heap = (tracking_heap *)user_data;
+    heap->live_bytes -= size;
+    free(ptr);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+int test_iovec_writer(void) {
+    static uint8_t blob[100000];
+    for (size_t i = 0; i < sizeof(blob); i++) blob[i] = (uint8_t)i;
+    
+    msgpack_buffer expected;
+    msgpack_buffer_init(&expected, 0);
+    /* scratch, segments and the iovec list all come from one allocator */
+    tracking_heap heap = {0};
+    msgpack_allocator allocator = {tracking_allocate, tracking_reallocate, tracking_deallocate, &heap};
+    msgpack_iovec_writer w;
+    if (msgpack_iovec_writer_init_with_allocator(&w, 1024, &allocator) != 0) return -1;
+    if (w.scratch.allocator != &allocator || heap.allocations != 1) return -1;
+    
+    for (int pass = 0; pass < 2; pass++) {
+        msgpack_buffer_clear(&expected);
+        msgpack_iovec_writer_clear(&w);
+        
+        msgpack_pack_map(&expected, 3);
+        msgpack_pack_str(&expected, "small", 5);
+        msgpack_pack_str(&expected, "tiny", 4);
+        msgpack_pack_str(&expected, "blob", 4);
+        msgpack_pack_bin(&expected, blob, sizeof(blob));
+        msgpack_pack_str(&expected, "parts", 5);
+        msgpack_pack_array(&expected, 3);
+        msgpack_pack_str(&expected, (const char *)blob, 2000);
+        msgpack_pack_ext(&expected, 3, blob, 70000);
+        msgpack_pack_int(&expected, -5);
+        
+        msgpack_pack_map(&w.scratch, 3);
+        msgpack_iovec_pack_str(&w, "small", 5);
+        msgpack_iovec_pack_str(&w, "tiny", 4);
+        msgpack_iovec_pack_str(&w, "blob", 4);
+        msgpack_iovec_pack_bin(&w, blob, sizeof(blob));
+        msgpack_iovec_pack_str(&w, "parts", 5);
+        msgpack_pack_array(&w.scratch, 3);
+        msgpack_iovec_pack_str(&w, (const char *)blob, 2000);
+        msgpack_iovec_pack_ext(&w, 3, blob, 70000);
+        msgpack_pack_int(&w.scratch, -5);
+        
+        const struct iovec *iov;
+        size_t iovcnt;
+        if (msgpack_iovec_writer_finish(&w, &iov, &iovcnt) != 0) return -1;
+        if (iovcnt != 7) return -1;
+        if (iov[1].iov_base != blob || iov[3].iov_base != blob || iov[5].iov_base != blob) return -1;
+        if (msgpack_iovec_writer_length(&w) != expected.length) return -1;
+        
+        size_t offset = 0;
+        for (size_t i = 0; i < iovcnt; i++) {
+            if (offset + iov[i].iov_len > expected.length) return -1;
+            if (memcmp(expected.data + offset, iov[i].iov_base, iov[i].iov_len) != 0) return -1;
+            offset += iov[i].iov_len;
+        }
+        if (offset != expected.length) return -1;
+    }
+    
+    msgpack_iovec_writer_free(&w);
+    if (heap.live_bytes != 0 || heap.allocations < 3) return -1;
+    msgpack_buffer_free(&expected);
+    return 0;
+}
+#endif
+
+typedef struct {
+    msgpack_buffer sink;
+    size_t calls;
+    size_t max_chunk;
+} stream_sink;
+
+static int stream_collect(const uint8_t *data, size_t len, void *user_data) {
+    stream_sink *sink = (stream_sink *)user_data;
+    sink->calls++;
+    if (len > sink->max_chunk) sink->max_chunk = len;
+    return msgpack_buffer_append(&sink->sink, data, len);
+}
+
+int test_stream_buffer(void) {
+    static char big[5000];
+    memset(big, 'b', sizeof(big));
+    
+    stream_sink sink = {0};
+    msgpack_buffer_init(&sink.sink, 0);
+    msgpack_buffer expected;
+    msgpack_buffer_init(&expected, 0);
+    tracking_heap heap = {0};
+    msgpack_allocator allocator = {tracking_allocate, tracking_reallocate, tracking_deallocate, &heap};
+    msgpack_buffer stream;
+    if (msgpack_buffer_init_stream_with_allocator(&stream, 64, NULL, &sink, &allocator) == 0) return -1;
+    if (msgpack_buffer_init_stream_with_allocator(&stream, 64, stream_collect, &sink, &allocator) != 0) return -1;
+    
+    msgpack_pack_array(&stream, 1000);
+    msgpack_pack_array(&expected, 1000);
+    for (int i = 0; i < 1000; i++) {
+        if (i == 500) {
+            msgpack_pack_str(&stream, big, sizeof(big));
+            msgpack_pack_str(&expected, big, sizeof(big));
+            continue;
+        }
+        msgpack_pack_map(&stream, 1);
+        msgpack_pack_str(&stream, "row", 3);
+        msgpack_pack_int(&stream, i * 1000);
+        msgpack_pack_map(&expected, 1);
+        msgpack_pack_str(&expected, "row", 3);
+        msgpack_pack_int(&expected, i * 1000);
+        if (stream.capacity != 64) return -1;
+    }
+    
+    msgpack_writer w;
+    if (msgpack_writer_begin(&w, &stream, 60) != 0) return -1;
+    msgpack_pack_uint_unchecked(&w, 123456789);
+    msgpack_writer_end(&w);
+    msgpack_pack_uint(&expected, 123456789);
+    if (msgpack_writer_begin(&w, &stream, 65) == 0) return -1;
+    
+    if (msgpack_buffer_flush(&stream) != 0) return -1;
+    if (stream.length != 0) return -1;
+    if (stream.flushed != expected.length) return -1;
+    if (sink.sink.length != expected.length) return -1;
+    if (memcmp(sink.sink.data, expected.data, expected.length) != 0) return -1;
+    if (sink.max_chunk != sizeof(big) || sink.calls < 100) return -1;
+    if (heap.live_bytes != 64) return -1;
+    
+    msgpack_buffer_free(&stream);
+    if (heap.live_bytes != 0) return -1;
+#if defined(__unix__) || defined(__APPLE__)
+    /* an fd buffer takes its memory from the allocator too; nothing is
+     * written to stdout without a flush */
+    if (msgpack_buffer_init_fd_with_allocator(&stream, 32, 1, &allocator) != 0) return -1;
+    if (stream.allocator != &allocator || heap.live_bytes != 32) return -1;
+    msgpack_buffer_free(&stream);
+    if (heap.live_bytes != 0) return -1;
+#endif
+    msgpack_buffer_free(&expected);
+    msgpack_buffer_free(&sink.sink);
+    return 0;
+}
+
+int test_custom_allocator(void) {
+    tracking_heap heap = {0};
+    msgpack_allocator allocator = {tracking_allocate, tracking_reallocate, tracking_deallocate, &heap};
+    
+    msgpack_buffer buf;
+    if (msgpack_buffer_init_with_allocator(&buf, 4, &allocator) != 0) return -1;
+    msgpack_pack_array(&buf, 20);
+    for (int i = 0; i < 20; i++) {
+        msgpack_pack_map(&buf, 1);
+        msgpack_pack_str(&buf, "values", 6);
+        msgpack_pack_array(&buf, 3);
+        msgpack_pack_int(&buf, i);
+        msgpack_pack_array(&buf, 0);
+        msgpack_pack_str(&buf, "x", 1);
+    }
+    if (heap.live_bytes != buf.capacity) return -1;
+    
+    size_t before = heap.allocations;
+    msgpack_reader reader;
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    msgpack_reader_set_allocator(&reader, &allocator);
+    msgpack_object out = {0};
+    if (msgpack_read_object(&reader, &out) != 0) return -1;
+    if (heap.allocations - before != 41) return -1;
+    if (out.as.array.ptr[19].as.map.ptr[0].value.as.array.ptr[0].as.i != 19) return -1;
+    msgpack_object_free_with_allocator(&out, &allocator);
+    if (heap.live_bytes != buf.capacity) return -1;
+    
+    msgpack_buffer_free(&buf);
+    if (heap.live_bytes != 0) return -1;
+    return 0;
+}
+
+int test_zone_decode(void) {
+    tracking_heap heap = {0};
+    msgpack_allocator allocator = {tracking_allocate, tracking_reallocate, tracking_deallocate, &heap};
+    msgpack_zone zone;
+    if (msgpack_zone_init_with_allocator(&zone, 256, &allocator) != 0) return -1;
+    
+    msgpack_buffer buf;
+    msgpack_buffer_init(&buf, 0);
+    for (int round = 0; round < 3; round++) {
+        msgpack_buffer_clear(&buf);
+        msgpack_pack_array(&buf, 50);
+        for (int i = 0; i < 50; i++) {
+            msgpack_pack_map(&buf, 1);
+            msgpack_pack_str(&buf, "k", 1);
+            msgpack_pack_array(&buf, 2);
+            msgpack_pack_int(&buf, i);
+            msgpack_pack_int(&buf, -i);
+        }
+        
+        size_t allocations = heap.allocations;
+        msgpack_reader reader;
+        msgpack_reader_init(&reader, buf.data, buf.length);
+        msgpack_reader_set_zone(&reader, &zone);
+        msgpack_object out = {0};
+        if (msgpack_read_object(&reader, &out) != 0) return -1;
+        if (out.as.array.size != 50) return -1;
+        if (out.as.array.ptr[49].as.map.ptr[0].value.as.array.ptr[1].as.i != -49) return -1;
+        if (((uintptr_t)out.as.array.ptr[7].as.map.ptr % sizeof(void *)) != 0) return -1;
+        if (round == 0 && heap.allocations - allocations < 2) return -1;
+        if (round > 0 && heap.allocations != allocations) return -1;
+        msgpack_zone_reset(&zone);
+    }
+    void *big = msgpack_zone_alloc(&zone, 100000);
+    if (!big) return -1;
+    memset(big, 0, 100000);
+    
+    /* if the merged chunk cannot be had, reset keeps the largest one, which
+     * then serves the next round without allocating */
+    size_t allocations = heap.allocations;
+    heap.limit = allocations;
+    msgpack_zone_reset(&zone);
+    if (heap.allocations != allocations || !zone.chunks || zone.end - zone.ptr < 100000) return -1;
+    size_t kept = heap.live_bytes;
+    if (!msgpack_zone_alloc(&zone, 100000) || heap.live_bytes != kept) return -1;
+    heap.limit = 0;
+    msgpack_zone_reset(&zone);
+    if (heap.allocations != allocations || !msgpack_zone_alloc(&zone, 100000)) return -1;
+    
+    msgpack_zone_free(&zone);
+    if (heap.live_bytes != 0) return -1;
+    msgpack_buffer_free(&buf);
+    return 0;
+}
+
+int test_32bit_lengths(void) {
+    static char payload[70000];
+    memset(payload, 'q', sizeof(payload));
+    
+    msgpack_buffer buf;
+    msgpack_buffer_init(&buf, 0);
+    msgpack_pack_array(&buf, 70000);
+    for (int i = 0; i < 70000; i++) {
+        msgpack_pack_nil(&buf);
+    }
+    msgpack_pack_str(&buf, payload, sizeof(payload));
+    msgpack_pack_bin(&buf, (const uint8_t *)payload, sizeof(payload));
+    
+    msgpack_reader reader;
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    msgpack_object out = {0};
+    if (msgpack_read_object(&reader, &out) != 0) return -1;
+    if (out.type != MSGPACK_TYPE_ARRAY32 || out.as.array.size != 70000) return -1;
+    msgpack_object_free(&out);
+    if (msgpack_read_object(&reader, &out) != 0) return -1;
+    if (out.type != MSGPACK_TYPE_STR32 || out.as.str.size != sizeof(payload)) return -1;
+    if (msgpack_read_object(&reader, &out) != 0) return -1;
+    if (out.type != MSGPACK_TYPE_BIN32 || out.as.bin.size != sizeof(payload)) return -1;
+    if (reader.position != buf.length) return -1;
+    
+    /* 8-bit lengths decode exactly into an object full of stale bytes */
+    uint8_t small[2 + 200];
+    memcpy(small + 2, payload, 200);
+    const uint8_t leads[] = {0xD9, 0xC4};
+    const size_t sizes[] = {0, 31, 200};
+    for (size_t l = 0; l < 2; l++) {
+        for (size_t i = 0; i < 3; i++) {
+            small[0] = leads[l];
+            small[1] = (uint8_t)sizes[i];
+            memset(&out, 0xA5, sizeof(out));
+            msgpack_reader_init(&reader, small, 2 + sizes[i]);
+            if (msgpack_read_object(&reader, &out) != 0 || msgpack_reader_remaining(&reader) != 0) return -1;
+            if (l == 0 && (out.type != MSGPACK_TYPE_STR8 || out.as.str.size != sizes[i] || out.as.str.ptr != (const char *)small + 2)) return -1;
+            if (l == 1 && (out.type != MSGPACK_TYPE_BIN8 || out.as.bin.size != sizes[i] || out.as.bin.ptr != small + 2)) return -1;
+        }
+    }
+    
+    msgpack_buffer_free(&buf);
+    return 0;
+}
+
+int test_compact_decode(void) {
+    tracking_heap heap = {0};
+    msgpack_allocator allocator = {tracking_allocate, tracking_reallocate, tracking_deallocate, &heap};
+    
+    msgpack_buffer buf;
+    msgpack_buffer_init(&buf, 0);
+    msgpack_pack_array(&buf, 3);
+    msgpack_pack_map(&buf, 2);
+    msgpack_pack_str(&buf, "a", 1);
+    msgpack_pack_array(&buf, 2);
+    msgpack_pack_int(&buf, 1);
+    msgpack_pack_int(&buf, 2);
+    msgpack_pack_str(&buf, "b", 1);
+    msgpack_pack_map(&buf, 0);
+    msgpack_pack_array(&buf, 1);
+    msgpack_pack_str(&buf, "deep", 4);
+    msgpack_pack_int(&buf, -7);
+    
+    msgpack_reader reader;
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    msgpack_reader_set_allocator(&reader, &allocator);
+    msgpack_object out = {0};
+    if (msgpack_read_object_compact(&reader, &out) != 0) return -1;
+    if (heap.allocations != 1) return -1;
+    if (reader.position != buf.length) return -1;
+    
+    msgpack_object *root = out.as.array.ptr;
+    msgpack_object_kv *map = root[0].as.map.ptr;
+    if (out.as.array.size != 3 || root[2].as.i != -7) return -1;
+    if (map[0].value.as.array.ptr[1].as.i != 2) return -1;
+    if (map[1].value.as.map.size != 0) return -1;
+    if (memcmp(root[1].as.array.ptr[0].as.str.ptr, "deep", 4) != 0) return -1;
+    /* pre-order: root children, then the map's entries, then its array, then the last array */
+    if ((uint8_t *)map != (uint8_t *)(root + 3)) return -1;
+    if ((uint8_t *)map[0].value.as.array.ptr != (uint8_t *)(map + 2)) return -1;
+    if ((uint8_t *)root[1].as.array.ptr != (uint8_t *)(map[0].value.as.array.ptr + 2)) return -1;
+    
+    msgpack_object_free_compact(&out, &allocator);
+    if (heap.live_bytes != 0) return -1;
+    
+    /* truncated input fails in the counting pass without allocating */
+    msgpack_reader_init(&reader, buf.data, buf.length - 1);
+    msgpack_reader_set_allocator(&reader, &allocator);
+    if (msgpack_read_object_compact(&reader, &out) == 0) return -1;
+    if (heap.allocations != 1 || reader.position != 0) return -1;
+    
+    msgpack_buffer_free(&buf);
+    return 0;
+}
+
+int test_cursor(void) {
+    msgpack_buffer buf;
+    msgpack_buffer_init(&buf, 0);
+    msgpack_pack_map(&buf, 2);
+    msgpack_pack_str(&buf, "ids", 3);
+    msgpack_pack_array(&buf, 3);
+    msgpack_pack_uint(&buf, 70000);
+    msgpack_pack_int(&buf, -3);
+    msgpack_pack_nil(&buf);
+    msgpack_pack_str(&buf, "blob", 4);
+    const uint8_t payload[3] = {1, 2, 3};
+    msgpack_pack_ext(&buf, 9, payload, 3);
+    msgpack_pack_float(&buf, 0.1);
+    
+    msgpack_reader reader;
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    msgpack_token t;
+    if (msgpack_cursor_next(&reader, &t) != 0 || t.type != MSGPACK_TYPE_FIXMAP || t.as.count != 2) return -1;
+    if (msgpack_cursor_next(&reader, &t) != 0 || t.as.str.size != 3 || memcmp(t.as.str.ptr, "ids", 3) != 0) return -1;
+    if (msgpack_cursor_next(&reader, &t) != 0 || t.type != MSGPACK_TYPE_FIXARRAY || t.as.count != 3) return -1;
+    if (msgpack_cursor_next(&reader, &t) != 0 || t.type != MSGPACK_TYPE_UINT32 || t.as.u != 70000) return -1;
+    if (msgpack_cursor_next(&reader, &t) != 0 || t.as.i != -3) return -1;
+    if (msgpack_cursor_next(&reader, &t) != 0 || t.type != MSGPACK_TYPE_NIL) return -1;
+    if (msgpack_cursor_next(&reader, &t) != 0 || memcmp(t.as.str.ptr, "blob", 4) != 0) return -1;
+    if (msgpack_cursor_next(&reader, &t) != 0 || t.as.ext.type != 9 || t.as.ext.size != 3 || t.as.ext.ptr[2] != 3) return -1;
+    if (msgpack_cursor_next(&reader, &t) != 0 || t.type != MSGPACK_TYPE_FLOAT64 || t.as.f != 0.1) return -1;
+    
+    /* clean end of input */
+    if (msgpack_cursor_next(&reader, &t) == 0 || msgpack_reader_remaining(&reader) != 0) return -1;
+    
+    /* a truncated payload fails and leaves the reader on its header */
+    msgpack_reader_init(&reader, buf.data, buf.length - 1);
+    reader.position = buf.length - 9;
+    if (msgpack_cursor_next(&reader, &t) == 0 || reader.position != buf.length - 9) return -1;
+    
+    msgpack_buffer_free(&buf);
+    return 0;
+}
+
+typedef struct {
+    char trace[128];
+    size_t len;
+    uint32_t skip_key;
+} parse_trace;
+
+static void trace_append(parse_trace *t, const char *s) {
+    size_t n = strlen(s);
+    if (t->len + n < sizeof(t->trace)) {
+        memcpy(t->trace + t->len, s, n + 1);
+        t->len += n;
+    }
+}
+
+static int trace_nil(void *ctx) { trace_append(ctx, "nil "); return 0; }
+static int trace_uint(void *ctx, uint64_t u) { char s[24]; snprintf(s, sizeof(s), "%llu ", (unsigned long long)u); trace_append(ctx, s); return 0; }
+static int trace_int(void *ctx, int64_t i) { char s[24]; snprintf(s, sizeof(s), "%lld ", (long long)i); trace_append(ctx, s); return 0; }
+static int trace_str(void *ctx, const char *ptr, uint32_t size) { char s[40]; snprintf(s, sizeof(s), "'%.*s' ", (int)size, ptr); trace_append(ctx, s); return 0; }
+static int trace_array_begin(void *ctx, uint32_t count) { char s[24]; snprintf(s, sizeof(s), "[%u ", count); trace_append(ctx, s); return count > 2 ? MSGPACK_VISIT_SKIP : 0; }
+static int trace_array_end(void *ctx) { trace_append(ctx, "] "); return 0; }
+static int trace_map_begin(void *ctx, uint32_t count) { char s[24]; snprintf(s, sizeof(s), "{%u ", count); trace_append(ctx, s); return 0; }
+static int trace_map_key(void *ctx, uint32_t index) { return index == ((parse_trace *)ctx)->skip_key ? MSGPACK_VISIT_SKIP : 0; }
+static int trace_map_end(void *ctx) { trace_append(ctx, "} "); return 0; }
+static int trace_abort(void *ctx, int64_t i) { (void)ctx; return i < 0 ? -1 : 0; }
+
+int test_parse_visitor(void) {
+    msgpack_buffer buf;
+    msgpack_buffer_init(&buf, 0);
+    msgpack_pack_map(&buf, 3);
+    msgpack_pack_str(&buf, "a", 1);
+    msgpack_pack_array(&buf, 2);
+    msgpack_pack_uint(&buf, 1);
+    msgpack_pack_int(&buf, -2);
+    msgpack_pack_str(&buf, "skipped", 7);
+    msgpack_pack_map(&buf, 1);
+    msgpack_pack_str(&buf, "x", 1);
+    msgpack_pack_nil(&buf);
+    msgpack_pack_str(&buf, "big", 3);
+    msgpack_pack_array(&buf, 3);
+    msgpack_pack_uint(&buf, 7);
+    msgpack_pack_array(&buf, 0);
+    msgpack_pack_str(&buf, "zzz", 3);
+    msgpack_pack_nil(&buf);
+    
+    msgpack_visitor visitor = {
+        .on_nil = trace_nil,
+        .on_int = trace_int,
+        .on_uint = trace_uint,
+        .on_str = trace_str,
+        .on_array_begin = trace_array_begin,
+        .on_array_end = trace_array_end,
+        .on_map_begin = trace_map_begin,
+        .on_map_key = trace_map_key,
+        .on_map_end = trace_map_end,
+    };
+    parse_trace t = {.skip_key = 1};
+    msgpack_reader reader;
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    if (msgpack_parse(&reader, &visitor, &t) != 0) return -1;
+    if (strcmp(t.trace, "{3 'a' [2 1 -2 ] 'big' [3 } ") != 0) return -1;
+    
+    /* values are parsed one at a time */
+    t = (parse_trace){.skip_key = 99};
+    if (msgpack_parse(&reader, &visitor, &t) != 0 || strcmp(t.trace, "nil ") != 0) return -1;
+    if (msgpack_reader_remaining(&reader) != 0) return -1;
+    
+    /* a negative callback result aborts the parse */
+    msgpack_visitor aborting = {.on_int = trace_abort};
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    if (msgpack_parse(&reader, &aborting, NULL) == 0) return -1;
+    
+    /* truncated input fails */
+    msgpack_reader_init(&reader, buf.data, buf.length - 2);
+    t = (parse_trace){.skip_key = 99};
+    if (msgpack_parse(&reader, &visitor, &t) == 0) return -1;
+    
+    msgpack_buffer_clear(&buf);
+    for (int i = 0; i < 5; i++) {
+        msgpack_pack_array(&buf, 1);
+    }
+    msgpack_pack_nil(&buf);
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    msgpack_reader_set_max_depth(&reader, 4);
+    if (msgpack_parse(&reader, &(msgpack_visitor){0}, NULL) == 0) return -1;
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    msgpack_reader_set_max_depth(&reader, 5);
+    if (msgpack_parse(&reader, &(msgpack_visitor){0}, NULL) != 0) return -1;
+    
+    msgpack_buffer_free(&buf);
+    return 0;
+}
+
+int test_skip_and_validate(void) {
+    msgpack_buffer buf;
+    msgpack_buffer_init(&buf, 0);
+    msgpack_pack_map(&buf, 2);
+    msgpack_pack_str(&buf, "tags", 4);
+    msgpack_pack_array(&buf, 2);
+    msgpack_pack_str(&buf, "alpha", 5);
+    const uint8_t blob[2] = {0, 1};
+    msgpack_pack_bin(&buf, blob, 2);
+    msgpack_pack_str(&buf, "nested", 6);
+    msgpack_pack_array(&buf, 1);
+    msgpack_pack_array(&buf, 1);
+    msgpack_pack_uint(&buf, 300);
+    size_t first = buf.length;
+    msgpack_pack_int(&buf, -1);
+    
+    msgpack_reader reader;
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    if (msgpack_skip_object(&reader) != 0 || reader.position != first) return -1;
+    if (msgpack_skip_object(&reader) != 0 || msgpack_reader_remaining(&reader) != 0) return -1;
+    if (msgpack_skip_object(&reader) == 0) return -1;
+    
+    /* exactly one message: trailing bytes and truncation are rejected */
+    if (msgpack_validate(buf.data, first, NULL) != 0) return -1;
+    if (msgpack_validate(buf.data, buf.length, NULL) == 0) return -1;
+    if (msgpack_validate(buf.data, first - 1, NULL) == 0) return -1;
+    msgpack_reader_init(&reader, buf.data, first - 1);
+    if (msgpack_skip_object(&reader) == 0 || reader.position != 0) return -1;
+    
+    msgpack_limits limits = {0};
+    if (msgpack_validate(buf.data, first, &limits) != 0) return -1;
+    limits = (msgpack_limits){.max_depth = 3, .max_str_size = 6, .max_bin_size = 2, .max_container_size = 2};
+    if (msgpack_validate(buf.data, first, &limits) != 0) return -1;
+    limits.max_depth = 2;
+    if (msgpack_validate(buf.data, first, &limits) == 0) return -1;
+    limits = (msgpack_limits){.max_str_size = 5};
+    if (msgpack_validate(buf.data, first, &limits) == 0) return -1;
+    limits = (msgpack_limits){.max_bin_size = 1};
+    if (msgpack_validate(buf.data, first, &limits) == 0) return -1;
+    limits = (msgpack_limits){.max_container_size = 1};
+    if (msgpack_validate(buf.data, first, &limits) == 0) return -1;
+    
+    /* a str length that runs past the buffer is rejected by every decoder */
+    const uint8_t overlong[] = {0x91, 0xD9, 0xF0, 'a', 'b'};
+    msgpack_object out = {0};
+    msgpack_reader_init(&reader, overlong, sizeof(overlong));
+    if (msgpack_read_object(&reader, &out) == 0) return -1;
+    if (msgpack_validate(overlong, sizeof(overlong), NULL) == 0) return -1;
+    
+    /* a container claiming more elements than bytes fails before allocating */
+    tracking_heap heap = {0};
+    msgpack_allocator allocator = {tracking_allocate, tracking_reallocate, tracking_deallocate, &heap};
+    const uint8_t huge[] = {0xDD, 0xFF, 0xFF, 0xFF, 0xFF, 0xC0};
+    msgpack_reader_init(&reader, huge, sizeof(huge));
+    msgpack_reader_set_allocator(&reader, &allocator);
+    if (msgpack_read_object(&reader, &out) == 0 || heap.allocations != 0) return -1;
+    
+    msgpack_buffer_free(&buf);
+    return 0;
+}
+
+int test_tape_index(void) {
+    msgpack_buffer buf;
+    msgpack_buffer_init(&buf, 0);
+    msgpack_pack_map(&buf, 3);
+    msgpack_pack_str(&buf, "big", 3);
+    msgpack_pack_array(&buf, 100);
+    for (int i = 0; i < 100; i++) {
+        msgpack_pack_map(&buf, 1);
+        msgpack_pack_str(&buf, "i", 1);
+        msgpack_pack_int(&buf, i);
+    }
+    msgpack_pack_uint(&buf, 7);
+    msgpack_pack_str(&buf, "seven", 5);
+    msgpack_pack_str(&buf, "user", 4);
+    msgpack_pack_map(&buf, 1);
+    msgpack_pack_str(&buf, "tags", 4);
+    msgpack_pack_array(&buf, 0);
+    
+    tracking_heap heap = {0};
+    msgpack_allocator allocator = {tracking_allocate, tracking_reallocate, tracking_deallocate, &heap};
+    msgpack_tape tape;
+    if (msgpack_tape_init_with_allocator(&tape, 0, &allocator) != 0) return -1;
+    msgpack_reader reader;
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    if (msgpack_tape_build(&tape, &reader) != 0) return -1;
+    /* root, 3 keys, big array + 100 * (map, key, value), 7 -> value, user map, tags key, tags array */
+    if (tape.count != 1 + 3 + 1 + 300 + 1 + 1 + 2) return -1;
+    if (tape.entries[0].next != tape.count || tape.entries[0].end != buf.length) return -1;
+    
+    /* skipping the big array is one jump */
+    msgpack_tape_entry *big = &tape.entries[2];
+    if (big->count != 100 || big->next != 303 || tape.entries[big->next].type != MSGPACK_TYPE_POSITIVE_FIXINT) return -1;
+    
+    size_t at, value;
+    msgpack_object obj;
+    if (msgpack_tape_map_find(&tape, 0, "big", 3, &at) != 0 || msgpack_tape_array_at(&tape, at, 42, &at) != 0) return -1;
+    if (msgpack_tape_map_find(&tape, at, "i", 1, &value) != 0 || msgpack_tape_read(&tape, value, &obj) != 0 || obj.as.u != 42) return -1;
+    if (msgpack_tape_map_find(&tape, 0, "user", 4, &at) != 0 || msgpack_tape_map_find(&tape, at, "tags", 4, &at) != 0) return -1;
+    if (tape.entries[at].count != 0 || msgpack_tape_array_at(&tape, at, 0, &at) == 0) return -1;
+    if (msgpack_tape_map_find(&tape, 0, "missing", 7, &at) == 0) return -1;
+    if (msgpack_tape_array_at(&tape, 0, 0, &at) == 0) return -1;
+    /* element lookups match a sibling walk; only the array of maps needs a table */
+    size_t walk = 3;
+    for (uint32_t i = 0; i < 100; i++) {
+        if (msgpack_tape_array_at(&tape, 2, i, &at) != 0 || at != walk) return -1;
+        walk = tape.entries[walk].next;
+    }
+    if (msgpack_tape_array_at(&tape, 2, 100, &at) == 0 || tape.children_count != 100) return -1;
+    
+    msgpack_buffer flat;
+    msgpack_buffer_init(&flat, 0);
+    msgpack_pack_array(&flat, 3);
+    msgpack_pack_int(&flat, 1);
+    msgpack_pack_array(&flat, 2);
+    msgpack_pack_int(&flat, 2);
+    msgpack_pack_int(&flat, 3);
+    msgpack_pack_int(&flat, 4);
+    msgpack_reader_init(&reader, flat.data, flat.length);
+    if (msgpack_tape_build(&tape, &reader) != 0 || tape.children_count != 3 || tape.entries[2].children != SIZE_MAX) return -1;
+    if (msgpack_tape_array_at(&tape, 2, 1, &at) != 0 || at != 4) return -1;
+    if (msgpack_tape_array_at(&tape, 0, 2, &at) != 0 || at != 5 || msgpack_tape_read(&tape, at, &obj) != 0 || obj.as.u != 4) return -1;
+    msgpack_buffer_free(&flat);
+    
+    /* rebuilding reuses the entries; failures leave an empty tape */
+    size_t allocations = heap.allocations;
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    if (msgpack_tape_build(&tape, &reader) != 0 || heap.allocations != allocations) return -1;
+    msgpack_reader_init(&reader, buf.data, buf.length - 1);
+    if (msgpack_tape_build(&tape, &reader) == 0 || tape.count != 0 || reader.position != 0) return -1;
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    msgpack_reader_set_max_depth(&reader, 2);
+    if (msgpack_tape_build(&tape, &reader) == 0 || reader.position != 0) return -1;
+    /* a failing allocation also leaves the reader where it was */
+    msgpack_tape_free(&tape);
+    msgpack_tape_init_with_allocator(&tape, 0, &allocator);
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    heap.limit = heap.allocations + 2;
+    if (msgpack_tape_build(&tape, &reader) == 0 || tape.count != 0 || reader.position != 0) return -1;
+    heap.limit = 0;
+    
+    msgpack_tape_free(&tape);
+    if (heap.live_bytes != 0) return -1;
+    msgpack_buffer_free(&buf);
+    return 0;
+}
+
+int test_view_paths(void) {
+    msgpack_buffer buf;
+    msgpack_buffer_init(&buf, 0);
+    msgpack_pack_map(&buf, 4);
+    msgpack_pack_array(&buf, 1);            /* non-string key is skipped */
+    msgpack_pack_str(&buf, "user", 4);
+    msgpack_pack_str(&buf, "decoy", 5);
+    msgpack_pack_str(&buf, "user", 4);
+    msgpack_pack_map(&buf, 3);
+    msgpack_pack_str(&buf, "name", 4);
+    msgpack_pack_str(&buf, "ann", 3);
+    msgpack_pack_str(&buf, "tags", 4);
+    msgpack_pack_array(&buf, 4);
+    msgpack_pack_str(&buf, "a", 1);
+    msgpack_pack_str(&buf, "b", 1);
+    msgpack_pack_array(&buf, 2);
+    msgpack_pack_nil(&buf);
+    msgpack_pack_nil(&buf);
+    msgpack_pack_str(&buf, "d", 1);
+    msgpack_pack_str(&buf, "age", 3);
+    msgpack_pack_uint(&buf, 33);
+    msgpack_pack_str(&buf, "items", 5);
+    msgpack_pack_array(&buf, 2);
+    msgpack_pack_map(&buf, 1);
+    msgpack_pack_str(&buf, "id", 2);
+    msgpack_pack_int(&buf, -1);
+    msgpack_pack_map(&buf, 1);
+    msgpack_pack_str(&buf, "id", 2);
+    msgpack_pack_float(&buf, 0.5);
+    msgpack_pack_str(&buf, "ok", 2);
+    msgpack_pack_bool(&buf, true);
+    
+    msgpack_view view, user;
+    msgpack_view_init(&view, buf.data, buf.length);
+    const char *str;
+    uint32_t size;
+    int64_t i;
+    uint64_t u;
+    double f;
+    bool b;
+    if (msgpack_view_get_str(&view, "user.tags[3]", &str, &size) != 0 || size != 1 || *str != 'd') return -1;
+    if (msgpack_view_get_int(&view, "items[0].id", &i) != 0 || i != -1) return -1;
+    if (msgpack_view_get_uint(&view, "items[0].id", &u) == 0) return -1;
+    if (msgpack_view_get_float(&view, "items[1].id", &f) != 0 || f != 0.5) return -1;
+    if (msgpack_view_get_float(&view, "user.age", &f) != 0 || f != 33.0) return -1;
+    if (msgpack_view_get_bool(&view, "ok", &b) != 0 || !b) return -1;
+    
+    /* views compose, and an empty path is the view itself */
+    if (msgpack_view_get(&view, "user", &user) != 0) return -1;
+    if (msgpack_view_get_uint(&user, "age", &u) != 0 || u != 33) return -1;
+    msgpack_object obj;
+    if (msgpack_view_read(&user, &obj) != 0 || obj.as.map.size != 3 || obj.as.map.ptr != NULL) return -1;
+    if (msgpack_view_get_str(&user, "", &str, &size) == 0) return -1;
+    
+    /* misses, type mismatches and malformed paths */
+    const char *bad[] = {"missing", "user.tags[4]", "user.tags.x", "user[0]", "user.", "user..name", ".user",
+                         "items[", "items[x]", "items[-1]", "items[0]x", "ok.x", "user.name[0]"};
+    msgpack_view target;
+    for (size_t n = 0; n < sizeof(bad) / sizeof(bad[0]); n++) {
+        if (msgpack_view_get(&view, bad[n], &target) == 0) return -1;
+    }
+    if (msgpack_view_get_int(&view, "user.name", &i) == 0) return -1;
+    
+    /* truncation inside a skipped subtree is reported, not read past */
+    msgpack_view_init(&view, buf.data, buf.length - 3);
+    if (msgpack_view_get_bool(&view, "ok", &b) == 0) return -1;
+    
+    msgpack_buffer_free(&buf);
+    return 0;
+}
+
+int test_projection(void) {
+    tracking_heap heap = {0};
+    msgpack_allocator allocator = {tracking_allocate, tracking_reallocate, tracking_deallocate, &heap};
+    const char *paths[] = {"id", "meta.region", "tags", "meta.zone.name", "absent.x"};
+    msgpack_projection proj;
+    if (msgpack_projection_compile_with_allocator(&proj, paths, 5, &allocator) != 0) return -1;
+    
+    msgpack_buffer buf;
+    msgpack_buffer_init(&buf, 0);
+    msgpack_pack_map(&buf, 6);
+    msgpack_pack_str(&buf, "payload", 7);
+    msgpack_pack_array(&buf, 3);
+    msgpack_pack_map(&buf, 0);
+    msgpack_pack_str(&buf, "big", 3);
+    msgpack_pack_uint(&buf, 1);
+    msgpack_pack_str(&buf, "id", 2);
+    msgpack_pack_uint(&buf, 42);
+    msgpack_pack_str(&buf, "meta", 4);
+    msgpack_pack_map(&buf, 3);
+    msgpack_pack_str(&buf, "host", 4);
+    msgpack_pack_str(&buf, "h1", 2);
+    msgpack_pack_str(&buf, "region", 6);
+    msgpack_pack_str(&buf, "eu", 2);
+    msgpack_pack_str(&buf, "zone", 4);
+    msgpack_pack_uint(&buf, 3);             /* not a map: meta.zone.name is absent */
+    msgpack_pack_str(&buf, "tags", 4);
+    msgpack_pack_array(&buf, 2);
+    msgpack_pack_str(&buf, "a", 1);
+    msgpack_pack_array(&buf, 0);
+    msgpack_pack_str(&buf, "absent", 6);
+    msgpack_pack_nil(&buf);
+    msgpack_pack_uint(&buf, 9);             /* non-string key */
+    msgpack_pack_str(&buf, "nine", 4);
+    
+    msgpack_reader reader;
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    msgpack_reader_set_allocator(&reader, &allocator);
+    msgpack_object out;
+    if (msgpack_read_projected(&reader, &proj, &out) != 0 || reader.position != buf.length) return -1;
+    if (out.as.map.size != 3) return -1;
+    msgpack_object_kv *kv = out.as.map.ptr;
+    if (memcmp(kv[0].key.as.str.ptr, "id", 2) != 0 || kv[0].value.as.u != 42) return -1;
+    msgpack_object meta = kv[1].value;
+    if (meta.as.map.size != 1 || memcmp(meta.as.map.ptr[0].value.as.str.ptr, "eu", 2) != 0) return -1;
+    if (kv[2].value.as.array.size != 2 || kv[2].value.as.array.ptr[1].as.array.size != 0) return -1;
+    msgpack_object_free_with_allocator(&out, &allocator);
+    
+    /* the same projection through a zone */
+    msgpack_zone zone;
+    msgpack_zone_init(&zone, 0);
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    msgpack_reader_set_zone(&reader, &zone);
+    if (msgpack_read_projected(&reader, &proj, &out) != 0 || out.as.map.size != 3) return -1;
+    msgpack_zone_free(&zone);
+    
+    /* failures free what was built and leave the reader untouched */
+    msgpack_reader_init(&reader, buf.data, buf.length - 1);
+    msgpack_reader_set_allocator(&reader, &allocator);
+    if (msgpack_read_projected(&reader, &proj, &out) == 0 || reader.position != 0 || out.type != MSGPACK_TYPE_NIL) return -1;
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    msgpack_reader_set_allocator(&reader, &allocator);
+    msgpack_reader_set_max_depth(&reader, 2);
+    if (msgpack_read_projected(&reader, &proj, &out) == 0) return -1;
+    msgpack_reader_set_max_depth(&reader, 3);
+    if (msgpack_read_projected(&reader, &proj, &out) != 0) return -1;
+    msgpack_object_free_with_allocator(&out, &allocator);
+    
+    msgpack_projection_free(&proj);
+    if (heap.live_bytes != 0) return -1;
+    const char *bad[] = {"a..b"};
+    if (msgpack_projection_compile(&proj, bad, 1) == 0) return -1;
+    msgpack_buffer_free(&buf);
+    return 0;
+}
+
+static void pack_event(msgpack_buffer *buf, const char *level, int64_t code, const char *host) {
+    msgpack_pack_map(buf, 3);
+    msgpack_pack_str(buf, "level", 5);
+    msgpack_pack_str(buf, level, strlen(level));
+    msgpack_pack_str(buf, "code", 4);
+    msgpack_pack_int(buf, code);
+    msgpack_pack_str(buf, "meta", 4);
+    msgpack_pack_map(buf, 1);
+    msgpack_pack_str(buf, "host", 4);
+    msgpack_pack_str(buf, host, strlen(host));
+}
+
+int test_filter(void) {
+    msgpack_buffer buf;
+    msgpack_buffer_init(&buf, 0);
+    pack_event(&buf, "info", 200, "web-1");
+    pack_event(&buf, "error", 503, "web-2");
+    pack_event(&buf, "error", 404, "web-3");
+    pack_event(&buf, "error", 500, "db-1");
+    pack_event(&buf, "error", -1, "web-4");
+    pack_event(&buf, "error", 599, "web-5");
+    
+    char level[] = "error";
+    msgpack_predicate preds[] = {
+        {.path = "level", .op = MSGPACK_PREDICATE_EQ, .value = {.type = MSGPACK_TYPE_STR, .as.str = {5, level}}},
+        {.path = "code", .op = MSGPACK_PREDICATE_GE, .value = {.type = MSGPACK_TYPE_FLOAT64, .as.f = 499.5}},
+        {.path = "meta.host", .op = MSGPACK_PREDICATE_PREFIX, .value = {.type = MSGPACK_TYPE_STR, .as.str = {4, "web-"}}},
+    };
+    msgpack_filter filter;
+    if (msgpack_filter_compile(&filter, preds, 3) != 0) return -1;
+    level[0] = 'X';                         /* the filter owns its constants */
+    
+    msgpack_reader reader;
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    msgpack_object out;
+    uint64_t codes[4];
+    size_t matches = 0;
+    while (msgpack_read_filtered(&reader, &filter, &out) == 0) {
+        codes[matches++] = out.as.map.ptr[1].value.as.u;
+        msgpack_object_free(&out);
+    }
+    if (matches != 2 || codes[0] != 503 || codes[1] != 599 || msgpack_reader_remaining(&reader) != 0) return -1;
+    msgpack_filter_free(&filter);
+    
+    /* signed against unsigned, existence, and missing fields */
+    msgpack_predicate lt = {.path = "code", .op = MSGPACK_PREDICATE_LT, .value = {.type = MSGPACK_TYPE_UINT64, .as.u = 0}};
+    msgpack_predicate exists = {.path = "meta.host", .op = MSGPACK_PREDICATE_EXISTS};
+    msgpack_predicate missing = {.path = "meta.port", .op = MSGPACK_PREDICATE_EXISTS};
+    if (msgpack_filter_compile(&filter, &lt, 1) != 0) return -1;
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    if (msgpack_read_filtered(&reader, &filter, &out) != 0 || out.as.map.ptr[1].value.as.i != -1) return -1;
+    msgpack_object_free(&out);
+    msgpack_filter_free(&filter);
+    if (msgpack_filter_compile(&filter, &exists, 1) != 0 || !msgpack_filter_match(&filter, buf.data, buf.length)) return -1;
+    msgpack_filter_free(&filter);
+    if (msgpack_filter_compile(&filter, &missing, 1) != 0 || msgpack_filter_match(&filter, buf.data, buf.length)) return -1;
+    msgpack_filter_free(&filter);
+    
+    /* prefix needs a string constant */
+    msgpack_predicate bad = {.path = "code", .op = MSGPACK_PREDICATE_PREFIX, .value = {.type = MSGPACK_TYPE_UINT64}};
+    if (msgpack_filter_compile(&filter, &bad, 1) == 0) return -1;
+    
+    /* a malformed message stops the scan where it starts */
+    msgpack_filter_compile(&filter, &missing, 1);
+    msgpack_reader_init(&reader, buf.data, buf.length - 1);
+    if (msgpack_read_filtered(&reader, &filter, &out) == 0 || msgpack_reader_remaining(&reader) == 0) return -1;
+    msgpack_filter_free(&filter);
+    msgpack_buffer_free(&buf);
+    return 0;
+}
+
+int test_unpacker(void) {
+    msgpack_buffer buf;
+    msgpack_buffer_init(&buf, 0);
+    for (int i = 0; i < 3; i++) {
+        msgpack_pack_map(&buf, 2);
+        msgpack_pack_str(&buf, "seq", 3);
+        msgpack_pack_int(&buf, i);
+        msgpack_pack_str(&buf, "body", 4);
+        msgpack_pack_array(&buf, 2);
+        msgpack_pack_str(&buf, "0123456789abcdefghijklmnopqrstuvwxyz", 36);
+        msgpack_pack_uint(&buf, 1u << 20);
+    }
+    msgpack_pack_nil(&buf);
+    
+    tracking_heap heap = {0};
+    msgpack_allocator allocator = {tracking_allocate, tracking_reallocate, tracking_deallocate, &heap};
+    msgpack_unpacker unpacker;
+    if (msgpack_unpacker_init_with_allocator(&unpacker, 0, &allocator) != 0) return -1;
+    msgpack_object out;
+    if (msgpack_unpacker_next(&unpacker, &out) != MSGPACK_UNPACK_NEED_MORE) return -1;
+    
+    /* one byte at a time: each message appears exactly when its last byte does */
+    int seen = 0;
+    bool saw_nil = false;
+    for (size_t i = 0; i < buf.length; i++) {
+        if (msgpack_unpacker_feed(&unpacker, buf.data + i, 1) != 0) return -1;
+        int ret;
+        while ((ret = msgpack_unpacker_next(&unpacker, &out)) == 0) {
+            if (out.type == MSGPACK_TYPE_NIL) {
+                saw_nil = i == buf.length - 1;
+                continue;
+            }
+            if (out.as.map.ptr[0].value.as.i != seen) return -1;
+            if (memcmp(out.as.map.ptr[1].value.as.array.ptr[0].as.str.ptr + 30, "uvwxyz", 6) != 0) return -1;
+            seen++;
+            msgpack_object_free_with_allocator(&out, &allocator);
+        }
+        if (ret != MSGPACK_UNPACK_NEED_MORE) return -1;
+    }
+    if (seen != 3 || !saw_nil) return -1;
+    
+    /* reading straight into the unpacker in two uneven chunks */
+    uint8_t *dst = msgpack_unpacker_reserve(&unpacker, buf.length);
+    if (!dst) return -1;
+    memcpy(dst, buf.data, 7);
+    msgpack_unpacker_commit(&unpacker, 7);
+    if (msgpack_unpacker_next(&unpacker, &out) != MSGPACK_UNPACK_NEED_MORE) return -1;
+    dst = msgpack_unpacker_reserve(&unpacker, buf.length - 7);
+    memcpy(dst, buf.data + 7, buf.length - 7);
+    msgpack_unpacker_commit(&unpacker, buf.length - 7);
+    for (seen = 0; msgpack_unpacker_next(&unpacker, &out) == 0; seen++) {
+        msgpack_object_free_with_allocator(&out, &allocator);
+    }
+    if (seen != 4) return -1;
+    
+    /* the never-used byte is an error, not a request for more input; with
+     * no message boundary after it, a good frame behind it stays out of
+     * reach until a reset, after which a fresh frame decodes */
+    const uint8_t bad[] = {0x92, 0x01, 0xC1};
+    const uint8_t good[] = {0x92, 0x03, 0xA1, 'x'};
+    msgpack_unpacker_feed(&unpacker, bad, sizeof(bad));
+    if (msgpack_unpacker_next(&unpacker, &out) != -1) return -1;
+    msgpack_unpacker_feed(&unpacker, good, sizeof(good));
+    if (msgpack_unpacker_next(&unpacker, &out) != -1 || msgpack_unpacker_next(&unpacker, &out) != -1) return -1;
+    size_t capacity = unpacker.buffer.capacity;
+    msgpack_unpacker_reset(&unpacker);
+    if (unpacker.buffer.length != 0 || unpacker.buffer.capacity != capacity) return -1;
+    if (msgpack_unpacker_next(&unpacker, &out) != MSGPACK_UNPACK_NEED_MORE) return -1;
+    msgpack_unpacker_feed(&unpacker, good, sizeof(good));
+    if (msgpack_unpacker_next(&unpacker, &out) != 0 || out.as.array.ptr[0].as.u != 3) return -1;
+    if (out.as.array.ptr[1].as.str.size != 1 || out.as.array.ptr[1].as.str.ptr[0] != 'x') return -1;
+    msgpack_object_free_with_allocator(&out, &allocator);
+    if (msgpack_unpacker_next(&unpacker, &out) != MSGPACK_UNPACK_NEED_MORE) return -1;
+    msgpack_unpacker_free(&unpacker);
+    if (heap.live_bytes != 0) return -1;
+    
+    /* hostile headers fail when scanned instead of waiting for their
+     * payload or elements to arrive */
+    const uint8_t huge_str[] = {0xDB, 0xFF, 0xFF, 0xFF, 0xF0, 'a'};
+    const uint8_t huge_array[] = {0xDD, 0xFF, 0xFF, 0xFF, 0xFF, 0x01};
+    const uint8_t nested[] = {0x92, 0x93, 0x01, 0x02, 0x03, 0x91, 0x04};
+    msgpack_unpacker_init(&unpacker, 0);
+    msgpack_unpacker_set_max_message_size(&unpacker, 1 << 20);
+    msgpack_unpacker_feed(&unpacker, huge_str, sizeof(huge_str));
+    if (msgpack_unpacker_next(&unpacker, &out) != -1) return -1;
+    msgpack_unpacker_free(&unpacker);
+    msgpack_unpacker_init(&unpacker, 0);
+    msgpack_unpacker_set_max_message_size(&unpacker, 1 << 20);
+    msgpack_unpacker_feed(&unpacker, huge_array, sizeof(huge_array));
+    if (msgpack_unpacker_next(&unpacker, &out) != -1) return -1;
+    /* the settings survive a reset */
+    msgpack_unpacker_reset(&unpacker);
+    msgpack_unpacker_feed(&unpacker, huge_array, sizeof(huge_array));
+    if (msgpack_unpacker_next(&unpacker, &out) != -1) return -1;
+    msgpack_unpacker_free(&unpacker);
+    
+    /* UTF-8 checking fails just the bad message, at an offset within it */
+    const uint8_t strings[] = {0xA2, 0xC3, 0xA9, 0x92, 0x01, 0xA3, 'a', 0xC3, 0x28};
+    msgpack_unpacker_init(&unpacker, 0);
+    msgpack_unpacker_set_validate_utf8(&unpacker, true);
+    msgpack_unpacker_feed(&unpacker, strings, sizeof(strings));
+    if (msgpack_unpacker_next(&unpacker, &out) != 0 || unpacker.utf8_error_offset != SIZE_MAX) return -1;
+    if (msgpack_unpacker_next(&unpacker, &out) != -1 || unpacker.utf8_error_offset != 4) return -1;
+    /* and the stream goes on with the next message */
+    msgpack_unpacker_feed(&unpacker, good, sizeof(good));
+    if (msgpack_unpacker_next(&unpacker, &out) != 0 || out.as.array.ptr[0].as.u != 3) return -1;
+    msgpack_object_free(&out);
+    msgpack_unpacker_free(&unpacker);
+    
+    /* the same headers just wait for input with the limits off */
+    msgpack_unpacker_init(&unpacker, 0);
+    msgpack_unpacker_set_max_message_size(&unpacker, 0);
+    msgpack_unpacker_feed(&unpacker, huge_array, sizeof(huge_array));
+    if (msgpack_unpacker_next(&unpacker, &out) != MSGPACK_UNPACK_NEED_MORE) return -1;
+    msgpack_unpacker_free(&unpacker);
+    
+    /* limits are exact: 7 bytes and 6 nested values pass, one less fails */
+    for (int tight = 0; tight < 2; tight++) {
+        msgpack_unpacker_init(&unpacker, 0);
+        msgpack_unpacker_set_max_message_size(&unpacker, sizeof(nested) - (size_t)tight);
+        msgpack_unpacker_feed(&unpacker, nested, sizeof(nested));
+        if (msgpack_unpacker_next(&unpacker, &out) != (tight ? -1 : 0)) return -1;
+        if (!tight) msgpack_object_free(&out);
+        msgpack_unpacker_free(&unpacker);
+        msgpack_unpacker_init(&unpacker, 0);
+        msgpack_unpacker_set_max_elements(&unpacker, 6 - (uint64_t)tight);
+        msgpack_unpacker_feed(&unpacker, nested, sizeof(nested));
+        if (msgpack_unpacker_next(&unpacker, &out) != (tight ? -1 : 0)) return -1;
+        if (!tight) msgpack_object_free(&out);
+        msgpack_unpacker_free(&unpacker);
+    }
+    msgpack_buffer_free(&buf);
+    return 0;
+}
+
+int test_read_many(void) {
+    msgpack_buffer buf;
+    msgpack_buffer_init(&buf, 0);
+    msgpack_pack_uint(&buf, 7);             /* scalar first: the batch block is found past it */
+    for (int i = 0; i < 4; i++) {
+        msgpack_pack_array(&buf, 2);
+        msgpack_pack_int(&buf, i);
+        msgpack_pack_map(&buf, 1);
+        msgpack_pack_str(&buf, "k", 1);
+        msgpack_pack_int(&buf, -i);
+    }
+    
+    tracking_heap heap = {0};
+    msgpack_allocator allocator = {tracking_allocate, tracking_reallocate, tracking_deallocate, &heap};
+    msgpack_reader reader;
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    msgpack_reader_set_allocator(&reader, &allocator);
+    msgpack_object objs[3];
+    size_t count;
+    if (msgpack_read_many(&reader, objs, 3, &count) != 0 || count != 3 || heap.allocations != 1) return -1;
+    if (objs[0].as.u != 7 || objs[2].as.array.ptr[1].as.map.ptr[0].value.as.i != -1) return -1;
+    /* one block holds the batch, in message order */
+    if ((uint8_t *)objs[2].as.array.ptr != (uint8_t *)objs[1].as.array.ptr + 4 * sizeof(msgpack_object)) return -1;
+    msgpack_object_free_many(objs, count, &allocator);
+    if (heap.live_bytes != 0) return -1;
+    
+    if (msgpack_read_many(&reader, objs, 3, &count) != 0 || count != 2 || objs[1].as.array.ptr[0].as.u != 3) return -1;
+    msgpack_object_free_many(objs, count, &allocator);
+    if (msgpack_read_many(&reader, objs, 3, &count) == 0 || count != 0 || heap.live_bytes != 0) return -1;
+    
+    /* a truncated message ends the batch before it */
+    msgpack_reader_init(&reader, buf.data, buf.length - 1);
+    if (msgpack_read_many(&reader, objs, 3, &count) != 0 || count != 3) return -1;
+    msgpack_object_free_many(objs, count, NULL);
+    if (msgpack_read_many(&reader, objs, 3, &count) != 0 || count != 1) return -1;
+    msgpack_object_free_many(objs, count, NULL);
+    if (msgpack_read_many(&reader, objs, 3, &count) == 0 || msgpack_reader_remaining(&reader) == 0) return -1;
+    
+    /* with a zone the batch is released by resetting it */
+    msgpack_zone zone;
+    msgpack_zone_init(&zone, 0);
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    msgpack_reader_set_zone(&reader, &zone);
+    if (msgpack_read_many(&reader, objs, 3, &count) != 0 || count != 3 || objs[1].as.array.ptr[0].as.u != 0) return -1;
+    msgpack_zone_free(&zone);
+    
+    msgpack_buffer_free(&buf);
+    return 0;
+}
+
+int test_scan_boundaries(void) {
+    msgpack_buffer buf;
+    msgpack_buffer_init(&buf, 0);
+    const uint8_t payload[] = {1, 2, 3};
+    size_t starts[4];
+    for (int i = 0; i < 4; i++) {
+        starts[i] = buf.length;
+        msgpack_pack_map(&buf, 2);
+        msgpack_pack_str(&buf, "id", 2);
+        msgpack_pack_int(&buf, i * 100000);
+        msgpack_pack_str(&buf, "tags", 4);
+        msgpack_pack_array(&buf, 2);
+        msgpack_pack_bin(&buf, payload, 2);
+        msgpack_pack_ext(&buf, 5, payload, 3);
+    }
+    
+    size_t offsets[5];
+    size_t count;
+    if (msgpack_scan_boundaries(buf.data, buf.length, offsets, 5, &count) != 0 || count != 4) return -1;
+    for (int i = 0; i < 4; i++) {
+        if (offsets[i] != starts[i]) return -1;
+    }
+    if (offsets[4] != buf.length) return -1;
+    
+    /* every range decodes on its own */
+    msgpack_reader reader;
+    msgpack_object obj;
+    msgpack_reader_init(&reader, buf.data + offsets[2], offsets[3] - offsets[2]);
+    if (msgpack_read_object(&reader, &obj) != 0 || obj.as.map.ptr[0].value.as.i != 200000) return -1;
+    if (msgpack_reader_remaining(&reader) != 0) return -1;
+    msgpack_object_free(&obj);
+    
+    /* max is the array size: a full array stops on a boundary, writes
+     * nothing past offsets[max - 1], and the tail picks up from
+     * offsets[count] */
+    offsets[4] = SIZE_MAX;
+    if (msgpack_scan_boundaries(buf.data, buf.length, offsets, 4, &count) != 0 || count != 3 || offsets[3] != starts[3]) return -1;
+    if (offsets[4] != SIZE_MAX) return -1;
+    if (msgpack_scan_boundaries(buf.data, buf.length, offsets, 1, &count) != 0 || count != 0 || offsets[0] != 0) return -1;
+    if (msgpack_scan_boundaries(buf.data, buf.length, offsets, 0, &count) != -1 || count != 0) return -1;
+    
+    /* data ending mid-message reports where the last whole one ends */
+    if (msgpack_scan_boundaries(buf.data, buf.length - 1, offsets, 5, &count) != MSGPACK_UNPACK_NEED_MORE) return -1;
+    if (count != 3 || offsets[3] != starts[3]) return -1;
+    
+    /* a count larger than the bytes left cannot complete here */
+    const uint8_t huge[] = {0xDD, 0xFF, 0xFF, 0xFF, 0xFF, 0xC0};
+    if (msgpack_scan_boundaries(huge, sizeof(huge), offsets, 5, &count) != MSGPACK_UNPACK_NEED_MORE || count != 0) return -1;
+    
+    const uint8_t bad[] = {0x01, 0x92, 0xC1, 0x02};
+    if (msgpack_scan_boundaries(bad, sizeof(bad), offsets, 5, &count) != -1 || count != 1 || offsets[1] != 1) return -1;
+    
+    msgpack_buffer_free(&buf);
+    return 0;
+}
+
+int test_cpu_features(void) {
+    const unsigned known = MSGPACK_CPU_SSE42 | MSGPACK_CPU_AVX2 | MSGPACK_CPU_AVX512 | MSGPACK_CPU_BMI2;
+    unsigned detected = msgpack_cpu_features();
+    if (detected & ~known) return -1;
+    if (msgpack_cpu_features() != detected) return -1;
+    
+    /* the mask narrows what is in use but never adds to it */
+    msgpack_cpu_set_features(0);
+    if (msgpack_cpu_features() != 0) return -1;
+    msgpack_cpu_set_features(MSGPACK_CPU_SSE42);
+    if (msgpack_cpu_features() != (detected & MSGPACK_CPU_SSE42)) return -1;
+    msgpack_cpu_set_features(~0u);
+    if (msgpack_cpu_features() != detected) return -1;
+    return 0;
+}
+
+int test_typed_arrays(void) {
+    int64_t ints[120];
+    const int64_t edges[] = {0, 127, -32, 128, -33, 255, 256, -128, -129, 65535, 65536, -32768, -32769,
+                             4294967295LL, 4294967296LL, -2147483648LL, -2147483649LL, INT64_MAX, INT64_MIN};
+    size_t n = 0;
+    for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) ints[n++] = edges[i];
+    for (int64_t i = 0; i < 40; i++) ints[n++] = 1700000000000000000LL + i * 1000;
+    for (int64_t i = 0; i < 20; i++) ints[n++] = i - 5;
+    for (int64_t i = 0; i < 41; i++) ints[n++] = INT64_MIN + i;
+    double doubles[45];
+    float floats[45];
+    for (size_t i = 0; i < 45; i++) {
+        doubles[i] = (double)i * 0.1 - 2.0;
+        floats[i] = (float)i * 0.25f - 3.0f;
+    }
+    
+    /* every kernel level produces the bytes of packing element by element */
+    const unsigned levels[] = {0, MSGPACK_CPU_SSE42, MSGPACK_CPU_SSE42 | MSGPACK_CPU_AVX2, ~0u};
+    msgpack_buffer expected, buf;
+    msgpack_buffer_init(&expected, 0);
+    msgpack_pack_array(&expected, (uint32_t)n);
+    for (size_t i = 0; i < n; i++) msgpack_pack_int(&expected, ints[i]);
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+        msgpack_cpu_set_features(levels[l]);
+        msgpack_buffer_init(&buf, 0);
+        if (msgpack_pack_int64_array(&buf, ints, n) != 0) return -1;
+        if (buf.length != expected.length || memcmp(buf.data, expected.data, buf.length) != 0) return -1;
+        if (msgpack_pack_double_array(&buf, doubles, 45) != 0 || msgpack_pack_float_array(&buf, floats, 45) != 0) return -1;
+        
+        msgpack_reader reader;
+        msgpack_reader_init(&reader, buf.data, buf.length);
+        int64_t ints_out[120];
+        double doubles_out[45];
+        float floats_out[45];
+        size_t count;
+        if (msgpack_read_int64_array(&reader, ints_out, 120, &count) != 0 || count != n) return -1;
+        if (memcmp(ints_out, ints, n * sizeof(ints[0])) != 0) return -1;
+        if (buf.data[reader.position + 3] != 0xCB) return -1;
+        if (msgpack_read_double_array(&reader, doubles_out, 45, &count) != 0 || count != 45) return -1;
+        if (memcmp(doubles_out, doubles, sizeof(doubles)) != 0) return -1;
+        if (msgpack_read_float_array(&reader, floats_out, 45, &count) != 0 || count != 45) return -1;
+        if (memcmp(floats_out, floats, sizeof(floats)) != 0) return -1;
+        if (msgpack_reader_remaining(&reader) != 0) return -1;
+        msgpack_buffer_free(&buf);
+    }
+    msgpack_cpu_set_features(~0u);
+    msgpack_buffer_free(&expected);
+    
+    /* mixed element forms convert; too-long arrays and bad elements leave the reader put */
+    msgpack_buffer_init(&buf, 0);
+    msgpack_pack_array(&buf, 4);
+    msgpack_pack_float(&buf, 0.5);
+    msgpack_pack_uint(&buf, 7);
+    msgpack_pack_int(&buf, -300);
+    msgpack_pack_float(&buf, 0.1);
+    const uint64_t big[] = {UINT64_MAX, 1, 5000000000ULL};
+    msgpack_pack_uint64_array(&buf, big, 3);
+    msgpack_reader reader;
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    double mixed[4];
+    size_t count;
+    if (msgpack_read_double_array(&reader, mixed, 3, &count) == 0 || count != 4 || reader.position != 0) return -1;
+    if (msgpack_read_double_array(&reader, mixed, 4, &count) != 0) return -1;
+    if (mixed[0] != 0.5 || mixed[1] != 7.0 || mixed[2] != -300.0 || mixed[3] != 0.1) return -1;
+    size_t middle = reader.position;
+    int64_t as_signed[3];
+    if (msgpack_read_int64_array(&reader, as_signed, 3, &count) == 0 || reader.position != middle) return -1;
+    uint64_t as_unsigned[3];
+    if (msgpack_read_uint64_array(&reader, as_unsigned, 3, &count) != 0 || memcmp(as_unsigned, big, sizeof(big)) != 0) return -1;
+    msgpack_buffer_free(&buf);
+    return 0;
+}
+
+/* Validates one string at every kernel level; each must report the
+ * offset the scalar level (levels[0]) does. */
+static int utf8_levels_agree(msgpack_buffer *buf, const char *str, size_t len, const unsigned *levels, size_t level_count) {
+    msgpack_buffer_clear(buf);
+    msgpack_pack_str(buf, str, len);
+    size_t expected = SIZE_MAX;
+    for (size_t l = 0; l < level_count; l++) {
+        msgpack_cpu_set_features(levels[l]);
+        msgpack_reader reader;
+        msgpack_object obj;
+        msgpack_reader_init(&reader, buf->data, buf->length);
+        msgpack_reader_set_validate_utf8(&reader, true);
+        int ret = msgpack_read_object(&reader, &obj);
+        if (l == 0) expected = reader.utf8_error_offset;
+        if (reader.utf8_error_offset != expected || (ret == 0) != (expected == SIZE_MAX)) return -1;
+    }
+    return 0;
+}
+
+/* Each kernel level against the scalar kernels (level 0) on the same
+ * input: every array length up to a few AVX-512 blocks, an element of
+ * another form at every position to stop the unpack loops mid-run, and a
+ * bad byte at every offset of strings of every length. */
+int test_cpu_kernels(void) {
+    enum { MAX = 72 };
+    const unsigned levels[] = {0, MSGPACK_CPU_SSE42, MSGPACK_CPU_SSE42 | MSGPACK_CPU_AVX2, ~0u};
+    const size_t level_count = sizeof(levels) / sizeof(levels[0]);
+    uint64_t u[MAX], u_out[MAX];
+    int64_t i64[MAX], i64_out[MAX];
+    double d[MAX], d_out[MAX];
+    float f[MAX], f_out[MAX];
+    for (size_t i = 0; i < MAX; i++) {
+        u[i] = UINT64_MAX - i * 0x0123456789ULL;
+        i64[i] = INT64_MIN + (int64_t)i * 977;
+        d[i] = 0.1 + (double)i;
+        f[i] = (float)i * 0.75f - 9.5f;
+    }
+    msgpack_buffer ref, buf;
+    msgpack_buffer_init(&ref, 0);
+    msgpack_buffer_init(&buf, 0);
+    msgpack_reader reader;
+    size_t count;
+    for (size_t n = 0; n <= MAX; n++) {
+        for (size_t l = 0; l < level_count; l++) {
+            msgpack_cpu_set_features(levels[l]);
+            msgpack_buffer *out = l == 0 ? &ref : &buf;
+            msgpack_buffer_clear(out);
+            if (msgpack_pack_uint64_array(out, u, n) != 0 || msgpack_pack_int64_array(out, i64, n) != 0) return -1;
+            if (msgpack_pack_double_array(out, d, n) != 0 || msgpack_pack_float_array(out, f, n) != 0) return -1;
+            if (l > 0 && (buf.length != ref.length || memcmp(buf.data, ref.data, ref.length) != 0)) return -1;
+            msgpack_reader_init(&reader, ref.data, ref.length);
+            if (msgpack_read_uint64_array(&reader, u_out, MAX, &count) != 0 || count != n) return -1;
+            if (msgpack_read_int64_array(&reader, i64_out, MAX, &count) != 0 || count != n) return -1;
+            if (msgpack_read_double_array(&reader, d_out, MAX, &count) != 0 || count != n) return -1;
+            if (msgpack_read_float_array(&reader, f_out, MAX, &count) != 0 || count != n) return -1;
+            if (memcmp(u_out, u, n * sizeof(u[0])) != 0 || memcmp(i64_out, i64, n * sizeof(i64[0])) != 0) return -1;
+            if (memcmp(d_out, d, n * sizeof(d[0])) != 0 || memcmp(f_out, f, n * sizeof(f[0])) != 0) return -1;
+        }
+    }
+    
+    /* a fixint at position k ends every tagged run there */
+    for (size_t k = 0; k < MAX; k++) {
+        msgpack_buffer_clear(&ref);
+        msgpack_pack_array(&ref, MAX);
+        for (size_t i = 0; i < MAX; i++) i == k ? msgpack_pack_uint(&ref, k) : msgpack_pack_uint(&ref, u[i]);
+        msgpack_pack_array(&ref, MAX);
+        for (size_t i = 0; i < MAX; i++) i == k ? msgpack_pack_uint(&ref, k) : msgpack_pack_int(&ref, i64[i]);
+        msgpack_pack_array(&ref, MAX);
+        for (size_t i = 0; i < MAX; i++) i == k ? msgpack_pack_uint(&ref, k) : msgpack_pack_float(&ref, d[i]);
+        msgpack_pack_array(&ref, MAX);
+        for (size_t i = 0; i < MAX; i++) i == k ? msgpack_pack_uint(&ref, k) : msgpack_pack_float(&ref, f[i]);
+        for (size_t l = 0; l < level_count; l++) {
+            msgpack_cpu_set_features(levels[l]);
+            msgpack_reader_init(&reader, ref.data, ref.length);
+            if (msgpack_read_uint64_array(&reader, u_out, MAX, &count) != 0 || u_out[k] != k) return -1;
+            if (msgpack_read_int64_array(&reader, i64_out, MAX, &count) != 0 || i64_out[k] != (int64_t)k) return -1;
+            if (msgpack_read_double_array(&reader, d_out, MAX, &count) != 0 || d_out[k] != (double)k) return -1;
+            if (msgpack_read_float_array(&reader, f_out, MAX, &count) != 0 || f_out[k] != (float)k) return -1;
+            for (size_t i = 0; i < MAX; i++) {
+                if (i != k && (u_out[i] != u[i] || i64_out[i] != i64[i] || d_out[i] != d[i] || f_out[i] != f[i])) return -1;
+            }
+        }
+    }
+    
+    /* a mix of 1 to 4-byte sequences, broken at every offset by a byte
+     * that is never UTF-8 or by an ASCII byte, which is only wrong next to
+     * its neighbours; every phase of a pattern puts each kind of sequence
+     * across a block boundary, and most lengths end mid-sequence. The
+     * second pattern has no 4-byte sequences, so no valid byte pair looks
+     * like an error to a vector pass that checks the wrong lanes */
+    const char *patterns[] = {"a\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80xyz", "\xE2\x82\xAC\xC3\xA9"};
+    char str[160];
+    for (size_t p = 0; p < 2; p++) {
+        size_t period = strlen(patterns[p]);
+        for (size_t phase = 0; phase < period; phase++) {
+            for (size_t i = 0; i < sizeof(str); i++) str[i] = patterns[p][(i + phase) % period];
+            for (size_t len = 1; len <= sizeof(str); len += len < 70 ? 1 : 13) {
+                for (size_t bad = 0; bad <= 2 * len; bad++) {
+                    char copy[sizeof(str)];
+                    memcpy(copy, str, len);
+                    if (bad < len) copy[bad] = (char)0xFF;
+                    if (bad > len) copy[bad - len - 1] = 'A';
+                    if (utf8_levels_agree(&ref, copy, len, levels, level_count) != 0) return -1;
+                }
+            }
+        }
+    }
+    msgpack_cpu_set_features(~0u);
+    msgpack_buffer_free(&ref);
+    msgpack_buffer_free(&buf);
+    return 0;
+}
+
+int test_utf8_validation(void) {
+    /* "a", "é", "€", "😀", then 40 bytes of ASCII so the vector loops run */
+    const char valid[] = "a\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80"
+                         "0123456789012345678901234567890123456789";
+    const struct {
+        const char *str;
+        size_t size;
+        size_t offset;
+    } invalid[] = {
+        {"abc\xFF" "def", 7, 3},              /* never a UTF-8 byte */
+        {"ab\xC0\xAF", 4, 2},                 /* overlong '/' */
+        {"\xE0\x80\xAF", 3, 0},               /* overlong, 3 bytes */
+        {"x\xED\xA0\x80", 4, 1},              /* surrogate U+D800 */
+        {"\xF4\x90\x80\x80", 4, 0},           /* above U+10FFFF */
+        {"abc\xE2\x82", 5, 3},                /* truncated at the end */
+        {"\xC3(", 2, 0},                       /* lead byte without continuation */
+        {"\x80", 1, 0},                        /* stray continuation */
+    };
+    const unsigned levels[] = {0, MSGPACK_CPU_SSE42, MSGPACK_CPU_SSE42 | MSGPACK_CPU_AVX2, ~0u};
+    msgpack_buffer buf;
+    msgpack_reader reader;
+    msgpack_object obj;
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+        msgpack_cpu_set_features(levels[l]);
+        msgpack_buffer_init(&buf, 0);
+        msgpack_pack_str(&buf, valid, sizeof(valid) - 1);
+        msgpack_reader_init(&reader, buf.data, buf.length);
+        msgpack_reader_set_validate_utf8(&reader, true);
+        if (msgpack_read_object(&reader, &obj) != 0 || obj.as.str.size != sizeof(valid) - 1) return -1;
+        msgpack_buffer_free(&buf);
+        
+        /* the bad sequence is found both on its own and behind 40 bytes of
+         * ASCII, where the vector pass sees it */
+        for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+            char str[64];
+            memcpy(str, valid + 10, 40);
+            memcpy(str + 40, invalid[i].str, invalid[i].size);
+            msgpack_buffer_init(&buf, 0);
+            msgpack_pack_array(&buf, 2);
+            msgpack_pack_str(&buf, invalid[i].str, invalid[i].size);
+            size_t second = buf.length + 2;
+            msgpack_pack_str(&buf, str, 40 + invalid[i].size);
+            msgpack_reader_init(&reader, buf.data, buf.length);
+            msgpack_reader_set_validate_utf8(&reader, true);
+            if (msgpack_read_object(&reader, &obj) == 0) return -1;
+            if (reader.utf8_error_offset != 2 + invalid[i].offset) return -1;
+            reader.position = 2 + invalid[i].size;
+            if (msgpack_read_object_compact(&reader, &obj) == 0) return -1;
+            if (reader.utf8_error_offset != second + 40 + invalid[i].offset) return -1;
+            
+            /* the offset describes only the latest read: a successful one or
+             * a failure of another kind clears it */
+            reader.position = 1;
+            if (msgpack_skip_object(&reader) != 0 || reader.utf8_error_offset != SIZE_MAX) return -1;
+            reader.utf8_error_offset = 0;
+            reader.length = second;
+            if (msgpack_read_object(&reader, &obj) == 0 || reader.utf8_error_offset != SIZE_MAX) return -1;
+            if (!reader.validate_utf8) return -1;
+            reader.length = buf.length;
+            
+            /* off by default: the same bytes decode */
+            msgpack_reader_init(&reader, buf.data, buf.length);
+            if (msgpack_read_object(&reader, &obj) != 0) return -1;
+            msgpack_object_free(&obj);
+            msgpack_buffer_free(&buf);
+        }
+    }
+    msgpack_cpu_set_features(~0u);
+    return 0;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+static int pack_snapshot_row(msgpack_buffer *buf, uint32_t i) {
+    msgpack_pack_map(buf, 3);
+    msgpack_pack_str(buf, "id", 2);
+    msgpack_pack_uint(buf, i);
+    msgpack_pack_str(buf, "name", 4);
+    msgpack_pack_str(buf, "row", 3);
+    msgpack_pack_str(buf, "path", 4);
+    msgpack_pack_array(buf, i % 3);
+    for (uint32_t j = 0; j < i % 3; j++) {
+        msgpack_pack_int(buf, -(int64_t)j);
+    }
+    return 0;
+}
+
+int test_parallel_decode(void) {
+    const uint32_t rows = 20000;
+    msgpack_buffer buf;
+    msgpack_buffer_init(&buf, 0);
+    msgpack_pack_array(&buf, rows);
+    size_t middle = 0, last = 0;
+    for (uint32_t i = 0; i < rows; i++) {
+        if (i == rows / 2) {
+            middle = buf.length;
+        }
+        last = buf.length;
+        pack_snapshot_row(&buf, i);
+    }
+    msgpack_pool pool;
+    if (msgpack_pool_init(&pool, 4) != 0 || pool.thread_count != 4) return -1;
+    
+    /* the stitched tree is the same as a sequential decode, so it packs
+     * back to the input */
+    msgpack_reader reader;
+    msgpack_object obj;
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    if (msgpack_read_object_parallel(&reader, &obj, &pool) != 0 || msgpack_reader_remaining(&reader) != 0) return -1;
+    if (obj.as.array.size != rows || obj.as.array.ptr[rows - 1].as.map.ptr[0].value.as.u != rows - 1) return -1;
+    msgpack_serializer serializer;
+    msgpack_serializer_init(&serializer, 0);
+    if (msgpack_serialize(&serializer, &obj) != 0) return -1;
+    if (serializer.buffer.length != buf.length || memcmp(serializer.buffer.data, buf.data, buf.length) != 0) return -1;
+    msgpack_object_free_compact(&obj, NULL);
+    
+    /* with a zone the block comes from the zone, on the parallel and the
+     * sequential path alike */
+    msgpack_zone zone;
+    msgpack_zone_init(&zone, 0);
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    msgpack_reader_set_zone(&reader, &zone);
+    if (msgpack_read_object_parallel(&reader, &obj, &pool) != 0 || zone.used < rows * sizeof(msgpack_object)) return -1;
+    if (msgpack_serialize(&serializer, &obj) != 0 || memcmp(serializer.buffer.data, buf.data, buf.length) != 0) return -1;
+    msgpack_zone_reset(&zone);
+    uint8_t small[] = {0x92, 0x01, 0x91, 0x02};
+    msgpack_reader_init(&reader, small, sizeof(small));
+    msgpack_reader_set_zone(&reader, &zone);
+    if (msgpack_read_object_parallel(&reader, &obj, &pool) != 0 || zone.used == 0) return -1;
+    if (obj.as.array.ptr[1].as.array.ptr[0].as.u != 2) return -1;
+    msgpack_zone_free(&zone);
+    
+    /* a map root is cut between pairs */
+    msgpack_buffer map;
+    msgpack_buffer_init(&map, 0);
+    msgpack_pack_map(&map, rows);
+    for (uint32_t i = 0; i < rows; i++) {
+        msgpack_pack_uint(&map, i);
+        pack_snapshot_row(&map, i);
+    }
+    msgpack_reader_init(&reader, map.data, map.length);
+    if (msgpack_read_object_parallel(&reader, &obj, &pool) != 0 || obj.as.map.size != rows) return -1;
+    if (obj.as.map.ptr[rows - 1].key.as.u != rows - 1 || obj.as.map.ptr[rows - 1].value.as.map.size != 3) return -1;
+    if (msgpack_serialize(&serializer, &obj) != 0 || serializer.buffer.length != map.length) return -1;
+    if (memcmp(serializer.buffer.data, map.data, map.length) != 0) return -1;
+    msgpack_object_free_compact(&obj, NULL);
+    
+    /* only the cuts before the last chunk are scanned up front: the last
+     * chunk ends where its values do, so a message after the root is left
+     * unread, and a bad header in it fails the read. 3 threads do not
+     * divide the rows evenly. */
+    msgpack_pool odd;
+    if (msgpack_pool_init(&odd, 3) != 0) return -1;
+    size_t root_end = buf.length;
+    msgpack_pack_str(&buf, "next", 4);
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    if (msgpack_read_object_parallel(&reader, &obj, &odd) != 0 || reader.position != root_end) return -1;
+    if (msgpack_serialize(&serializer, &obj) != 0 || serializer.buffer.length != root_end) return -1;
+    if (memcmp(serializer.buffer.data, buf.data, root_end) != 0) return -1;
+    msgpack_object_free_compact(&obj, NULL);
+    buf.data[last] = 0xC1;
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    if (msgpack_read_object_parallel(&reader, &obj, &odd) == 0 || reader.position != 0) return -1;
+    buf.data[last] = 0x83;
+    buf.length = root_end;
+    msgpack_pool_free(&odd);
+    
+    /* truncated or malformed input fails and leaves the reader in place */
+    msgpack_reader_init(&reader, buf.data, buf.length - 1);
+    if (msgpack_read_object_parallel(&reader, &obj, &pool) == 0 || reader.position != 0) return -1;
+    buf.data[middle] = 0xC1;
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    if (msgpack_read_object_parallel(&reader, &obj, &pool) == 0 || reader.position != 0) return -1;
+    
+    /* nesting limits still count the root */
+    msgpack_reader_init(&reader, map.data, map.length);
+    msgpack_reader_set_max_depth(&reader, 2);
+    if (msgpack_read_object_parallel(&reader, &obj, &pool) == 0) return -1;
+    msgpack_reader_set_max_depth(&reader, 3);
+    if (msgpack_read_object_parallel(&reader, &obj, &pool) != 0) return -1;
+    msgpack_object_free_compact(&obj, NULL);
+    
+    /* a UTF-8 error inside a later chunk is reported at its input offset */
+    size_t bad = map.length - 4;
+    while (memcmp(map.data + bad, "\xA3row", 4) != 0) bad--;
+    map.data[bad + 2] = 0xFF;
+    msgpack_reader_init(&reader, map.data, map.length);
+    msgpack_reader_set_validate_utf8(&reader, true);
+    if (msgpack_read_object_parallel(&reader, &obj, &pool) == 0 || reader.utf8_error_offset != bad + 2) return -1;
+    
+    msgpack_serializer_free(&serializer);
+    msgpack_pool_free(&pool);
+    msgpack_buffer_free(&map);
+    msgpack_buffer_free(&buf);
+    return 0;
+}
+
+int test_serialize_batch(void) {
+    const size_t n = 1000;
+    msgpack_buffer source;
+    msgpack_buffer_init(&source, 0);
+    msgpack_pack_array(&source, (uint32_t)n);
+    for (uint32_t i = 0; i < n; i++) {
+        pack_snapshot_row(&source, i);
+    }
+    msgpack_reader reader;
+    msgpack_object rows;
+    msgpack_reader_init(&reader, source.data, source.length);
+    if (msgpack_read_object(&reader, &rows) != 0) return -1;
+    const msgpack_object *objs = rows.as.array.ptr;
+    
+    msgpack_pool pool;
+    if (msgpack_pool_init(&pool, 4) != 0) return -1;
+    msgpack_batch batch;
+    msgpack_batch_init(&batch, 0);
+    
+    /* offsets delimit each object's own encoding, in input order */
+    msgpack_serializer serializer;
+    msgpack_serializer_init(&serializer, 0);
+    for (int round = 0; round < 2; round++) {
+        if (msgpack_serialize_batch(objs, n, &pool, &batch) != 0 || batch.count != n || batch.offsets[0] != 0) return -1;
+        for (size_t i = 0; i < n; i++) {
+            if (msgpack_serialize(&serializer, &objs[i]) != 0) return -1;
+            if (batch.offsets[i + 1] - batch.offsets[i] != serializer.buffer.length) return -1;
+            if (memcmp(batch.buffer.data + batch.offsets[i], serializer.buffer.data, serializer.buffer.length) != 0) return -1;
+        }
+        if (batch.offsets[n] != batch.buffer.length) return -1;
+    }
+    
+    /* wrapped, the batch is one array message identical to the source */
+    msgpack_batch_set_wrap_array(&batch, true);
+    if (msgpack_serialize_batch(objs, n, &pool, &batch) != 0 || batch.buffer.length != source.length) return -1;
+    if (memcmp(batch.buffer.data, source.data, source.length) != 0 || batch.offsets[0] != 3) return -1;
+    
+    /* a single-thread pool encodes in place with the same result */
+    msgpack_pool single;
+    msgpack_pool_init(&single, 1);
+    if (msgpack_serialize_batch(objs, n, &single, &batch) != 0 || memcmp(batch.buffer.data, source.data, source.length) != 0) return -1;
+    msgpack_pool_free(&single);
+    
+    /* one object over the depth limit fails the whole batch */
+    msgpack_batch_set_max_depth(&batch, 1);
+    if (msgpack_serialize_batch(objs, n, &pool, &batch) == 0 || batch.buffer.length != 0) return -1;
+    if (msgpack_serialize_batch(objs, 0, &pool, &batch) != 0 || batch.count != 0 || batch.buffer.length != 1) return -1;
+    
+    /* a scratch buffer failing to initialise is retried by the next call,
+     * and the batch still frees every byte at its allocated size (no
+     * objects, so the non-thread-safe tracking heap is only used by the
+     * calling thread) */
+    tracking_heap heap = {0};
+    msgpack_allocator allocator = {tracking_allocate, tracking_reallocate, tracking_deallocate, &heap};
+    msgpack_batch tracked;
+    msgpack_batch_init_with_allocator(&tracked, 0, &allocator);
+    heap.limit = heap.allocations + 4;
+    if (msgpack_serialize_batch(objs, n, &pool, &tracked) == 0) return -1;
+    if (tracked.scratch_count >= pool.thread_count || tracked.scratch_capacity != pool.thread_count) return -1;
+    heap.limit = 0;
+    if (msgpack_serialize_batch(objs, 0, &pool, &tracked) != 0 || tracked.scratch_count != pool.thread_count) return -1;
+    msgpack_batch_free(&tracked);
+    if (heap.live_bytes != 0) return -1;
+    
+    msgpack_serializer_free(&serializer);
+    msgpack_batch_free(&batch);
+    msgpack_pool_free(&pool);
+    msgpack_object_free(&rows);
+    msgpack_buffer_free(&source);
+    return 0;
+}
+#endif
+
+int test_deep_nesting(void) {
+    const size_t depth = 200000;
+    msgpack_buffer buf;
+    msgpack_buffer_init(&buf, 0);
+    for (size_t i = 0; i < depth; i++) {
+        msgpack_pack_array(&buf, 1);
+    }
+    msgpack_pack_nil(&buf);
+    
+    tracking_heap heap = {0};
+    msgpack_allocator allocator = {tracking_allocate, tracking_reallocate, tracking_deallocate, &heap};
+    msgpack_reader reader;
+    msgpack_object out = {0};
+    
+    /* default limit rejects hostile nesting and frees the partial tree */
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    msgpack_reader_set_allocator(&reader, &allocator);
+    if (msgpack_read_object(&reader, &out) == 0) return -1;
+    if (heap.live_bytes != 0) return -1;
+    
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    msgpack_reader_set_max_depth(&reader, 10);
+    if (msgpack_read_object_compact(&reader, &out) == 0) return -1;
+    
+    /* truncated input frees the partial tree too */
+    msgpack_reader_init(&reader, buf.data, buf.length - 1);
+    msgpack_reader_set_allocator(&reader, &allocator);
+    msgpack_reader_set_max_depth(&reader, 0);
+    if (msgpack_read_object(&reader, &out) == 0) return -1;
+    if (heap.live_bytes != 0) return -1;
+    
+    /* unlimited depth decodes, re-encodes and frees without recursion */
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    msgpack_reader_set_max_depth(&reader, 0);
+    if (msgpack_read_object(&reader, &out) != 0) return -1;
+    
+    size_t size;
+    if (msgpack_object_packed_size(&out, &size) != 0 || size != buf.length) return -1;
+    msgpack_serializer serializer;
+    msgpack_serializer_init(&serializer, 0);
+    if (msgpack_serialize(&serializer, &out) == 0) return -1;
+    msgpack_serializer_set_max_depth(&serializer, 0);
+    if (msgpack_serialize(&serializer, &out) != 0) return -1;
+    if (serializer.buffer.length != buf.length || memcmp(serializer.buffer.data, buf.data, buf.length) != 0) return -1;
+    if (msgpack_serialize_sized(&serializer, &out) != 0) return -1;
+    if (serializer.buffer.length != buf.length || memcmp(serializer.buffer.data, buf.data, buf.length) != 0) return -1;
+    msgpack_object_free(&out);
+    
+    msgpack_reader_init(&reader, buf.data, buf.length);
+    msgpack_reader_set_max_depth(&reader, 0);
+    if (msgpack_read_object_compact(&reader, &out) != 0) return -1;
+    msgpack_object_free_compact(&out, NULL);
+    
+    msgpack_serializer_free(&serializer);
+    msgpack_buffer_free(&buf);
+    return 0;
+}
+
 int main(void) {
     printf("=== msgpack-c Functional Tests ===\n\n");
     
@@ -450,7 +2359,36 @@ int main(void) {
     test_case("fixmap", test_fixmap());
     test_case("binary", test_binary());
     test_case("timestamp", test_timestamp());
+    test_case("ext and timestamp formats", test_ext_formats());
     test_case("nested structures", test_nested());
+    test_case("buffer growth and reserve", test_buffer_growth());
+    test_case("packed size pre-pass", test_packed_size());
+    test_case("unchecked writer", test_writer_unchecked());
+    test_case("bounded stream buffer", test_stream_buffer());
+    test_case("custom allocator", test_custom_allocator());
+    test_case("zone-backed decode", test_zone_decode());
+    test_case("32-bit lengths", test_32bit_lengths());
+    test_case("two-pass compact decode", test_compact_decode());
+    test_case("deep nesting and depth limits", test_deep_nesting());
+    test_case("pull cursor", test_cursor());
+    test_case("SAX visitor parse", test_parse_visitor());
+    test_case("skip and validate", test_skip_and_validate());
+    test_case("structural tape index", test_tape_index());
+    test_case("lazy view path lookup", test_view_paths());
+    test_case("compiled projection", test_projection());
+    test_case("predicate filter", test_filter());
+    test_case("resumable unpacker", test_unpacker());
+    test_case("batch read_many", test_read_many());
+    test_case("message boundary scan", test_scan_boundaries());
+    test_case("CPU feature dispatch", test_cpu_features());
+    test_case("CPU kernels match scalar", test_cpu_kernels());
+    test_case("typed numeric arrays", test_typed_arrays());
+    test_case("UTF-8 validation", test_utf8_validation());
+#if defined(__unix__) || defined(__APPLE__)
+    test_case("iovec writer", test_iovec_writer());
+    test_case("parallel array decode", test_parallel_decode());
+    test_case("parallel batch encode", test_serialize_batch());
+#endif
     
     printf("\n=== Results: %d passed, %d failed ===\n", tests_passed, tests_failed);
     return tests_failed > 0 ? 1 : 0;